@@ -2,6 +2,7 @@
 #define NOOSKEWL_ENGINE_H
 
 #include "Nooskewl_Engine/a_star.h"
+#include "Nooskewl_Engine/asset_loader.h"
 #include "Nooskewl_Engine/brain.h"
 #include "Nooskewl_Engine/cpa.h"
 #include "Nooskewl_Engine/dllist.h"
@@ -9,27 +10,34 @@
 #include "Nooskewl_Engine/error.h"
 #include "Nooskewl_Engine/font.h"
 #include "Nooskewl_Engine/gui.h"
+#include "Nooskewl_Engine/hpa_star.h"
 #include "Nooskewl_Engine/image.h"
 #include "Nooskewl_Engine/internal.h"
 #include "Nooskewl_Engine/inventory.h"
 #include "Nooskewl_Engine/item.h"
+#include "Nooskewl_Engine/light_renderer.h"
 #include "Nooskewl_Engine/main.h"
 #include "Nooskewl_Engine/map.h"
 #include "Nooskewl_Engine/map_entity.h"
 #include "Nooskewl_Engine/map_logic.h"
 #include "Nooskewl_Engine/mml.h"
+#include "Nooskewl_Engine/path_cache.h"
+#include "Nooskewl_Engine/path_scheduler.h"
 #include "Nooskewl_Engine/player_brain.h"
+#include "Nooskewl_Engine/render_queue.h"
 #include "Nooskewl_Engine/sample.h"
 #include "Nooskewl_Engine/sound.h"
 #include "Nooskewl_Engine/speech.h"
 #include "Nooskewl_Engine/spell.h"
 #include "Nooskewl_Engine/sprite.h"
 #include "Nooskewl_Engine/stats.h"
+#include "Nooskewl_Engine/tile_sheet_cache.h"
 #include "Nooskewl_Engine/tilemap.h"
 #include "Nooskewl_Engine/tokenizer.h"
 #include "Nooskewl_Engine/translation.h"
 #include "Nooskewl_Engine/tween.h"
 #include "Nooskewl_Engine/basic_types.h"
+#include "Nooskewl_Engine/vertex_buffer.h"
 #include "Nooskewl_Engine/vertex_cache.h"
 #include "Nooskewl_Engine/widgets.h"
 #include "Nooskewl_Engine/xml.h"
@@ -10,32 +10,65 @@ class Map;
 
 class A_Star {
 public:
-	struct Node {
-		Node *parent;
-		Point<int> position;
-		int cost_from_start;
-		int cost_to_goal;
-		int total_cost;
+	// Tiles to step onto in order, not including the start
+	typedef std::vector< Point<int> > Path;
+
+	enum Search_State {
+		SEARCHING,
+		FOUND,
+		FAILED
 	};
 
 	A_Star(Map *map);
 	~A_Star();
 
-	std::list<Node *> find_path(Point<int> start, Point<int> goal, bool check_solids = true);
+	Path find_path(Point<int> start, Point<int> goal, bool check_solids = true);
+	// Only through tiles in the box (inclusive)
+	Path find_path(Point<int> start, Point<int> goal, bool check_solids, Point<int> topleft, Point<int> bottomright);
+
+	// For spreading a search over several frames. find_path uses the same
+	// state, so don't call it on this A_Star while a search is going.
+	void start_search(Point<int> start, Point<int> goal, bool check_solids, Point<int> topleft, Point<int> bottomright);
+	// Looks at up to max_nodes more tiles, adding how many it did to count
+	Search_State step(int max_nodes, int &count);
+	Path get_path(); // once step returns FOUND
 
 private:
-	Node *find_in_list(Point<int> position, std::list<Node *> &list);
-	void remove_from_list(Node *node, std::list<Node *> &list);
-	void add_to_open(Node *node);
-	void destroy_nodes(std::list<Node *> &list);
-	void branch(Node *node, Point<int> offset, Point<int> goal, bool check_solids = true);
+	// One per tile. Only valid if generation is the current search's, so
+	// nothing is cleared between searches.
+	struct Node {
+		Uint32 generation;
+		int parent; // tile index, -1 for the start
+		int cost_from_start;
+		bool closed;
+	};
+
+	// Entries in the open heap. A tile is pushed again when a cheaper way to
+	// it is found and the old entry is skipped when it comes up.
+	struct Open_Node {
+		int index;
+		int cost_from_start;
+		int total_cost;
+	};
+
+	static bool open_order(const Open_Node &a, const Open_Node &b);
+
+	Node &get_node(int index); // starts it for this search if it isn't yet
 	int heuristic(Point<int> start, Point<int> end);
 
 	Map *map;
-	Node *final_node;
 
-	std::list<Node *> open;
-	std::list<Node *> closed;
+	Size<int> size; // of the tilemap when nodes was made
+	std::vector<Node> nodes; // by y * size.w + x
+	std::vector<Open_Node> open; // binary heap, cheapest first
+	Uint32 generation;
+
+	Search_State state;
+	Point<int> goal;
+	int goal_index;
+	bool check_solids;
+	Point<int> topleft;
+	Point<int> bottomright;
 };
 
 } // End namespace Nooskewl_Engine
@@ -0,0 +1,126 @@
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include "Nooskewl_Engine/main.h"
+#include "Nooskewl_Engine/basic_types.h"
+
+namespace Nooskewl_Engine {
+
+class Image;
+class MML;
+class Sample;
+class Tilemap;
+class XML;
+
+// Reads and decodes assets on a pool of worker threads. Images are decoded on
+// the workers and uploaded on the main thread in update(), after which they
+// are in the Image cache so new Image(filename) is free while the handle is
+// held. Filenames are the same as you'd pass to each class's constructor.
+class NOOSKEWL_ENGINE_EXPORT Asset_Loader {
+public:
+	typedef int Handle; // 0 is never a valid handle
+
+	enum Priority {
+		LOW = 0,
+		NORMAL = 10,
+		HIGH = 20,
+		IMMEDIATE = 30 // something is waiting on it
+	};
+
+	Asset_Loader(int num_threads = 0); // 0 = one per extra CPU core, at least 1
+	~Asset_Loader();
+
+	Handle load_image(std::string filename, bool is_absolute_path = false, int priority = NORMAL);
+	Handle load_xml(std::string filename, int priority = NORMAL);
+	Handle load_sample(std::string filename, int priority = NORMAL);
+	Handle load_mml(std::string filename, int priority = NORMAL);
+	// Takes the map name as passed to Map. Nothing in the Tilemap constructor
+	// touches the GPU, so the whole thing is made on a worker.
+	Handle load_tilemap(std::string map_name, int priority = NORMAL);
+	// Decoded TGA pixels (bottom row first), never uploaded
+	Handle load_pixels(std::string filename, int priority = NORMAL);
+
+	void set_priority(Handle handle, int priority);
+	bool is_ready(Handle handle); // true once loaded or failed
+	bool failed(Handle handle);
+	void wait(Handle handle); // main thread only
+
+	// These wait if needed and give you the asset (0 if it failed to load).
+	// The handle is no longer valid after.
+	Image *get_image(Handle handle);
+	XML *get_xml(Handle handle);
+	Sample *get_sample(Handle handle);
+	MML *get_mml(Handle handle);
+	Tilemap *get_tilemap(Handle handle);
+	unsigned char *get_pixels(Handle handle, Size<int> &size); // delete[] them
+
+	// Cancel or free a handle you don't want to get_* from
+	void release(Handle handle);
+
+	// If this image (full path) is queued or loading, finish it now. Used by
+	// Image so a synchronous load doesn't decode the same file twice.
+	bool finish_image(std::string filename);
+
+	void update(); // call once per frame from the main thread, uploads decoded images
+
+	int get_pending_count();
+
+private:
+	enum Type {
+		IMAGE,
+		XML_FILE,
+		SAMPLE,
+		MML_FILE,
+		TILEMAP,
+		PIXELS
+	};
+
+	enum State {
+		QUEUED,
+		LOADING,
+		DECODED, // images only, waiting for upload
+		READY,
+		FAILED
+	};
+
+	struct Request {
+		Type type;
+		std::string filename;
+		int priority;
+		State state;
+		bool cancelled; // released while loading, worker deletes it
+		unsigned char *pixels;
+		Size<int> size;
+		Image *image;
+		XML *xml;
+		Sample *sample;
+		MML *mml;
+		Tilemap *tilemap;
+	};
+
+	static int thread_main(void *data);
+
+	static const Uint32 UPLOAD_BUDGET = 4; // ms per update() spent on uploads
+
+	Handle add(Type type, std::string filename, int priority);
+	Request *get(Handle handle);
+	void run();
+	void decode(Request *r);
+	void finish(Request *r); // main thread, call without the lock held
+	void destroy(Request *r);
+
+	std::vector<SDL_Thread *> threads;
+	SDL_mutex *mutex;
+	SDL_cond *queue_cond; // signalled when something is queued or on quit
+	SDL_cond *done_cond; // signalled when a worker finishes something
+	bool quit;
+
+	std::vector<Request *> queue;
+	std::vector<Request *> released; // released while loading, freed in update()
+	std::map<Handle, Request *> requests;
+	Handle next_handle;
+};
+
+} // End namespace Nooskewl_Engine
+
+#endif // ASSET_LOADER_H
@@ -1,6 +1,8 @@
 // Crystal Picnic Archive: archive format created for the game Crystal Picnic.
-// Basically all the files catted together with an index at the end, then
-// optionally gzipped.
+// Version 1 is basically all the files catted together with an index at the
+// end, then optionally gzipped. Version 2 has a binary index at the start of
+// the file, compresses each file on its own and is memory mapped so only the
+// files that are actually used are ever read/decompressed.
 
 #ifndef CPA_H
 #define CPA_H
@@ -15,13 +17,44 @@ public:
 	SDL_RWops *open(std::string filename);
 	bool exists(std::string filename);
 	std::vector<std::string> get_all_filenames();
+	// All files that start with prefix, e.g. "sprites/pleasant/"
+	std::vector<std::string> get_filenames(std::string prefix);
 
 	CPA();
 	~CPA();
 
 private:
+	struct Entry {
+		const char *name; // not NUL terminated
+		Uint32 name_length;
+		Uint32 offset; // from start of bytes
+		Uint32 stored_size;
+		Uint32 size;
+		bool compressed;
+		Uint8 *inflated; // decompressed on first open
+	};
+
+	struct Name_Less {
+		const std::vector<Entry> *entries;
+		bool operator()(int a, int b) const;
+	};
+
+	static Uint32 hash_name(const char *name, Uint32 length);
+
+	int find(const std::string &filename);
+	void build_hash_table();
+	void build_sorted_list();
+	void load_v1(std::string filename);
+	void load_v2(std::string filename);
+	bool map_file(std::string filename);
+	void unmap_file();
+
 	Uint8 *bytes;
-	std::map< std::string, std::pair<int, int> > info; // offset, size
+	size_t mapped_size; // 0 if bytes isn't memory mapped
+	std::vector<Entry> entries;
+	std::vector<Uint32> hash_table; // pairs of hash, entry index + 1 (0 = empty slot)
+	std::vector<int> sorted; // entry indices sorted by name
+	SDL_mutex *mutex; // open can be called from Asset_Loader threads
 	bool load_from_filesystem;
 };
 
@@ -6,6 +6,7 @@
 
 namespace Nooskewl_Engine {
 
+class Asset_Loader;
 class Brain;
 class CPA;
 class Font;
@@ -16,6 +17,7 @@ class Map_Entity;
 class MML;
 class Shader;
 class Stats;
+class Tilemap;
 class Translation;
 class XML;
 
@@ -37,12 +39,14 @@ public:
 	float scale;
 	float font_scale;
 	bool use_hires_font;
+	bool use_sdf_font; // distance field glyphs that scale without reloading fonts (OpenGL only)
 	Size<int> real_screen_size;
 	Size<int> screen_size;
 	Point<int> screen_offset;
 	int tile_size;
 	bool fullscreen;
 	bool opengl;
+	bool gpu_lighting; // Tilemap lighting done by Light_Renderer
 	SDL_Colour colours[256];
 	SDL_Colour shadow_colour;
 	SDL_Colour four_blacks[4];
@@ -79,6 +83,7 @@ public:
 	Translation *t;
 	Translation *game_t;
 	CPA *cpa;
+	Asset_Loader *asset_loader;
 	Map *map;
 	std::string last_map_name;
 	Map_Entity *player;
@@ -117,6 +122,7 @@ public:
 	void set_screen_size(int w, int h);
 	void set_default_projection();
 	void set_map_transition_projection(float angle);
+	void get_matrices(glm::mat4 &model, glm::mat4 &view, glm::mat4 &proj);
 	void set_matrices(glm::mat4 &model, glm::mat4 &view, glm::mat4 &proj);
 	void update_projection();
 
@@ -151,6 +157,8 @@ public:
 	float get_day_time(); // 0.0f - 1.0f (midnight AM to midnight PM)
 
 	bool save_map(Map *map, bool save_player);
+	// For Map, the prefetched Tilemap of a map reached from the last one or 0
+	Tilemap *take_prefetched_tilemap(std::string map_name);
 
 	void add_notification(std::string text);
 
@@ -174,6 +182,8 @@ private:
 	void load_translation();
 	void clear_buffers();
 	void setup_default_shader();
+	void prefetch_exits();
+	void update_prefetch();
 
 	bool save_milestones(SDL_RWops *file);
 	bool load_milestones(SDL_RWops *file, int version);
@@ -239,6 +249,13 @@ private:
 	Direction new_map_direction;
 	static const int map_transition_duration = 500;
 
+	// Assets for the maps reachable from the current one, loading in the background
+	std::string prefetched_map_name;
+	std::vector<int> prefetch_handles; // Asset_Loader::Handle
+	std::map<std::string, int> prefetch_tilemap_handles; // by map name, still loading
+	std::map<std::string, Tilemap *> prefetched_tilemaps;
+	std::map<std::string, std::vector<std::string> > known_exits; // maps changed to from each map this session
+
 	Uint32 fancy_draw_start;
 
 	int loaded_time;
@@ -3,6 +3,7 @@
 
 #include "Nooskewl_Engine/main.h"
 #include "Nooskewl_Engine/basic_types.h"
+#include "Nooskewl_Engine/utf8.h"
 
 namespace Nooskewl_Engine {
 
@@ -16,34 +17,107 @@ public:
 		FULL_SHADOW
 	};
 
+	// With +sdf-font glyphs are made at this many font pixels per game pixel
+	static const int SDF_SCALE = 4;
+
 	Font(std::string filename, int size);
 	~Font();
 
 	void clear_cache();
 
-	float get_text_width(std::string text);
+	float get_text_width(const std::string &text);
 	float get_height();
 
 	void enable_shadow(SDL_Colour shadow_colour, Shadow_Type shadow_type);
 	void disable_shadow();
 
-	void draw(SDL_Colour colour, std::string text, Point<float> dest_position);
+	void draw(SDL_Colour colour, const std::string &text, Point<float> dest_position);
 	// Returns number of characters drawn, plus whether or not it filled the max in bool &full
-	int draw_wrapped(SDL_Colour colour, std::string text, Point<float> dest_position, int w, int line_height, int max_lines, int started_time, int delay, bool dry_run, bool &full, int &num_lines, int &width);
+	int draw_wrapped(SDL_Colour colour, const std::string &text, Point<float> dest_position, int w, int line_height, int max_lines, int started_time, int delay, bool dry_run, bool &full, int &num_lines, int &width);
 
 private:
+	static const int PAGE_SIZE = 512;
+	static const int MAX_PAGES = 8; // past this the least recently used is emptied for new glyphs
+	static const int MAX_LAYOUTS = 32; // least recently used are dropped past this
+	static const int MAX_TEXT_WIDTHS = 256; // all are dropped past this
+	static const int SDF_SPREAD = 12; // furthest distance stored in a distance field, in font pixels
+
+	struct Glyph {
+		int page; // -1 if there's nothing to draw (empty or couldn't be rendered)
+		Point<int> position; // top left in the page, glyph_padding in from its cell
+		Size<int> size;
+	};
+
+	// Glyphs are shelf packed into pages as they're first used. A new page is
+	// started when one fills up.
+	struct Page {
+		// Bottom row first like Image::read_tga. With +sdf-font they're one byte
+		// of distance field each and image is alpha only.
+		unsigned char *pixels;
+		Image *image; // made when first drawn
+		// Part of pixels changed since image was last updated, in pixels rows
+		// (bottom right exclusive). Empty if it's up to date.
+		Point<int> dirty_topleft;
+		Point<int> dirty_bottomright;
+		Point<int> next; // where the next glyph goes on the current shelf
+		int shelf_height;
+		Uint32 last_used; // glyph_clock when a glyph on it was last looked up
+	};
+
+	// A line of draw_wrapped when all the text is shown. With less shown it's
+	// cut short and the rest is worked out from these.
+	struct Line {
+		int start; // in characters
+		int length; // characters drawn
+		int scanned; // characters looked at finding the break
+		Uint32 end_char; // the one that caused the break, 0 at the end of the text
+		bool empty; // broke on the first character, draw_wrapped stops here
+		float width; // in font pixels
+	};
+
+	// Where a text breaks into lines for a width, so draw_wrapped only has to
+	// decide how much of it to show each frame
+	struct Layout {
+		std::vector<Uint32> chars; // 0 terminated
+		std::vector<int> offsets; // byte offset of each character, and the end
+		std::vector<Line> lines; // the last one repeats if it doesn't move the text along
+		Uint32 last_used;
+	};
+
+	void draw_range(SDL_Colour colour, UTF8_Iterator begin, UTF8_Iterator end, Point<float> dest_position);
+	// Text and shadow in one pass with the shadow shader (OpenGL)
+	void draw_with_shadow(SDL_Colour colour, UTF8_Iterator begin, UTF8_Iterator end, Point<float> dest_position, std::vector<Image *> &page_images);
+	// Text and any shadow from distance fields in one pass (+sdf-font)
+	void draw_sdf(SDL_Colour colour, UTF8_Iterator begin, UTF8_Iterator end, Point<float> dest_position, std::vector<Image *> &page_images);
+	float get_drop_shadow_distance(); // in font pixels
+
+	Layout &get_layout(const std::string &text, int w);
+	void build_layout(Layout &layout, const std::string &text, int w);
+
+	// Call cache_glyph for every glyph about to be used after advancing
+	// glyph_clock, so none of them are evicted until the clock moves on
 	void cache_glyph(Uint32 ch);
-	void cache_glyphs(std::string text);
+	void cache_glyphs(UTF8_Iterator begin, UTF8_Iterator end);
+	int get_empty_page(); // a new one, or the least recently used emptied
+	Image *get_page_image(int page); // uploads any glyphs added since last time
 
 	SDL_RWops *file;
 	TTF_Font *font;
 
-	std::map<Uint32, Image *> glyphs;
+	std::map<Uint32, Glyph> glyphs;
+	std::vector<Page> pages;
+	int current_page; // the one glyphs are being added to
+	Uint32 glyph_clock;
+
+	std::map<std::pair<std::string, int>, Layout> layouts; // by text and width
+	Uint32 layout_clock;
+	std::map<std::string, float> text_widths;
 
 	SDL_Colour shadow_colour;
 	Shadow_Type shadow_type;
 
 	int size;
+	int glyph_padding; // empty pixels around each glyph in the pages
 };
 
 } // End namespace Nooskewl_Engine
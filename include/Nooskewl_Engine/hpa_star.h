@@ -0,0 +1,113 @@
+#ifndef HPA_STAR_H
+#define HPA_STAR_H
+
+#include "Nooskewl_Engine/main.h"
+#include "Nooskewl_Engine/a_star.h"
+#include "Nooskewl_Engine/basic_types.h"
+
+namespace Nooskewl_Engine {
+
+class Map;
+
+// Hierarchical A* for long paths. The map is split into clusters and the
+// places paths can cross between neighbouring clusters (entrances) are joined
+// into a graph, with the costs across each cluster worked out ahead of time.
+// A long path is found on that graph and then filled in a cluster at a time
+// with A_Star.
+//
+// The graph only knows about solid tiles. Entities are avoided when filling
+// in, and if they block the way the whole path is found with A_Star instead.
+class HPA_Star {
+public:
+	static const int CLUSTER_SIZE = 16; // in tiles
+
+	HPA_Star(Map *map, A_Star *a_star);
+	~HPA_Star();
+
+	A_Star::Path find_path(Point<int> start, Point<int> goal);
+
+	// Call if tile solidity in the box (inclusive, in tiles) changes. The
+	// clusters touching it are rebuilt before the next search.
+	void invalidate(Point<int> topleft, Point<int> bottomright);
+
+private:
+	static const int MAX_ENTRANCE_WIDTH = 6; // wider get a node at each end instead of one in the middle
+
+	struct Edge {
+		int node;
+		int cost;
+	};
+
+	// Nodes come in pairs, one each side of an entrance
+	struct Node {
+		Point<int> position;
+		int cluster;
+		int partner; // the node across the entrance
+		std::vector<Edge> edges; // to the other nodes of the cluster it can reach
+	};
+
+	// Between a cluster and the one east (vertical) or south of it
+	struct Border {
+		int cluster;
+		int other;
+		bool vertical;
+		std::vector<int> nodes;
+	};
+
+	struct Cluster {
+		Point<int> topleft;
+		Point<int> bottomright; // inclusive
+		std::vector<int> borders;
+		std::vector<int> nodes;
+		bool dirty;
+	};
+
+	// Abstract search state, stamped like A_Star's nodes
+	struct Search_Node {
+		Uint32 generation;
+		int parent;
+		int cost_from_start;
+		bool closed;
+	};
+
+	struct Open_Node {
+		int node;
+		int cost_from_start;
+		int total_cost;
+	};
+
+	static bool open_order(const Open_Node &a, const Open_Node &b);
+
+	void build();
+	void rebuild_dirty();
+	void build_border(int border);
+	void build_edges(int cluster);
+	int add_node(Point<int> position, int cluster);
+	void free_node(int node);
+	// Walking distance within a cluster from one tile to every tile, -1 if unreachable
+	void get_distances(int cluster, Point<int> from, std::vector<int> &distances);
+	int get_cluster(Point<int> position);
+	bool is_walkable(Point<int> position);
+	int heuristic(Point<int> start, Point<int> end);
+
+	Map *map;
+	A_Star *a_star;
+
+	Size<int> size; // of the tilemap in tiles
+	Size<int> num_clusters;
+	std::vector<Cluster> clusters;
+	std::vector<Border> borders;
+	std::vector<Node> nodes;
+	std::vector<int> free_nodes;
+	bool built;
+
+	std::vector<int> distances; // get_distances scratch
+	std::vector<Point<int> > queue;
+	std::vector<Search_Node> search_nodes;
+	std::vector<Open_Node> open;
+	Uint32 generation;
+};
+
+} // End namespace Nooskewl_Engine
+
+#endif // HPA_STAR_H
@@ -6,10 +6,12 @@
 
 namespace Nooskewl_Engine {
 
+class Asset_Loader;
 class Shader;
 
 class NOOSKEWL_ENGINE_EXPORT Image {
 public:
+	friend class NOOSKEWL_ENGINE_EXPORT Asset_Loader;
 	friend class NOOSKEWL_ENGINE_EXPORT Shader;
 	friend class NOOSKEWL_ENGINE_EXPORT Vertex_Cache;
 
@@ -22,6 +24,7 @@ public:
 	static void reload_all();
 	static int get_unfreed_count();
 	static unsigned char *read_tga(std::string filename, Size<int> &out_size, SDL_Colour *out_palette = 0);
+	static bool read_tga_size(std::string filename, Size<int> &out_size); // just reads the header
 
 	static bool dumping_colours;
 	static bool keep_data;
@@ -34,6 +37,9 @@ public:
 	Image(std::string filename, bool is_absolute_path = false);
 	Image(SDL_Surface *surface);
 	Image(Size<int> size);
+	// pixels laid out like read_tga returns them, not kept. alpha_only images
+	// have a byte of alpha per pixel and draw black.
+	Image(unsigned char *pixels, Size<int> size, bool alpha_only = false);
 	~Image();
 
 	void release();
@@ -41,6 +47,10 @@ public:
 
 	bool save(std::string filename);
 
+	// Uploads just the region (in pixels) from pixels, which are the whole
+	// image laid out like the constructor takes them
+	void update_region(unsigned char *pixels, Point<int> position, Size<int> region_size);
+
 	void start(bool repeat = false); // call before every group of draws of the same Image
 	void end(); // call after every group of draws
 
@@ -89,16 +99,21 @@ private:
 		SDL_Colour palette[256];
 	};
 
+	// Used by Asset_Loader, takes ownership of pixels (from read_tga)
+	Image(std::string filename, unsigned char *pixels, Size<int> size);
+
 	static void merge_bytes(unsigned char *pixel, unsigned char *p, int bytes, TGA_Header *header);
 
 	unsigned char find_colour_in_palette(unsigned char *p);
 
 	struct Internal {
 		Internal(std::string filename, bool keep_data, bool support_render_to_texture = false);
-		Internal(unsigned char *pixels, Size<int> size, bool support_render_to_texture = false);
+		Internal(unsigned char *pixels, Size<int> size, bool support_render_to_texture = false, bool alpha_only = false);
+		Internal(std::string filename, unsigned char *pixels, Size<int> size, bool keep_data);
 		~Internal();
 
 		void upload(unsigned char *pixels);
+		void upload_region(unsigned char *pixels, Point<int> position, Size<int> region_size);
 
 		void release();
 		unsigned char *reload(bool keep_data);
@@ -110,6 +125,7 @@ private:
 		int refcount;
 
 		bool has_render_to_texture;
+		bool alpha_only; // not with render to texture
 
 	#ifdef NOOSKEWL_ENGINE_WINDOWS
 		LPDIRECT3DTEXTURE9 video_texture;
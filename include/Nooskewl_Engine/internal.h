@@ -7,8 +7,12 @@
 namespace Nooskewl_Engine {
 
 class Brain;
+class Light_Renderer;
 class Map_Logic;
+class Render_Queue;
 struct SampleInstance;
+class Shader;
+class Tile_Sheet_Cache;
 class Vertex_Cache;
 
 typedef bool (*DLL_Start)();
@@ -23,6 +27,10 @@ typedef bool (*Event_Handler)(SDL_Event *event);
 void load_dll();
 void close_dll();
 
+// Run with +benchmark-tilemap and +benchmark-paths, log timings and exit
+void benchmark_tilemap();
+void benchmark_paths();
+
 #ifdef NOOSKEWL_ENGINE_WINDOWS
 /* MSVC doesn't have snprintf */
 
@@ -54,6 +62,11 @@ struct Module {
 	std::vector<SampleInstance *> playing_samples;
 	// graphics
 	Vertex_Cache *vertex_cache;
+	Tile_Sheet_Cache *tile_sheet_cache;
+	Light_Renderer *light_renderer; // 0 without +gpu-lighting
+	Render_Queue *render_queue; // map entities and text
+	Shader *text_shadow_shader; // made by Font when first needed, OpenGL only
+	Shader *sdf_text_shader; // same, for +sdf-font
 };
 
 class List_Directory {
@@ -0,0 +1,46 @@
+#ifndef LIGHT_RENDERER_H
+#define LIGHT_RENDERER_H
+
+#include "Nooskewl_Engine/main.h"
+#include "Nooskewl_Engine/basic_types.h"
+
+namespace Nooskewl_Engine {
+
+class Image;
+class Shader;
+class Vertex_Buffer;
+
+// Lights drawn per pixel on the GPU (+gpu-lighting, OpenGL only) instead of
+// per tile on the CPU. Lights are added up in a screen sized buffer which then
+// multiplies whatever was drawn.
+class NOOSKEWL_ENGINE_EXPORT Light_Renderer {
+public:
+	Light_Renderer();
+	~Light_Renderer();
+
+	// Clears the light buffer to base and makes it the target
+	void start(SDL_Colour base);
+	// position, reach and falloff are in tiles, map_offset is where the map is
+	// drawn. occluder has a pixel per tile with the height of the highest wall
+	// on it + 1 in red (0 = no wall), walls as high as the light block it.
+	void draw_light(Point<float> map_offset, Vec3D<float> position, SDL_Colour colour, float reach, float falloff, Image *occluder);
+	// Goes back to the old target and multiplies it by the light buffer
+	void end();
+
+private:
+	Shader *shader;
+	Vertex_Buffer *quad;
+	Image *buffer;
+
+	// Restored in end
+	Image *old_target;
+	Shader *old_shader;
+	bool old_depth_buffer_enabled;
+	glm::mat4 old_model;
+	glm::mat4 old_view;
+	glm::mat4 old_proj;
+};
+
+} // End namespace Nooskewl_Engine
+
+#endif // LIGHT_RENDERER_H
@@ -26,6 +26,7 @@
 
 #include <algorithm>
 #include <functional>
+#include <iterator>
 #include <list>
 #include <map>
 #include <string>
@@ -49,9 +50,12 @@
 #include <d3dx9.h>
 #else
 #include <dlfcn.h>
+#include <fcntl.h>
 #include <glob.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 #ifdef __linux__
 // X11 pollutes the global namespace and conflicts with some of our names
 namespace X11 {
@@ -7,8 +7,12 @@
 
 namespace Nooskewl_Engine {
 
+class HPA_Star;
+class Light_Brain;
 class Map_Entity;
 class Map_Logic;
+class Path_Cache;
+class Path_Scheduler;
 class Speech;
 class Tilemap;
 
@@ -16,10 +20,24 @@ class NOOSKEWL_ENGINE_EXPORT Map {
 public:
 	static const float PAN_BACK_SPEED;
 
+	// Entities with Light_Brains, kept up to date as entities come and go.
+	// The light data is copied from the brains once per update so lighting
+	// code can loop over it without finding the lights or calling into brains.
+	struct Lights {
+		std::vector<Map_Entity *> entities;
+		std::vector<Light_Brain *> brains;
+		std::vector< Vec3D<float> > positions;
+		std::vector<SDL_Colour> colours;
+		std::vector<float> reaches;
+		std::vector<float> falloffs;
+	};
+
 	static void new_game_started();
 	static void sit_sleep_callback(void *data);
 
 	Map(std::string map_name, bool been_here_before, int last_visited_time);
+	// Takes tilemap, with no Map_Logic. For benchmarks.
+	Map(Tilemap *tilemap);
 	~Map();
 
 	void start_audio();
@@ -37,6 +55,7 @@ public:
 	void schedule_destroy(Map_Entity *entity);
 
 	void add_entity(Map_Entity *entity);
+	void update_light(Map_Entity *entity); // call when an entity's brain changes
 	void add_speech(Speech *speech);
 	void add_speech(std::string text, Callback callback = NULL, void *callback_data = NULL);
 	void change_map(std::string map_name, Point<int> position, Direction direction);
@@ -45,6 +64,11 @@ public:
 
 	std::vector<Map_Entity *> get_colliding_entities(int layer, Point<int> position, Size<int> size);
 	bool is_solid(int layer, Map_Entity *collide_with, Point<int> position, Size<int> size, bool check_entities = true, bool check_tiles = true);
+	// Call when an entity moves or changes size or solidity
+	void invalidate_occupancy();
+	// Changes whenever solid entities cover different tiles, so a search
+	// that's been going on a while may be wrong
+	Uint32 get_occupancy_version();
 	void check_triggers(Map_Entity *entity);
 	void get_new_map_details(std::string &map_name, Point<int> &position, Direction &direction);
 	Map_Entity *get_entity(int id);
@@ -53,20 +77,46 @@ public:
 	Tilemap *get_tilemap();
 	Point<float> get_offset();
 	Point<float> get_pan();
-	std::list<A_Star::Node *> find_path(Point<int> start, Point<int> goal, bool check_solids = true);
+	// Long paths come from HPA_Star and can be a little longer than needed.
+	// shortest always uses A_Star, for paths the player will see picked.
+	A_Star::Path find_path(Point<int> start, Point<int> goal, bool check_solids = true, bool shortest = false);
+	// Like find_path but spread over frames, see Path_Scheduler. Requests with
+	// an entity as callback_data are cancelled when it's removed.
+	int request_path(Point<int> start, Point<int> goal, bool check_solids, Callback callback, void *callback_data = NULL);
+	Path_Scheduler *get_path_scheduler();
+	Path_Cache *get_path_cache();
+	// The cache with the checks find_path uses. Cached paths with check_solids
+	// are only found if no solid entity stands on them now.
+	bool find_cached_path(Point<int> start, Point<int> goal, bool check_solids, A_Star::Path &path);
+	bool is_path_clear(const A_Star::Path &path); // of solid entities
+	void cache_path(Point<int> start, Point<int> goal, bool check_solids, const A_Star::Path &path);
 	bool is_speech_active();
 	Map_Logic *get_map_logic();
 	std::vector<Map_Entity *> &get_entities();
+	Lights &get_lights();
 
 	bool save(std::string &out, bool save_player);
 
 private:
+	void remove_light(Map_Entity *entity);
+	void refresh_light(int index);
+	void update_occupancy();
+	bool is_occupied(Point<int> position, Size<int> size); // by a solid entity
+	static bool path_is_clear(const A_Star::Path &path, void *data); // a Path_Cache::Path_Check
+
 	Tilemap *tilemap;
 	Point<float> offset;
 	bool panning;
 	Point<float> pan;
 	float pan_angle;
 	std::vector<Map_Entity *> entities;
+	Lights lights;
+
+	// Bit per tile with a solid entity on it, for checks that don't need to
+	// know which entities collide. Remade when used after being invalidated.
+	std::vector<Uint32> occupancy;
+	bool occupancy_dirty;
+	Uint32 occupancy_version;
 
 	std::vector<Speech *> speeches;
 	Speech *speech;
@@ -79,6 +129,9 @@ private:
 	Map_Logic *ml;
 
 	A_Star *a_star;
+	HPA_Star *hpa_star;
+	Path_Scheduler *path_scheduler;
+	Path_Cache *path_cache;
 
 	std::vector<Map_Entity *> entities_to_destroy;
 
@@ -9,6 +9,7 @@ namespace Nooskewl_Engine {
 
 class Brain;
 class Map;
+class Render_Queue;
 class Sprite;
 class Stats;
 
@@ -36,7 +37,7 @@ public:
 	void set_solid(bool solid);
 	void set_sitting(bool sitting);
 	void set_sleeping(bool sleeping);
-	void set_path(std::list<A_Star::Node *> path, Callback callback = NULL, void *callback_data = NULL);
+	void set_path(const A_Star::Path &path, Callback callback = NULL, void *callback_data = NULL);
 	void set_input_enabled(bool enabled);
 	void set_type(Type type);
 	void load_stats(std::string name);
@@ -52,9 +53,11 @@ public:
 	void set_stop_next_tile(bool stop_next_tile);
 	void set_speed(float speed);
 	void set_should_face_activator(bool should_face);
+	void set_map(Map *map); // by Map::add_entity
 
 	int get_id();
 	std::string get_name();
+	Map *get_map();
 	Brain *get_brain();
 	Sprite *get_sprite();
 	Direction get_direction();
@@ -92,7 +95,8 @@ public:
 	// return false to destroy
 	bool update(bool can_move);
 	// draws with z values
-	void draw(Point<float> draw_pos, bool use_depth_buffer = true, bool sitting_n = false);
+	// With a queue the entity is added to it to be drawn on the next flush
+	void draw(Point<float> draw_pos, bool use_depth_buffer = true, bool sitting_n = false, Render_Queue *queue = 0);
 
 	bool save(std::string &out);
 
@@ -106,6 +110,7 @@ private:
 
 	int id;
 	std::string name;
+	Map *map; // the one it was added to, told when it moves
 	Direction direction;
 	Sprite *sprite;
 	Brain *brain;
@@ -123,7 +128,8 @@ private:
 	bool input_enabled;
 
 	bool following_path;
-	std::list<A_Star::Node *> path;
+	A_Star::Path path;
+	size_t path_step; // next tile in path
 	Callback path_callback;
 	void *path_callback_data;
 
@@ -16,6 +16,9 @@ public:
 	virtual void update();
 	virtual void activate(Map_Entity *activator, Map_Entity *activated);
 	virtual Map_Entity *mutate_loaded_entity(Map_Entity *entity);
+	// Names of the maps this map's triggers can lead to, these are loaded in the background.
+	// Without this only maps already gone to from here this session are.
+	virtual std::vector<std::string> get_exits();
 };
 
 } // End namespace Nooskewl_Engine
@@ -0,0 +1,64 @@
+#ifndef PATH_CACHE_H
+#define PATH_CACHE_H
+
+#include "Nooskewl_Engine/main.h"
+#include "Nooskewl_Engine/a_star.h"
+#include "Nooskewl_Engine/basic_types.h"
+
+namespace Nooskewl_Engine {
+
+// Recently found paths, for entities walking the same routes over and over.
+// Solid tiles don't change once a map is loaded, so nothing is thrown out
+// for them. Entities walking around are checked for on each hit by a
+// Path_Check, and a path that fails it is dropped. Call clear if tiles are
+// ever changed. When full the least recently used is dropped.
+class NOOSKEWL_ENGINE_EXPORT Path_Cache {
+public:
+	// Returns false if the path can't be walked anymore
+	typedef bool (*Path_Check)(const A_Star::Path &path, void *data);
+
+	static const int DEFAULT_MAX_SIZE = 64;
+
+	struct Stats {
+		int hits;
+		int misses;
+	};
+
+	Path_Cache(int max_size = DEFAULT_MAX_SIZE);
+	~Path_Cache();
+
+	// Fills in path and returns true if it's cached. Empty paths (no way
+	// there) are cached too. A path that fails check is dropped.
+	bool find(Point<int> start, Point<int> goal, bool check_solids, A_Star::Path &path, Path_Check check = 0, void *check_data = 0);
+	void add(Point<int> start, Point<int> goal, bool check_solids, const A_Star::Path &path);
+	void clear();
+
+	Stats get_stats();
+	void reset_stats();
+
+private:
+	struct Key {
+		Point<int> start;
+		Point<int> goal;
+		bool check_solids;
+
+		bool operator<(const Key &rhs) const;
+	};
+
+	struct Entry {
+		A_Star::Path path;
+		std::list<Key>::iterator lru_position;
+	};
+
+	static Key make_key(Point<int> start, Point<int> goal, bool check_solids);
+
+	int max_size;
+	std::map<Key, Entry> entries;
+	std::list<Key> lru; // most recently used first
+
+	Stats stats;
+};
+
+} // End namespace Nooskewl_Engine
+
+#endif // PATH_CACHE_H
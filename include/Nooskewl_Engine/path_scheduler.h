@@ -0,0 +1,91 @@
+#ifndef PATH_SCHEDULER_H
+#define PATH_SCHEDULER_H
+
+#include "Nooskewl_Engine/main.h"
+#include "Nooskewl_Engine/a_star.h"
+#include "Nooskewl_Engine/basic_types.h"
+#include "Nooskewl_Engine/callback_data.h"
+
+namespace Nooskewl_Engine {
+
+class Map;
+
+// Path searches queued up and run a bit each frame within a budget, so lots
+// of entities finding paths at once don't make frames late. One search runs
+// at a time on its own A_Star and picks up where it left off next frame. If
+// solid entities moved meanwhile and are now in the way, it's searched again
+// up to MAX_RESTARTS times.
+// Results are shared with Map::find_path through the map's Path_Cache.
+class NOOSKEWL_ENGINE_EXPORT Path_Scheduler {
+public:
+	// What callbacks get, with userdata the callback_data they were
+	// requested with
+	struct Callback_Data : public Generic_Callback_Data {
+		int id;
+		Point<int> start;
+		Point<int> goal;
+		A_Star::Path path; // empty if there is none
+	};
+
+	struct Stats {
+		int nodes; // tiles searched
+		int completed;
+		int frames_over_budget; // frames update stopped early with work left
+	};
+
+	static const int DEFAULT_MAX_NODES = 2000; // per frame
+	static const float DEFAULT_MAX_MILLISECONDS;
+
+	Path_Scheduler(Map *map);
+	~Path_Scheduler();
+
+	// Returns an id for cancel. The callback is called from a later update,
+	// never from in here.
+	int request(Point<int> start, Point<int> goal, bool check_solids, Callback callback, void *callback_data = 0);
+	void cancel(int id);
+	void cancel(void *callback_data); // every request with it
+	bool is_pending(int id);
+
+	// Call once a frame. Searches until the queue is empty or either budget
+	// is used up.
+	void update();
+
+	void set_budget(int max_nodes, float max_milliseconds);
+
+	Stats get_stats();
+	void reset_stats();
+
+private:
+	static const int NODES_PER_STEP = 100; // between looks at the clock
+	static const int MAX_RESTARTS = 2; // per request
+
+	struct Request {
+		int id;
+		Point<int> start;
+		Point<int> goal;
+		bool check_solids;
+		Callback callback;
+		void *callback_data;
+		int restarts; // searches thrown away because entities got in the way
+	};
+
+	void start_search(const Request &r);
+	void finish(const A_Star::Path &path);
+
+	Map *map;
+	A_Star *a_star;
+
+	std::list<Request> requests; // the front one is being searched
+	bool searching;
+	Uint32 search_version; // Map::get_occupancy_version when it started
+	int next_id;
+
+	int max_nodes;
+	float max_milliseconds;
+
+	Stats stats;
+};
+
+} // End namespace Nooskewl_Engine
+
+#endif // PATH_SCHEDULER_H
@@ -0,0 +1,74 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include "Nooskewl_Engine/main.h"
+#include "Nooskewl_Engine/basic_types.h"
+
+namespace Nooskewl_Engine {
+
+class Image;
+class Shader;
+
+// Quads collected over a frame (or part of one) instead of drawn right away
+// with Image::*_single, which costs a Vertex_Cache flush each. flush draws
+// everything, a batch per run of quads with the same image, shader and state.
+class NOOSKEWL_ENGINE_EXPORT Render_Queue {
+public:
+	// Called with enable true before a batch using it is drawn and false after,
+	// for shader uniforms and the like. Quads with a different setter or data
+	// never share a batch.
+	typedef void (*State_Setter)(void *data, bool enable);
+
+	struct Stats {
+		int quads; // what drawing them one at a time would cost in draw calls
+		int batches; // draw calls they actually took
+	};
+
+	Render_Queue();
+	~Render_Queue();
+
+	// image can be 0 for an untextured quad. Remembers the current shader.
+	void add(Image *image, SDL_Colour colours[4], Point<float> source_position, Size<float> source_size, Point<float> dest_position, float z, int flags = 0, State_Setter set_state = 0, void *state_data = 0);
+	void add(Image *image, SDL_Colour tint, Point<float> source_position, Size<float> source_size, Point<float> dest_position, float z, int flags = 0, State_Setter set_state = 0, void *state_data = 0);
+
+	// Draws and empties the queue with the current target, matrices and depth
+	// buffer setting. Without sort quads are drawn in the order they were added
+	// and only neighbours are batched. With it they are grouped by image and
+	// state first, which is only right if the quads don't overlap or the depth
+	// buffer sorts them out.
+	void flush(bool sort = false);
+
+	int get_size();
+
+	Stats get_stats();
+	void reset_stats();
+
+private:
+	struct Quad {
+		Image *image;
+		Shader *shader;
+		State_Setter set_state;
+		void *state_data;
+		SDL_Colour colours[4];
+		Point<float> source_position;
+		Size<float> source_size;
+		Point<float> dest_position;
+		float z;
+		int flags;
+	};
+
+	static bool same_batch(const Quad *a, const Quad *b);
+	static bool batch_order(const Quad *a, const Quad *b);
+
+	void start_batch(Quad *q);
+	void end_batch(Quad *q);
+
+	std::vector<Quad> quads;
+	std::vector<Quad *> order;
+
+	Stats stats;
+};
+
+} // End namespace Nooskewl_Engine
+
+#endif // RENDER_QUEUE_H
@@ -7,24 +7,55 @@ namespace Nooskewl_Engine {
 
 class Shader {
 public:
+	enum Attribute {
+		POSITION = 0, // in_position
+		TEXCOORD,     // in_texcoord
+		COLOUR,       // in_colour
+		NUM_ATTRIBUTES
+	};
+
+	// A uniform name looked up once (get_uniform) and usable with any shader.
+	// Each shader finds its location the first time it's set.
+	class Uniform {
+	public:
+		Uniform();
+
+	private:
+		friend class Shader;
+		int id;
+	};
+
 	Shader(bool opengl, std::string vertex_source, std::string fragment_source);
 	~Shader();
 
 	static void release_all();
 	static void reload_all();
 
+	static Uniform get_uniform(const std::string &name);
+	// set_texture skips binding a texture that's already bound, call this after
+	// binding one some other way
+	static void forget_bound_texture();
+
 	void use();
 
-	void set_texture(std::string name, Image *image);
-	void set_matrix(std::string name, const float *matrix);
-	void set_float(std::string name, float value);
-	bool set_float_vector(std::string name, int num_components, float *vector, int num_elements);
-	void set_bool(std::string name, bool value);
+	// Values the same as last time are not sent again
+	void set_texture(Uniform uniform, Image *image);
+	void set_matrix(Uniform uniform, const float *matrix);
+	void set_float(Uniform uniform, float value);
+	bool set_float_vector(Uniform uniform, int num_components, float *vector, int num_elements);
+	void set_bool(Uniform uniform, bool value);
+
+	void set_texture(const std::string &name, Image *image);
+	void set_matrix(const std::string &name, const float *matrix);
+	void set_float(const std::string &name, float value);
+	bool set_float_vector(const std::string &name, int num_components, float *vector, int num_elements);
+	void set_bool(const std::string &name, bool value);
 
 	float get_global_alpha();
 	void set_global_alpha(float global_alpha);
 
 	GLuint get_opengl_shader();
+	GLint get_opengl_attribute(Attribute attribute); // looked up when the shader is built, -1 if missing
 #ifdef NOOSKEWL_ENGINE_WINDOWS
 	LPD3DXEFFECT get_d3d_effect();
 #endif
@@ -32,9 +63,21 @@ public:
 private:
 	class Internal {
 public:
+		struct Uniform_State {
+			bool resolved;
+			GLint location; // -1 if the shader doesn't have it
+#ifdef NOOSKEWL_ENGINE_WINDOWS
+			D3DXHANDLE d3d_handle; // 0 if the shader doesn't have it
+#endif
+			std::vector<float> value; // last value set, empty if not set yet
+		};
+
 		void release();
 		void reload();
 
+		Uniform_State &get_uniform_state(int id);
+		bool update_value(Uniform_State &state, const float *value, int count); // true if changed
+
 		bool opengl;
 
 		std::string vertex_source;
@@ -44,6 +87,10 @@ public:
 		GLuint opengl_vertex_shader;
 		GLuint opengl_fragment_shader;
 		GLuint opengl_shader;
+		GLint opengl_attributes[NUM_ATTRIBUTES];
+
+		std::vector<Uniform_State> uniforms; // by Uniform id, forgotten on reload
+		Uniform_State missing;
 
 		// D3D
 #ifdef NOOSKEWL_ENGINE_WINDOWS
@@ -56,6 +103,10 @@ public:
 
 	static std::vector<Internal *> loaded_shaders;
 
+	static std::map<std::string, int> uniform_ids;
+	static std::vector<std::string> uniform_names;
+	static GLuint bound_texture;
+
 private:
 	float global_alpha;
 };
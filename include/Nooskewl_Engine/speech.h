@@ -45,10 +45,10 @@ private:
 	std::string text;
 	std::string name;
 	int start_time;
-	int offset;
+	int offset; // in bytes
 	bool advance;
 	bool done;
-	int skip;
+	int skip; // bytes
 	bool top;
 	bool right;
 
@@ -0,0 +1,61 @@
+#ifndef TILE_SHEET_CACHE_H
+#define TILE_SHEET_CACHE_H
+
+#include "Nooskewl_Engine/main.h"
+#include "Nooskewl_Engine/basic_types.h"
+
+namespace Nooskewl_Engine {
+
+class Image;
+
+// Every tiles/tilesN.tga packed into as few large textures (atlases) as
+// possible, shared by all Tilemaps and kept across map changes. Atlases are
+// loaded when first drawn and the least recently used ones are dropped when
+// the total goes over the budget.
+class NOOSKEWL_ENGINE_EXPORT Tile_Sheet_Cache {
+public:
+	struct Location {
+		int atlas;
+		Point<int> offset; // of the sheet's top left in the atlas
+	};
+
+	Tile_Sheet_Cache(int budget_mb = 64);
+	~Tile_Sheet_Cache();
+
+	int get_num_sheets();
+	Location get_location(int sheet);
+	Image *get_atlas(int atlas); // loads it if needed
+	Size<int> get_atlas_size(int atlas); // doesn't load it
+
+	// Start decoding these sheets in the background if their atlases aren't
+	// resident, so loading them later only has to upload. Replaces the last
+	// set asked for, dropping any of those not used yet.
+	void prefetch(const std::vector<int> &sheets);
+
+	void set_budget(int mb);
+	int get_resident_bytes();
+
+private:
+	static const Uint32 IN_USE_TIME = 1000; // atlases drawn this recently (ms) are never evicted
+
+	struct Atlas {
+		Image *image; // 0 if not resident
+		Size<int> size;
+		std::vector<int> sheets;
+		Uint32 last_used;
+	};
+
+	void load(Atlas &atlas);
+	void evict(int needed_bytes);
+
+	std::vector<Size<int> > sheet_sizes;
+	std::vector<Location> locations;
+	std::vector<Atlas> atlases;
+	std::map<int, int> prefetched; // sheet -> Asset_Loader::Handle
+	int budget; // bytes
+	int resident_bytes;
+};
+
+} // End namespace Nooskewl_Engine
+
+#endif // TILE_SHEET_CACHE_H
@@ -7,6 +7,8 @@
 namespace Nooskewl_Engine {
 
 class Image;
+class Light_Brain;
+class Vertex_Buffer;
 
 class NOOSKEWL_ENGINE_EXPORT Tilemap
 {
@@ -38,28 +40,100 @@ public:
 	};
 
 	Tilemap(std::string map_filename);
+	// Made up, for benchmarks: every tile is the first of sheet 0 and about
+	// solid_percent of tiles on layer 0 are solid
+	Tilemap(Size<int> size, int num_layers, int solid_percent = 0);
 	~Tilemap();
 
 	int get_num_layers();
 	Size<int> get_size();
+	std::vector<int> get_sheets_used(); // by any layer
 
 	// in tiles
 	bool is_solid(int layer, Point<int> position);
 	// in pixels
 	bool collides(int layer, Point<int> topleft, Point<int> bottomright);
 
+	// position is the camera offset from Map::update_camera. Only chunks of
+	// the map that are on screen are touched.
 	void draw(int layer, Point<float> position, bool use_depth_buffer = true);
 
+	// Counted by draw since the map was loaded or reset_draw_stats, for +benchmark-tilemap
+	struct Draw_Stats {
+		int draws;
+		int chunks_visited;
+		int chunks_drawn;
+		int tiles_drawn;
+		Uint64 ticks; // SDL_GetPerformanceCounter ticks spent in draw
+	};
+
+	Draw_Stats get_draw_stats();
+	void reset_draw_stats();
+	int get_num_chunks(); // per layer
+
 	std::vector<Group *> get_groups(int layer);
 
 	// Following functions vertices ordered 0,0, 1,0, 1,1, 0,1 in screen coordinates
 
+	// Brings the light map up to date with the lights and time of day. Call
+	// once a frame before drawing the layers.
+	void update_light_map();
+	// From the light map. White with GPU lighting.
 	void get_tile_lighting(Point<int> tile_position, SDL_Colour &out);
 
+	// With GPU lighting, lights everything drawn so far. Call after drawing the map.
+	void draw_lights(Point<float> position);
+
 	void enable_lighting(bool enabled);
 	void set_lighting_parameters(bool indoors, int outdoor_effect, SDL_Colour ambient_light);
 
 private:
+	static const int CHUNK_SIZE = 16; // layers are baked and drawn in pieces this many tiles square
+
+	void init(); // after the layers, groups and walls are loaded
+
+	struct Chunk
+	{
+		int num_tiles;
+		// Of the tiles in the chunk, in map pixels (bottomright is exclusive)
+		Point<int> topleft;
+		Point<int> bottomright;
+		bool baked;
+		Vertex_Buffer *buffer; // 0 if the chunk is empty
+		std::vector< Point<int> > tiles; // one per quad in buffer
+		std::vector< std::pair<int, int> > atlas_ranges; // first vertex, vertex count for each of Layer::atlases_used
+		bool lit; // buffer colours are up to date
+	};
+
+	void bake(int layer, int chunk);
+	void light(Chunk &chunk);
+	// Light from Light_Brains, added up per tile. A light's footprint is how
+	// much of it reaches each tile, which only changes when it moves or its
+	// reach or falloff change.
+	struct Light_Footprint
+	{
+		Vec3D<float> position;
+		float reach;
+		float falloff;
+		std::vector< std::pair<int, float> > tiles; // tile index, 0-1
+		Point<int> topleft; // bounds of tiles, inclusive
+		Point<int> bottomright;
+	};
+
+	struct Light_State
+	{
+		SDL_Colour colour;
+		Light_Footprint footprint;
+		Light_Footprint previous_footprint; // flickering lights go back and forth between two
+		bool seen;
+	};
+
+	bool use_gpu_lighting();
+	void compute_footprint(Light_Footprint &footprint);
+	float get_light_amount(Point<int> tile_position, Vec3D<float> light_position, float reach, float falloff, Wall *light_wall);
+	void apply_light(Light_State &state, int sign); // add (1) or remove (-1) from light_map
+	void relight_chunks(Point<int> topleft, Point<int> bottomright); // in tiles, inclusive
+
 	float get_z(int layer, int x, int y);
 	Wall *get_tile_wall(Point<int> tile_position);
 	SDL_Colour get_day_time_colour();
@@ -74,15 +148,18 @@ private:
 		bool **solid;
 		std::vector<Group *> groups;
 		std::vector<int> sheets_used;
+		std::vector<int> atlases_used; // Tile_Sheet_Cache atlases
+		std::vector<Chunk> chunks; // num_chunks.w * num_chunks.h, row by row
 	};
 
-	std::vector<Image *> sheets;
-
 	Size<int> size; // in tiles
+	Size<int> num_chunks;
 	int num_layers;
 
 	Layer *layers;
 
+	std::vector<Uint32> solid_bits; // bit per tile, set if solid on any layer
+
 	std::vector<Wall *> walls;
 
 	// Lighting parameters
@@ -96,6 +173,16 @@ private:
 	int outdoor_effect; // % of total lighting effect to take from outdoors (0-100)
 	SDL_Colour ambient_light;
 	std::vector<Day_Night_Portion> day_night_splits;
+	std::vector<float> lighting_inputs; // the above and day time colour when light_map was last updated
+	SDL_Colour day_time_colour;
+
+	std::vector<int> light_map; // r, g, b from lights per tile, in 1/256ths
+	std::map<Light_Brain *, Light_State> light_states;
+	std::vector<Wall *> tile_walls; // get_tile_wall for every tile
+	int max_wall_extent; // most rows a wall moves a tile's lighting position down
+	Image *occluder; // walls for Light_Renderer, made when first needed
+
+	Draw_Stats draw_stats;
 };
 
 } // End namespace Nooskewl_Engine
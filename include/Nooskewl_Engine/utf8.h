@@ -5,12 +5,61 @@
 
 namespace Nooskewl_Engine {
 
-int utf8_len(std::string text);
-Uint32 utf8_char_next(std::string text, int &offset);
-Uint32 utf8_char(std::string text, int i);
+// Walks the characters of UTF-8 text in place. The text must outlive it and
+// be 0 terminated, the iterator never steps past the 0. Dereferencing at the
+// end gives 0.
+class UTF8_Iterator {
+public:
+	typedef std::forward_iterator_tag iterator_category;
+	typedef Uint32 value_type;
+	typedef int difference_type;
+	typedef const Uint32 *pointer;
+	typedef const Uint32 &reference;
+
+	UTF8_Iterator();
+	UTF8_Iterator(const char *text);
+	UTF8_Iterator(const std::string &text, int offset = 0); // offset in bytes
+
+	const Uint32 &operator*() const;
+	UTF8_Iterator &operator++();
+	UTF8_Iterator operator++(int);
+	bool operator==(const UTF8_Iterator &rhs) const;
+	bool operator!=(const UTF8_Iterator &rhs) const;
+
+	const char *get_pointer() const;
+	int get_size() const; // bytes in the current character, 0 at the end
+
+private:
+	void decode();
+
+	const unsigned char *p;
+	Uint32 ch;
+	int size;
+};
+
+// Byte offset of every character of a text, for random access without
+// rescanning. The text must outlive it.
+class UTF8_Index {
+public:
+	UTF8_Index(const std::string &text);
+
+	int get_length() const; // in characters
+	int get_offset(int i) const; // of character i in bytes, get_length() gives the end
+	Uint32 get_char(int i) const; // 0 past the end
+	UTF8_Iterator get_iterator(int i) const;
+
+private:
+	const std::string &text;
+	std::vector<int> offsets;
+};
+
+// Writes ch and a 0 to buf, returns the bytes written not counting the 0
+int utf8_encode(Uint32 ch, char buf[7]);
+
+int utf8_len(const std::string &text);
 std::string utf8_char_to_string(Uint32 ch);
-std::string utf8_substr(std::string s, int start, int len = -1);
+std::string utf8_substr(const std::string &s, int start, int len = -1);
 
 }
 
-#endif
\ No newline at end of file
+#endif
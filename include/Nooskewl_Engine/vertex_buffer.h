@@ -0,0 +1,38 @@
+#ifndef VERTEX_BUFFER_H
+#define VERTEX_BUFFER_H
+
+#include "Nooskewl_Engine/main.h"
+
+namespace Nooskewl_Engine {
+
+// Triangles built once and drawn many times with the same shader inputs as
+// Vertex_Cache. Positions and texture coordinates never change, colours can.
+// On OpenGL both live in buffer objects, colours in their own so changing them
+// doesn't upload everything again.
+class NOOSKEWL_ENGINE_EXPORT Vertex_Buffer {
+public:
+	// vertices is x, y, z, u, v for each vertex. Colours start out white.
+	Vertex_Buffer(float *vertices, int count);
+	~Vertex_Buffer();
+
+	int get_count();
+
+	void set_colours(float *colours); // r, g, b, a (0-1) for each vertex
+
+	// Uses the current shader, matrices and texture (Vertex_Cache::start)
+	void draw(int first, int count);
+
+private:
+	int count;
+
+	GLuint vertex_buffer;
+	GLuint colour_buffer;
+
+#ifdef NOOSKEWL_ENGINE_WINDOWS
+	float *vertices; // interleaved like Vertex_Cache for DrawPrimitiveUP
+#endif
+};
+
+} // End namespace Nooskewl_Engine
+
+#endif // VERTEX_BUFFER_H
@@ -3,6 +3,7 @@
 
 #include "Nooskewl_Engine/main.h"
 #include "Nooskewl_Engine/basic_types.h"
+#include "Nooskewl_Engine/shader.h"
 
 namespace Nooskewl_Engine {
 
@@ -24,15 +25,38 @@ public:
 
 	void enable_font_scaling(bool enable);
 
+	// How cache_z maps destination positions to vertex positions right now:
+	// position * scale + translation. For drawing prebuilt vertices.
+	void get_transform(Point<float> &scale, Point<float> &translation);
+
+	// Draw calls made by end and anything else that counts itself here
+	void count_draw_call();
+	int get_draw_calls();
+	void reset_draw_calls();
+
 	void cache(SDL_Colour vertex_colours[3], Point<float> da, Point<float> db, Point<float> dc);
 	void cache(SDL_Colour vertex_colours[4], Point<float> source_position, Size<float> source_size, Point<float> da, Point<float> db, Point<float> dc, Point<float> dd, int flags);
 	void cache_z(SDL_Colour vertex_colours[4], Point<float> source_position, Size<float> source_size, Point<float> dest_position, float z, Size<float> dest_size, int flags);
 	void cache(SDL_Colour vertex_colours[4], Point<float> source_position, Size<float> source_size, Point<float> dest_position, Size<float> dest_size, int flags);
 
 private:
+	// 24 bytes. Colours go to the GPU as bytes, normalised there.
+	struct Vertex {
+		float x, y, z;
+		float u, v;
+		SDL_Colour colour;
+	};
+
+	static const int NUM_BUFFERS = 4; // VBOs to cycle through so uploads don't wait on draws in flight
+	static const int MAX_QUADS = 16384; // per draw, as many as 16 bit indices can reach
+
+	float get_scale();
 	void maybe_resize_cache(int increase);
+	void set_position(Vertex &v, float x, float y, float z);
+	void set_texcoords(Vertex *v, float tu, float tv, float tu2, float tv2); // for a quad
+	void set_colours(Vertex *v, SDL_Colour vertex_colours[4]); // for a quad
 
-	float *vertices;
+	Vertex *vertices;
 	int count;
 	int total;
 	Image *image;
@@ -42,6 +66,22 @@ private:
 	Size<int> screen_size;
 
 	bool font_scaling;
+
+	GLuint buffers[NUM_BUFFERS];
+	int buffer_sizes[NUM_BUFFERS]; // in vertices
+	int current_buffer;
+
+	std::vector<Uint16> indices; // the same for every batch, MAX_QUADS worth
+	GLuint index_buffer;
+
+	int draw_calls;
+
+	Shader::Uniform use_tex_uniform;
+	Shader::Uniform tex_uniform;
+
+#ifdef NOOSKEWL_ENGINE_WINDOWS
+	std::vector<float> d3d_vertices; // vertices in the layout NOOSKEWL_ENGINE_FVF expects
+#endif
 };
 
 } // End namespace Nooskewl_Engine
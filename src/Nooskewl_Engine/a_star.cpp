@@ -1,152 +1,218 @@
 #include "Nooskewl_Engine/a_star.h"
 #include "Nooskewl_Engine/map.h"
+#include "Nooskewl_Engine/tilemap.h"
 
 using namespace Nooskewl_Engine;
 
 A_Star::A_Star(Map *map) :
 	map(map),
-	final_node(0)
+	size(0, 0),
+	generation(0),
+	state(FAILED),
+	goal_index(0),
+	check_solids(false)
 {
 }
 
 A_Star::~A_Star()
 {
-	delete final_node;
-	destroy_nodes(open);
-	destroy_nodes(closed);
 }
 
-std::list<A_Star::Node *> A_Star::find_path(Point<int> start, Point<int> goal, bool check_solids)
+A_Star::Path A_Star::find_path(Point<int> start, Point<int> goal, bool check_solids)
 {
-	delete final_node;
-	final_node = 0;
-	destroy_nodes(open);
-	destroy_nodes(closed);
+	Size<int> map_size = map->get_tilemap()->get_size();
+	return find_path(start, goal, check_solids, Point<int>(0, 0), Point<int>(map_size.w-1, map_size.h-1));
+}
+
+A_Star::Path A_Star::find_path(Point<int> start, Point<int> goal, bool check_solids, Point<int> topleft, Point<int> bottomright)
+{
+	int count = 0;
+
+	start_search(start, goal, check_solids, topleft, bottomright);
+
+	if (step(INT_MAX, count) == FOUND) {
+		return get_path();
+	}
+
+	return Path(); // failed
+}
+
+void A_Star::start_search(Point<int> start, Point<int> goal, bool check_solids, Point<int> topleft, Point<int> bottomright)
+{
+	Size<int> map_size = map->get_tilemap()->get_size();
+
+	topleft.x = MAX(0, topleft.x);
+	topleft.y = MAX(0, topleft.y);
+	bottomright.x = MIN(map_size.w-1, bottomright.x);
+	bottomright.y = MIN(map_size.h-1, bottomright.y);
+
+	this->goal = goal;
+	this->check_solids = check_solids;
+	this->topleft = topleft;
+	this->bottomright = bottomright;
+
+	open.clear();
+
+	state = FAILED;
+
+	if (start.x < topleft.x || start.y < topleft.y || start.x > bottomright.x || start.y > bottomright.y) {
+		return;
+	}
+	if (goal.x < topleft.x || goal.y < topleft.y || goal.x > bottomright.x || goal.y > bottomright.y) {
+		return;
+	}
 
 	if (check_solids && map->is_solid(-1, 0, goal, Size<int>(1, 1), true, true)) {
 		// No path since the goal is solid
-		std::list<Node *> path;
-		return path;
+		return;
 	}
 
-	Node *start_node = new Node();
-	start_node->parent = 0;
-	start_node->position = start;
-	start_node->cost_from_start = 0;
-	start_node->cost_to_goal = heuristic(start, goal);
-	start_node->total_cost = start_node->cost_from_start + start_node->cost_to_goal;
-	open.push_back(start_node);
-
-	while (open.size() > 0) {
-		Node *node = open.front();
-		open.pop_front();
-
-		if (node->position == goal) {
-			final_node = node;
-			std::list<Node *> path;
-			while (node->parent != 0) {
-				path.push_front(node);
-				node = node->parent;
-			}
-			return path;
-		}
-		else {
-			branch(node, Point<int>(0, -1), goal, check_solids);
-			branch(node, Point<int>(-1, 0), goal, check_solids);
-			branch(node, Point<int>(1, 0), goal, check_solids);
-			branch(node, Point<int>(0, 1), goal, check_solids);
+	if (map_size.w != size.w || map_size.h != size.h) {
+		size = map_size;
+		Node n;
+		n.generation = 0;
+		nodes.assign(size.w * size.h, n);
+		generation = 0;
+	}
+
+	generation++;
+	if (generation == 0) {
+		// Wrapped, so old stamps could look current
+		for (size_t i = 0; i < nodes.size(); i++) {
+			nodes[i].generation = 0;
 		}
-		closed.push_back(node);
+		generation = 1;
 	}
 
-	return std::list<Node *>(); // failed
+	int start_index = start.y * size.w + start.x;
+	goal_index = goal.y * size.w + goal.x;
+
+	Node &start_node = get_node(start_index);
+	start_node.cost_from_start = 0;
+
+	Open_Node o;
+	o.index = start_index;
+	o.cost_from_start = 0;
+	o.total_cost = heuristic(start, goal);
+	open.push_back(o);
+
+	state = SEARCHING;
 }
 
-A_Star::Node *A_Star::find_in_list(Point<int> position, std::list<Node *> &list)
+A_Star::Search_State A_Star::step(int max_nodes, int &count)
 {
-	for (std::list<Node *>::iterator it = list.begin(); it != list.end(); it++) {
-		Node *n = *it;
-		if (n->position == position) {
-			return n;
+	static const Point<int> offsets[4] = {
+		Point<int>(0, -1),
+		Point<int>(-1, 0),
+		Point<int>(1, 0),
+		Point<int>(0, 1)
+	};
+
+	if (state != SEARCHING) {
+		return state;
+	}
+
+	int searched = 0;
+
+	while (searched < max_nodes) {
+		if (open.size() == 0) {
+			state = FAILED;
+			return state;
+		}
+
+		Open_Node top = open.front();
+		std::pop_heap(open.begin(), open.end(), open_order);
+		open.pop_back();
+
+		Node &node = nodes[top.index];
+
+		if (node.closed || top.cost_from_start != node.cost_from_start) {
+			continue;
+		}
+
+		node.closed = true;
+		searched++;
+		count++;
+
+		if (top.index == goal_index) {
+			state = FOUND;
+			return state;
+		}
+
+		Point<int> position(top.index % size.w, top.index / size.w);
+
+		for (int i = 0; i < 4; i++) {
+			Point<int> new_position = position + offsets[i];
+			if (new_position.x < topleft.x || new_position.y < topleft.y || new_position.x > bottomright.x || new_position.y > bottomright.y) {
+				continue;
+			}
+			if (check_solids && map->is_solid(-1, 0, new_position, Size<int>(1, 1), true, true)) {
+				continue;
+			}
+
+			int index = new_position.y * size.w + new_position.x;
+			int new_cost = node.cost_from_start + 1;
+			Node &n = get_node(index);
+
+			// Costs are all 1 and the heuristic never overestimates, so a
+			// closed node already has its cheapest cost
+			if (n.closed || n.cost_from_start <= new_cost) {
+				continue;
+			}
+
+			n.parent = top.index;
+			n.cost_from_start = new_cost;
+
+			Open_Node o;
+			o.index = index;
+			o.cost_from_start = new_cost;
+			o.total_cost = new_cost + heuristic(new_position, goal);
+			open.push_back(o);
+			std::push_heap(open.begin(), open.end(), open_order);
 		}
 	}
 
-	return 0;
+	return state;
 }
 
-void A_Star::remove_from_list(Node *node, std::list<Node *> &list)
+A_Star::Path A_Star::get_path()
 {
-	std::list<Node *>::iterator it = std::find(list.begin(), list.end(), node);
-	if (it != list.end()) {
-		list.erase(it);
+	Path path;
+
+	if (state != FOUND) {
+		return path;
 	}
-}
 
-void A_Star::add_to_open(Node *node)
-{
-	std::list<Node *>::iterator it;
-	for (it = open.begin(); it != open.end(); it++) {
-		Node *n = *it;
-		if (n->total_cost >= node->total_cost) {
-			break;
-		}
+	for (int i = goal_index; nodes[i].parent != -1; i = nodes[i].parent) {
+		path.push_back(Point<int>(i % size.w, i / size.w));
 	}
-	open.insert(it, node);
+	std::reverse(path.begin(), path.end());
+
+	return path;
 }
 
-void A_Star::destroy_nodes(std::list<Node *> &list)
+bool A_Star::open_order(const Open_Node &a, const Open_Node &b)
 {
-	for (std::list<Node *>::iterator it = list.begin(); it != list.end();) {
-		delete *it;
-		it = list.erase(it);
+	// std::push_heap puts the greatest first, so cheaper is greater. Ties go
+	// to the one furthest along, which is closest to the goal.
+	if (a.total_cost != b.total_cost) {
+		return a.total_cost > b.total_cost;
 	}
+	return a.cost_from_start < b.cost_from_start;
 }
 
-void A_Star::branch(Node *node, Point<int> offset, Point<int> goal, bool check_solids)
+A_Star::Node &A_Star::get_node(int index)
 {
-	Point<int> new_position = node->position + offset;
-	if (check_solids && map->is_solid(-1, 0, new_position, Size<int>(1, 1), true, true)) {
-		return;
-	}
+	Node &n = nodes[index];
 
-	int new_cost = node->cost_from_start + 1;
-	bool in_open = false;
-	bool in_closed = false;
-	Node *new_node = find_in_list(new_position, open);
-	if (new_node == 0) {
-		in_open = false;
-		new_node = find_in_list(new_position, closed);
-		if (new_node == 0) {
-			in_closed = false;
-		}
-		else {
-			in_closed = true;
-		}
-	}
-	else {
-		in_open = true;
-		in_closed = find_in_list(new_position, closed) != 0;
-	}
-	if (new_node == 0 || new_node->cost_from_start > new_cost) {
-		if (new_node == 0) {
-			new_node = new Node();
-			new_node->position = new_position;
-		}
-		new_node->parent = node;
-		new_node->cost_from_start = new_cost;
-		new_node->cost_to_goal = heuristic(new_node->position, goal);
-		new_node->total_cost = new_node->cost_from_start + new_node->cost_to_goal;
-		if (in_closed) {
-			remove_from_list(new_node, closed);
-		}
-		else if (in_open) {
-			remove_from_list(new_node, open);
-			add_to_open(new_node);
-		}
-		else {
-			add_to_open(new_node);
-		}
+	if (n.generation != generation) {
+		n.generation = generation;
+		n.parent = -1;
+		n.cost_from_start = INT_MAX;
+		n.closed = false;
 	}
+
+	return n;
 }
 
 int A_Star::heuristic(Point<int> start, Point<int> end)
@@ -0,0 +1,554 @@
+#include "Nooskewl_Engine/asset_loader.h"
+#include "Nooskewl_Engine/error.h"
+#include "Nooskewl_Engine/image.h"
+#include "Nooskewl_Engine/internal.h"
+#include "Nooskewl_Engine/mml.h"
+#include "Nooskewl_Engine/sample.h"
+#include "Nooskewl_Engine/tilemap.h"
+#include "Nooskewl_Engine/xml.h"
+
+using namespace Nooskewl_Engine;
+
+int Asset_Loader::thread_main(void *data)
+{
+	Asset_Loader *loader = static_cast<Asset_Loader *>(data);
+	loader->run();
+	return 0;
+}
+
+Asset_Loader::Asset_Loader(int num_threads) :
+	quit(false),
+	next_handle(1)
+{
+	if (num_threads <= 0) {
+		num_threads = MAX(1, MIN(4, SDL_GetCPUCount()-1));
+	}
+
+	mutex = SDL_CreateMutex();
+	queue_cond = SDL_CreateCond();
+	done_cond = SDL_CreateCond();
+
+	for (int i = 0; i < num_threads; i++) {
+		SDL_Thread *thread = SDL_CreateThread(thread_main, "Asset_Loader", this);
+		if (thread == 0) {
+			errormsg("Couldn't create asset loader thread\n");
+			break;
+		}
+		threads.push_back(thread);
+	}
+}
+
+Asset_Loader::~Asset_Loader()
+{
+	SDL_LockMutex(mutex);
+	quit = true;
+	SDL_CondBroadcast(queue_cond);
+	SDL_UnlockMutex(mutex);
+
+	for (size_t i = 0; i < threads.size(); i++) {
+		SDL_WaitThread(threads[i], 0);
+	}
+
+	std::map<Handle, Request *>::iterator it;
+	for (it = requests.begin(); it != requests.end(); it++) {
+		destroy((*it).second);
+	}
+
+	for (size_t i = 0; i < released.size(); i++) {
+		destroy(released[i]);
+	}
+
+	SDL_DestroyCond(done_cond);
+	SDL_DestroyCond(queue_cond);
+	SDL_DestroyMutex(mutex);
+}
+
+Asset_Loader::Handle Asset_Loader::load_image(std::string filename, bool is_absolute_path, int priority)
+{
+	if (is_absolute_path == false) {
+		filename = "images/" + filename;
+	}
+
+	return add(IMAGE, filename, priority);
+}
+
+Asset_Loader::Handle Asset_Loader::load_xml(std::string filename, int priority)
+{
+	return add(XML_FILE, filename, priority);
+}
+
+Asset_Loader::Handle Asset_Loader::load_sample(std::string filename, int priority)
+{
+	return add(SAMPLE, filename, priority);
+}
+
+Asset_Loader::Handle Asset_Loader::load_mml(std::string filename, int priority)
+{
+	return add(MML_FILE, filename, priority);
+}
+
+Asset_Loader::Handle Asset_Loader::load_tilemap(std::string map_name, int priority)
+{
+	return add(TILEMAP, map_name, priority);
+}
+
+Asset_Loader::Handle Asset_Loader::load_pixels(std::string filename, int priority)
+{
+	return add(PIXELS, filename, priority);
+}
+
+void Asset_Loader::set_priority(Handle handle, int priority)
+{
+	SDL_LockMutex(mutex);
+	Request *r = get(handle);
+	if (r) {
+		r->priority = priority;
+	}
+	SDL_UnlockMutex(mutex);
+}
+
+bool Asset_Loader::is_ready(Handle handle)
+{
+	SDL_LockMutex(mutex);
+	Request *r = get(handle);
+	bool ready = r == 0 || r->state == READY || r->state == FAILED;
+	SDL_UnlockMutex(mutex);
+	return ready;
+}
+
+bool Asset_Loader::failed(Handle handle)
+{
+	SDL_LockMutex(mutex);
+	Request *r = get(handle);
+	bool failed = r == 0 || r->state == FAILED;
+	SDL_UnlockMutex(mutex);
+	return failed;
+}
+
+void Asset_Loader::wait(Handle handle)
+{
+	SDL_LockMutex(mutex);
+
+	Request *r = get(handle);
+	if (r == 0) {
+		SDL_UnlockMutex(mutex);
+		return;
+	}
+
+	if (r->state == QUEUED) {
+		// No worker has started on it, quicker to do it here than wait for one
+		queue.erase(std::find(queue.begin(), queue.end(), r));
+		r->state = LOADING;
+		SDL_UnlockMutex(mutex);
+		decode(r);
+		SDL_LockMutex(mutex);
+	}
+	else {
+		r->priority = IMMEDIATE;
+		while (r->state == LOADING) {
+			SDL_CondWait(done_cond, mutex);
+		}
+	}
+
+	bool needs_upload = r->state == DECODED;
+
+	SDL_UnlockMutex(mutex);
+
+	if (needs_upload) {
+		finish(r);
+	}
+}
+
+Image *Asset_Loader::get_image(Handle handle)
+{
+	wait(handle);
+
+	SDL_LockMutex(mutex);
+	Request *r = get(handle);
+	requests.erase(handle);
+	SDL_UnlockMutex(mutex);
+
+	if (r == 0) {
+		return 0;
+	}
+
+	Image *image = r->image;
+	r->image = 0;
+	destroy(r);
+
+	return image;
+}
+
+XML *Asset_Loader::get_xml(Handle handle)
+{
+	wait(handle);
+
+	SDL_LockMutex(mutex);
+	Request *r = get(handle);
+	requests.erase(handle);
+	SDL_UnlockMutex(mutex);
+
+	if (r == 0) {
+		return 0;
+	}
+
+	XML *xml = r->xml;
+	r->xml = 0;
+	destroy(r);
+
+	return xml;
+}
+
+Sample *Asset_Loader::get_sample(Handle handle)
+{
+	wait(handle);
+
+	SDL_LockMutex(mutex);
+	Request *r = get(handle);
+	requests.erase(handle);
+	SDL_UnlockMutex(mutex);
+
+	if (r == 0) {
+		return 0;
+	}
+
+	Sample *sample = r->sample;
+	r->sample = 0;
+	destroy(r);
+
+	return sample;
+}
+
+MML *Asset_Loader::get_mml(Handle handle)
+{
+	wait(handle);
+
+	SDL_LockMutex(mutex);
+	Request *r = get(handle);
+	requests.erase(handle);
+	SDL_UnlockMutex(mutex);
+
+	if (r == 0) {
+		return 0;
+	}
+
+	MML *mml = r->mml;
+	r->mml = 0;
+	destroy(r);
+
+	return mml;
+}
+
+Tilemap *Asset_Loader::get_tilemap(Handle handle)
+{
+	wait(handle);
+
+	SDL_LockMutex(mutex);
+	Request *r = get(handle);
+	requests.erase(handle);
+	SDL_UnlockMutex(mutex);
+
+	if (r == 0) {
+		return 0;
+	}
+
+	Tilemap *tilemap = r->tilemap;
+	r->tilemap = 0;
+	destroy(r);
+
+	return tilemap;
+}
+
+unsigned char *Asset_Loader::get_pixels(Handle handle, Size<int> &size)
+{
+	wait(handle);
+
+	SDL_LockMutex(mutex);
+	Request *r = get(handle);
+	requests.erase(handle);
+	SDL_UnlockMutex(mutex);
+
+	if (r == 0) {
+		return 0;
+	}
+
+	unsigned char *pixels = r->pixels;
+	size = r->size;
+	r->pixels = 0;
+	destroy(r);
+
+	return pixels;
+}
+
+void Asset_Loader::release(Handle handle)
+{
+	SDL_LockMutex(mutex);
+
+	Request *r = get(handle);
+	if (r == 0) {
+		SDL_UnlockMutex(mutex);
+		return;
+	}
+
+	requests.erase(handle);
+
+	if (r->state == QUEUED) {
+		queue.erase(std::find(queue.begin(), queue.end(), r));
+	}
+	else if (r->state == LOADING) {
+		// The worker hands it back to update() when it's done
+		r->cancelled = true;
+		SDL_UnlockMutex(mutex);
+		return;
+	}
+
+	SDL_UnlockMutex(mutex);
+
+	destroy(r);
+}
+
+bool Asset_Loader::finish_image(std::string filename)
+{
+	Handle handle = 0;
+
+	SDL_LockMutex(mutex);
+	std::map<Handle, Request *>::iterator it;
+	for (it = requests.begin(); it != requests.end(); it++) {
+		Request *r = (*it).second;
+		if (r->type == IMAGE && r->filename == filename && r->state != READY && r->state != FAILED) {
+			handle = (*it).first;
+			break;
+		}
+	}
+	SDL_UnlockMutex(mutex);
+
+	if (handle == 0) {
+		return false;
+	}
+
+	wait(handle);
+
+	return true;
+}
+
+void Asset_Loader::update()
+{
+	std::vector<Request *> to_destroy;
+	std::vector<Request *> to_upload;
+
+	SDL_LockMutex(mutex);
+	to_destroy = released;
+	released.clear();
+	std::map<Handle, Request *>::iterator it;
+	for (it = requests.begin(); it != requests.end(); it++) {
+		Request *r = (*it).second;
+		if (r->state == DECODED) {
+			to_upload.push_back(r);
+		}
+	}
+	SDL_UnlockMutex(mutex);
+
+	for (size_t i = 0; i < to_destroy.size(); i++) {
+		destroy(to_destroy[i]);
+	}
+
+	Uint32 start = SDL_GetTicks();
+
+	for (size_t i = 0; i < to_upload.size(); i++) {
+		finish(to_upload[i]);
+		// Leave the rest for next frame rather than drop one
+		if (SDL_GetTicks() - start >= UPLOAD_BUDGET) {
+			break;
+		}
+	}
+}
+
+int Asset_Loader::get_pending_count()
+{
+	SDL_LockMutex(mutex);
+	int count = 0;
+	std::map<Handle, Request *>::iterator it;
+	for (it = requests.begin(); it != requests.end(); it++) {
+		State state = (*it).second->state;
+		if (state != READY && state != FAILED) {
+			count++;
+		}
+	}
+	SDL_UnlockMutex(mutex);
+	return count;
+}
+
+Asset_Loader::Handle Asset_Loader::add(Type type, std::string filename, int priority)
+{
+	Request *r = new Request;
+	r->type = type;
+	r->filename = filename;
+	r->priority = priority;
+	r->state = QUEUED;
+	r->cancelled = false;
+	r->pixels = 0;
+	r->image = 0;
+	r->xml = 0;
+	r->sample = 0;
+	r->mml = 0;
+	r->tilemap = 0;
+
+	if (type == IMAGE) {
+		// Already in the Image cache, just hold a reference
+		for (size_t i = 0; i < Image::loaded_images.size(); i++) {
+			if (Image::loaded_images[i]->filename == filename) {
+				r->image = new Image(filename, true);
+				r->state = READY;
+				break;
+			}
+		}
+	}
+
+	SDL_LockMutex(mutex);
+	Handle handle = next_handle++;
+	requests[handle] = r;
+	if (r->state == QUEUED) {
+		// With no workers this just sits here until someone waits on it
+		queue.push_back(r);
+		SDL_CondSignal(queue_cond);
+	}
+	SDL_UnlockMutex(mutex);
+
+	return handle;
+}
+
+// Call with the lock held
+Asset_Loader::Request *Asset_Loader::get(Handle handle)
+{
+	std::map<Handle, Request *>::iterator it = requests.find(handle);
+	if (it == requests.end()) {
+		return 0;
+	}
+	return (*it).second;
+}
+
+void Asset_Loader::run()
+{
+	SDL_LockMutex(mutex);
+
+	while (true) {
+		while (quit == false && queue.size() == 0) {
+			SDL_CondWait(queue_cond, mutex);
+		}
+
+		if (quit) {
+			break;
+		}
+
+		// Highest priority first, oldest first within a priority
+		size_t best = 0;
+		for (size_t i = 1; i < queue.size(); i++) {
+			if (queue[i]->priority > queue[best]->priority) {
+				best = i;
+			}
+		}
+
+		Request *r = queue[best];
+		queue.erase(queue.begin()+best);
+		r->state = LOADING;
+
+		SDL_UnlockMutex(mutex);
+		decode(r);
+		SDL_LockMutex(mutex);
+	}
+
+	SDL_UnlockMutex(mutex);
+}
+
+// Runs on a worker (or the main thread from wait()), so only things that don't touch GL
+void Asset_Loader::decode(Request *r)
+{
+	bool ok = true;
+
+	try {
+		switch (r->type) {
+			case IMAGE:
+				r->pixels = Image::read_tga(r->filename, r->size);
+				break;
+			case XML_FILE:
+				r->xml = new XML(r->filename);
+				break;
+			case SAMPLE:
+				// SDL_LoadWAV_RW writes to m.device_spec
+				SDL_LockMutex(m.mixer_mutex);
+				try {
+					r->sample = new Sample(r->filename);
+				}
+				catch (Error e) {
+					SDL_UnlockMutex(m.mixer_mutex);
+					throw e;
+				}
+				SDL_UnlockMutex(m.mixer_mutex);
+				break;
+			case MML_FILE:
+				r->mml = new MML(r->filename);
+				break;
+			case TILEMAP:
+				r->tilemap = new Tilemap(r->filename);
+				break;
+			case PIXELS:
+				r->pixels = Image::read_tga(r->filename, r->size);
+				break;
+		}
+	}
+	catch (Error e) {
+		errormsg("Couldn't load %s: %s\n", r->filename.c_str(), e.error_message.c_str());
+		ok = false;
+	}
+
+	SDL_LockMutex(mutex);
+
+	if (ok == false) {
+		r->state = FAILED;
+	}
+	else if (r->type == IMAGE) {
+		r->state = DECODED;
+	}
+	else {
+		r->state = READY;
+	}
+
+	if (r->cancelled) {
+		released.push_back(r);
+	}
+
+	SDL_CondBroadcast(done_cond);
+	SDL_UnlockMutex(mutex);
+}
+
+void Asset_Loader::finish(Request *r)
+{
+	bool ok = true;
+
+	try {
+		// Puts it in the Image cache, the Image takes the pixels
+		r->image = new Image(r->filename, r->pixels, r->size);
+	}
+	catch (Error e) {
+		errormsg("Couldn't upload %s: %s\n", r->filename.c_str(), e.error_message.c_str());
+		ok = false;
+	}
+
+	r->pixels = 0;
+
+	SDL_LockMutex(mutex);
+	r->state = ok ? READY : FAILED;
+	SDL_UnlockMutex(mutex);
+}
+
+// Main thread only, Sample and MML destructors touch the mixer
+void Asset_Loader::destroy(Request *r)
+{
+	delete[] r->pixels;
+	delete r->image;
+	delete r->xml;
+	delete r->sample;
+	delete r->mml;
+	delete r->tilemap;
+	delete r;
+}
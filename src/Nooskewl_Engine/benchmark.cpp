@@ -0,0 +1,135 @@
+#include "Nooskewl_Engine/a_star.h"
+#include "Nooskewl_Engine/engine.h"
+#include "Nooskewl_Engine/hpa_star.h"
+#include "Nooskewl_Engine/internal.h"
+#include "Nooskewl_Engine/map.h"
+#include "Nooskewl_Engine/tilemap.h"
+
+using namespace Nooskewl_Engine;
+
+// Each map is drawn this many times from the same spot, after one draw to
+// bake the chunks on screen
+static const int TILEMAP_FRAMES = 200;
+static const int TILEMAP_LAYERS = 4;
+
+// Paths between random open tiles, the same ones for A_Star and HPA_Star
+static const int PATH_QUERIES = 200;
+static const int PATH_SOLID_PERCENT = 20;
+
+static void draw_tilemap(Tilemap *tilemap, Point<float> position)
+{
+	noo.clear(noo.black);
+
+	for (int layer = 0; layer < tilemap->get_num_layers(); layer++) {
+		tilemap->draw(layer, position);
+	}
+
+	// So the time includes the GPU's work, not just queuing it
+	if (noo.opengl) {
+		glFinish();
+	}
+}
+
+void Nooskewl_Engine::benchmark_tilemap()
+{
+	int sizes[] = { 32, 64, 128, 256, 512 };
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		Tilemap *tilemap = new Tilemap(Size<int>(sizes[i], sizes[i]), TILEMAP_LAYERS);
+
+		// Camera on the middle of the map, as Map::update_camera would put it
+		Point<float> position;
+		position.x = float(noo.screen_size.w - sizes[i] * noo.tile_size) / 2;
+		position.y = float(noo.screen_size.h - sizes[i] * noo.tile_size) / 2;
+
+		draw_tilemap(tilemap, position);
+
+		tilemap->reset_draw_stats();
+
+		Uint64 start_ticks = SDL_GetPerformanceCounter();
+
+		for (int frame = 0; frame < TILEMAP_FRAMES; frame++) {
+			draw_tilemap(tilemap, position);
+		}
+
+		Uint64 ticks = SDL_GetPerformanceCounter() - start_ticks;
+
+		Tilemap::Draw_Stats stats = tilemap->get_draw_stats();
+		double frequency = (double)SDL_GetPerformanceFrequency();
+
+		infomsg("Tilemap %dx%d (%d chunks per layer): %.3f ms per frame, %.3f ms in Tilemap::draw, %d chunks visited, %d chunks/%d tiles drawn per frame\n", sizes[i], sizes[i], tilemap->get_num_chunks(), ticks * 1000.0 / frequency / TILEMAP_FRAMES, stats.ticks * 1000.0 / frequency / TILEMAP_FRAMES, stats.chunks_visited / TILEMAP_FRAMES, stats.chunks_drawn / TILEMAP_FRAMES, stats.tiles_drawn / TILEMAP_FRAMES);
+
+		delete tilemap;
+	}
+}
+
+static Point<int> random_open_tile(Tilemap *tilemap)
+{
+	Size<int> size = tilemap->get_size();
+	Point<int> p;
+
+	do {
+		p.x = rand() % size.w;
+		p.y = rand() % size.h;
+	} while (tilemap->is_solid(-1, p));
+
+	return p;
+}
+
+void Nooskewl_Engine::benchmark_paths()
+{
+	int sizes[] = { 64, 128, 256, 512 };
+	double frequency = (double)SDL_GetPerformanceFrequency();
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		Map *map = new Map(new Tilemap(Size<int>(sizes[i], sizes[i]), 1, PATH_SOLID_PERCENT));
+		Tilemap *tilemap = map->get_tilemap();
+
+		A_Star *a_star = new A_Star(map);
+		HPA_Star *hpa_star = new HPA_Star(map, a_star);
+
+		std::vector< std::pair< Point<int>, Point<int> > > queries;
+		for (int q = 0; q < PATH_QUERIES; q++) {
+			queries.push_back(std::pair< Point<int>, Point<int> >(random_open_tile(tilemap), random_open_tile(tilemap)));
+		}
+
+		// The cluster graph is built by the first search
+		Uint64 start_ticks = SDL_GetPerformanceCounter();
+		hpa_star->find_path(queries[0].first, queries[0].first);
+		double build_ms = (SDL_GetPerformanceCounter() - start_ticks) * 1000.0 / frequency;
+
+		double a_star_ms = 0.0, a_star_worst_ms = 0.0;
+		double hpa_star_ms = 0.0, hpa_star_worst_ms = 0.0;
+		int found = 0;
+		size_t a_star_length = 0, hpa_star_length = 0;
+
+		for (size_t q = 0; q < queries.size(); q++) {
+			start_ticks = SDL_GetPerformanceCounter();
+			A_Star::Path a_star_path = a_star->find_path(queries[q].first, queries[q].second, true);
+			double ms = (SDL_GetPerformanceCounter() - start_ticks) * 1000.0 / frequency;
+			a_star_ms += ms;
+			a_star_worst_ms = MAX(a_star_worst_ms, ms);
+
+			start_ticks = SDL_GetPerformanceCounter();
+			A_Star::Path hpa_star_path = hpa_star->find_path(queries[q].first, queries[q].second);
+			ms = (SDL_GetPerformanceCounter() - start_ticks) * 1000.0 / frequency;
+			hpa_star_ms += ms;
+			hpa_star_worst_ms = MAX(hpa_star_worst_ms, ms);
+
+			// Lengths only compared where both found one
+			if (a_star_path.size() > 0 && hpa_star_path.size() > 0) {
+				found++;
+				a_star_length += a_star_path.size();
+				hpa_star_length += hpa_star_path.size();
+			}
+		}
+
+		int n = (int)queries.size();
+
+		infomsg("Paths %dx%d (%d%% solid): A* %.3f ms average/%.3f ms worst, HPA* %.3f ms average/%.3f ms worst (graph built in %.3f ms), %d/%d found, HPA* paths %.1f%% longer\n", sizes[i], sizes[i], PATH_SOLID_PERCENT, a_star_ms / n, a_star_worst_ms, hpa_star_ms / n, hpa_star_worst_ms, build_ms, found, n, a_star_length > 0 ? (double)hpa_star_length * 100.0 / a_star_length - 100.0 : 0.0);
+
+		delete hpa_star;
+		delete a_star;
+		delete map;
+	}
+}
@@ -16,6 +16,11 @@ static Uint8 *safe_find_char(Uint8 *haystack, char needle, Uint8 *end)
 	return 0;
 }
 
+static Uint32 read_le32(const Uint8 *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+}
+
 SDL_RWops *CPA::open(std::string filename)
 {
 #if !defined LOAD_FROM_FILESYSTEM
@@ -27,16 +32,44 @@ SDL_RWops *CPA::open(std::string filename)
 		return file;
 #if !defined LOAD_FROM_FILESYSTEM
 	}
-	if (!exists(filename)) {
+	int index = find(filename);
+	if (index < 0) {
 		return 0;
 	}
-	return SDL_RWFromMem(bytes+info[filename].first, info[filename].second);
+	Entry &e = entries[index];
+	if (e.compressed) {
+		SDL_LockMutex(mutex);
+		if (e.inflated == 0) {
+			e.inflated = new Uint8[e.size];
+			uLongf inflated_size = e.size;
+			if (uncompress(e.inflated, &inflated_size, bytes+e.offset, e.stored_size) != Z_OK || inflated_size != e.size) {
+				errormsg("Corrupt CPA entry: %s\n", filename.c_str());
+				delete[] e.inflated;
+				e.inflated = 0;
+				SDL_UnlockMutex(mutex);
+				return 0;
+			}
+		}
+		SDL_UnlockMutex(mutex);
+		return SDL_RWFromConstMem(e.inflated, e.size);
+	}
+	return SDL_RWFromConstMem(bytes+e.offset, e.size);
 #endif
 }
 
 bool CPA::exists(std::string filename)
 {
-	return info.find(filename) != info.end();
+#if !defined LOAD_FROM_FILESYSTEM
+	if (load_from_filesystem == false) {
+		return find(filename) >= 0;
+	}
+#endif
+	SDL_RWops *file = open(filename);
+	if (file == 0) {
+		return false;
+	}
+	SDL_RWclose(file);
+	return true;
 }
 
 std::vector<std::string> CPA::get_all_filenames()
@@ -104,20 +137,381 @@ std::vector<std::string> CPA::get_all_filenames()
 		}
 	}
 	else {
-		std::map< std::string, std::pair<int, int> >::iterator it;
+		for (size_t i = 0; i < sorted.size(); i++) {
+			Entry &e = entries[sorted[i]];
+			v.push_back(std::string(e.name, e.name_length));
+		}
+	}
+
+	return v;
+}
+
+std::vector<std::string> CPA::get_filenames(std::string prefix)
+{
+	std::vector<std::string> v;
 
-		for (it = info.begin(); it != info.end(); it++) {
-			std::pair< std::string, std::pair<int, int> > p = *it;
-			v.push_back(p.first);
+	if (load_from_filesystem) {
+		std::vector<std::string> all = get_all_filenames();
+		for (size_t i = 0; i < all.size(); i++) {
+			if (all[i].compare(0, prefix.length(), prefix) == 0) {
+				v.push_back(all[i]);
+			}
+		}
+		return v;
+	}
+
+	// Binary search for the first name >= prefix, then everything after it that matches is in the listing
+	size_t lo = 0;
+	size_t hi = sorted.size();
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		Entry &e = entries[sorted[mid]];
+		Uint32 len = MIN(e.name_length, (Uint32)prefix.length());
+		int cmp = memcmp(e.name, prefix.c_str(), len);
+		if (cmp < 0 || (cmp == 0 && e.name_length < prefix.length())) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	for (size_t i = lo; i < sorted.size(); i++) {
+		Entry &e = entries[sorted[i]];
+		if (e.name_length < prefix.length() || memcmp(e.name, prefix.c_str(), prefix.length()) != 0) {
+			break;
 		}
+		v.push_back(std::string(e.name, e.name_length));
 	}
 
 	return v;
 }
 
+bool CPA::Name_Less::operator()(int a, int b) const
+{
+	const Entry &ea = (*entries)[a];
+	const Entry &eb = (*entries)[b];
+	int cmp = memcmp(ea.name, eb.name, MIN(ea.name_length, eb.name_length));
+	if (cmp == 0) {
+		return ea.name_length < eb.name_length;
+	}
+	return cmp < 0;
+}
+
+// FNV-1a, must match mkcpa2
+Uint32 CPA::hash_name(const char *name, Uint32 length)
+{
+	Uint32 hash = 2166136261u;
+	for (Uint32 i = 0; i < length; i++) {
+		hash ^= (Uint8)name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+int CPA::find(const std::string &filename)
+{
+	if (hash_table.size() == 0) {
+		return -1;
+	}
+
+	Uint32 hash = hash_name(filename.c_str(), filename.length());
+	Uint32 mask = hash_table.size() / 2 - 1;
+
+	// There's always at least one empty slot so this terminates
+	for (Uint32 slot = hash & mask;; slot = (slot + 1) & mask) {
+		Uint32 index = hash_table[slot*2+1];
+		if (index == 0) {
+			return -1;
+		}
+		if (hash_table[slot*2] == hash) {
+			Entry &e = entries[index-1];
+			if (e.name_length == filename.length() && memcmp(e.name, filename.c_str(), e.name_length) == 0) {
+				return index-1;
+			}
+		}
+	}
+}
+
+// Only used for v1 archives, v2 archives store the table
+void CPA::build_hash_table()
+{
+	Uint32 num_slots = 2;
+	while (num_slots < entries.size() * 2) {
+		num_slots *= 2;
+	}
+
+	hash_table.clear();
+	hash_table.resize(num_slots * 2, 0);
+
+	Uint32 mask = num_slots - 1;
+
+	for (size_t i = 0; i < entries.size(); i++) {
+		Entry &e = entries[i];
+		Uint32 hash = hash_name(e.name, e.name_length);
+		Uint32 slot = hash & mask;
+		// A name listed twice replaces the first, as it always has
+		while (hash_table[slot*2+1] != 0) {
+			if (hash_table[slot*2] == hash) {
+				Entry &other = entries[hash_table[slot*2+1]-1];
+				if (other.name_length == e.name_length && memcmp(other.name, e.name, e.name_length) == 0) {
+					break;
+				}
+			}
+			slot = (slot + 1) & mask;
+		}
+		hash_table[slot*2] = hash;
+		hash_table[slot*2+1] = i + 1;
+	}
+}
+
+void CPA::build_sorted_list()
+{
+	// From the hash table so duplicate names left out of it aren't listed
+	sorted.clear();
+	for (size_t i = 1; i < hash_table.size(); i += 2) {
+		if (hash_table[i] != 0) {
+			sorted.push_back(hash_table[i]-1);
+		}
+	}
+
+	Name_Less less;
+	less.entries = &entries;
+	std::sort(sorted.begin(), sorted.end(), less);
+}
+
+void CPA::load_v1(std::string filename)
+{
+	SDL_RWops *file = SDL_RWFromFile(filename.c_str(), "rb");
+	if (file == 0) {
+		throw FileNotFoundError("Couldn't open " + filename);
+	}
+
+	// The last 4 bytes of every gzipped file is the size of the uncompressed data as a 32 bit little endian number
+	SDL_RWseek(file, -4, RW_SEEK_END);
+	int size = SDL_ReadLE32(file);
+	SDL_RWclose(file);
+
+	gzFile f = gzopen(filename.c_str(), "rb");
+	bytes = new Uint8[size];
+	int read = gzread(f, bytes, size);
+	gzclose(f);
+
+	if (read != size) {
+		throw Error("Invalid CPA: corrupt gzip file");
+	}
+
+	// Read the size of the data (ascii text followed by newline first thing in the file)
+	Uint8 *header_end = (Uint8 *)safe_find_char(bytes, '\n', bytes+size);
+	if (header_end == 0) {
+		throw Error("Invalid CPA: header not present");
+	}
+	int header_size = (header_end - bytes) + 1;
+	int data_size = atoi((char *)bytes);
+	if (data_size >= size) {
+		throw Error("Invalid CPA: data size > archive size");
+	}
+	// Skip to the info section at the end
+	Uint8 *p = bytes + header_size + data_size;
+	// Keep track of the byte offset of each file
+	int count = header_size;
+
+	int total_size = 0;
+
+	char line[1000];
+
+	while (p < bytes+size) {
+		Uint8 *end = (Uint8 *)safe_find_char(p, '\n', bytes+size);
+		if (end == 0) {
+			throw Error("Invalid CPA: corrupt info section");
+		}
+		int len = end-p;
+		if (len < 1000) {
+			memcpy(line, p, len);
+			line[len] = 0;
+			char size_text[1000];
+			Uint8 *size_text_end = (Uint8 *)safe_find_char(p, '\t', bytes+size);
+			if (size_text_end == 0 || size_text_end - p > 999) {
+				throw Error("Invalid CPA: corrupt info section");
+			}
+			memcpy(size_text, p, size_text_end-p);
+			size_text[size_text_end-p] = 0;
+			int file_size = atoi(size_text);
+			Entry e;
+			e.name = (char *)size_text_end+1;
+			e.name_length = end-size_text_end-1;
+			e.offset = count;
+			e.stored_size = file_size;
+			e.size = file_size;
+			e.compressed = false;
+			e.inflated = 0;
+			entries.push_back(e);
+			count += file_size;
+			total_size += file_size;
+		}
+		p += len + 1;
+	}
+
+	if (total_size > data_size) {
+		throw Error("Invalid CPA: total file sizes > data size");
+	}
+
+	build_hash_table();
+}
+
+/* Version 2 layout, all numbers 32 bit little endian:
+ *
+ * header:  "CPA2", number of entries, size of name table, number of hash
+ *          table slots
+ * index:   per entry: name offset, name length, data offset, stored size,
+ *          size, flags (1 = zlib compressed)
+ * names:   all names catted together with no terminators, padded to 4 bytes
+ * hash:    open addressing table, per slot: FNV-1a hash of the name, entry
+ *          index + 1 or 0 if empty. Linear probing, power of 2 slots with at
+ *          least one empty.
+ * data:    file data, each compressed separately or stored as is
+ *
+ * Data offsets are from the start of the file. Archives with 0 hash slots get
+ * a table built at load time.
+ */
+void CPA::load_v2(std::string filename)
+{
+	if (map_file(filename) == false) {
+		throw Error("Invalid CPA: couldn't map " + filename);
+	}
+
+	if (mapped_size < 16) {
+		throw Error("Invalid CPA: header not present");
+	}
+
+	Uint32 num_entries = read_le32(bytes+4);
+	Uint32 names_size = read_le32(bytes+8);
+	Uint32 num_slots = read_le32(bytes+12);
+	Uint32 index_size = num_entries * 24;
+
+	if (num_entries > (mapped_size-16) / 24 || names_size > mapped_size-16-index_size) {
+		throw Error("Invalid CPA: index > archive size");
+	}
+
+	Uint8 *index = bytes + 16;
+	Uint8 *names = index + index_size;
+	Uint8 *hash = names + ((names_size + 3) & ~3);
+
+	if (num_slots != 0) {
+		if ((num_slots & (num_slots-1)) != 0 || num_slots <= num_entries || num_slots > (mapped_size-(hash-bytes)) / 8) {
+			throw Error("Invalid CPA: corrupt hash table");
+		}
+	}
+
+	for (Uint32 i = 0; i < num_entries; i++) {
+		Uint8 *p = index + i * 24;
+		Uint32 name_offset = read_le32(p);
+		Uint32 name_length = read_le32(p+4);
+		Entry e;
+		e.offset = read_le32(p+8);
+		e.stored_size = read_le32(p+12);
+		e.size = read_le32(p+16);
+		e.compressed = (read_le32(p+20) & 1) != 0;
+		e.inflated = 0;
+		e.name = (char *)names+name_offset;
+		e.name_length = name_length;
+		if (name_offset > names_size || name_length > names_size-name_offset) {
+			throw Error("Invalid CPA: corrupt index");
+		}
+		if (e.offset > mapped_size || e.stored_size > mapped_size-e.offset || (e.compressed == false && e.stored_size != e.size)) {
+			throw Error("Invalid CPA: corrupt index");
+		}
+		entries.push_back(e);
+	}
+
+	if (num_slots == 0) {
+		build_hash_table();
+	}
+	else {
+		hash_table.resize(num_slots * 2);
+		bool has_empty_slot = false;
+		for (Uint32 i = 0; i < num_slots * 2; i++) {
+			hash_table[i] = read_le32(hash + i * 4);
+			if ((i & 1) == 1) {
+				if (hash_table[i] > num_entries) {
+					throw Error("Invalid CPA: corrupt hash table");
+				}
+				if (hash_table[i] == 0) {
+					has_empty_slot = true;
+				}
+			}
+		}
+		if (has_empty_slot == false) {
+			throw Error("Invalid CPA: corrupt hash table");
+		}
+	}
+}
+
+bool CPA::map_file(std::string filename)
+{
+#ifdef NOOSKEWL_ENGINE_WINDOWS
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (GetFileSizeEx(file, &size) == 0 || size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+	CloseHandle(file);
+	if (mapping == 0) {
+		return false;
+	}
+	// The view keeps the mapping alive
+	void *p = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (p == 0) {
+		return false;
+	}
+	bytes = (Uint8 *)p;
+	mapped_size = (size_t)size.QuadPart;
+#else
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+	void *p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED) {
+		return false;
+	}
+	bytes = (Uint8 *)p;
+	mapped_size = st.st_size;
+#endif
+	return true;
+}
+
+void CPA::unmap_file()
+{
+#ifdef NOOSKEWL_ENGINE_WINDOWS
+	UnmapViewOfFile(bytes);
+#else
+	munmap(bytes, mapped_size);
+#endif
+	bytes = 0;
+	mapped_size = 0;
+}
+
 CPA::CPA() :
+	bytes(0),
+	mapped_size(0),
 	load_from_filesystem(false)
 {
+	mutex = SDL_CreateMutex();
+
 #ifndef LOAD_FROM_FILESYSTEM
 	try {
 
@@ -139,70 +533,18 @@ CPA::CPA() :
 #endif
 
 		if (file) {
-			// The last 4 bytes of every gzipped file is the size of the uncompressed data as a 32 bit little endian number
-			SDL_RWseek(file, -4, RW_SEEK_END);
-			int size = SDL_ReadLE32(file);
+			char magic[4];
+			bool is_v2 = SDL_RWread(file, magic, 1, 4) == 4 && memcmp(magic, "CPA2", 4) == 0;
 			SDL_RWclose(file);
 
-			gzFile f = gzopen(filename.c_str(), "rb");
-			bytes = new Uint8[size];
-			int read = gzread(f, bytes, size);
-			gzclose(f);
-
-			if (read != size) {
-				throw Error("Invalid CPA: corrupt gzip file");
+			if (is_v2) {
+				load_v2(filename);
 			}
-
-			// Read the size of the data (ascii text followed by newline first thing in the file)
-			Uint8 *header_end = (Uint8 *)safe_find_char(bytes, '\n', bytes+size);
-			if (header_end == 0) {
-				throw Error("Invalid CPA: header not present");
-			}
-			int header_size = (header_end - bytes) + 1;
-			int data_size = atoi((char *)bytes);
-			if (data_size >= size) {
-				throw Error("Invalid CPA: data size > archive size");
-			}
-			// Skip to the info section at the end
-			Uint8 *p = bytes + header_size + data_size;
-			// Keep track of the byte offset of each file
-			int count = header_size;
-
-			int total_size = 0;
-
-			char line[1000];
-
-			while (p < bytes+size) {
-				Uint8 *end = (Uint8 *)safe_find_char(p, '\n', bytes+size);
-				if (end == 0) {
-					throw Error("Invalid CPA: corrupt info section");
-				}
-				int len = end-p;
-				if (len < 1000) {
-					memcpy(line, p, len);
-					line[len] = 0;
-					char size_text[1000];
-					char name_text[1000];
-					Uint8 *size_text_end = (Uint8 *)safe_find_char(p, '\t', bytes+size);
-					if (size_text_end == 0 || size_text_end - p > 999) {
-						throw Error("Invalid CPA: corrupt info section");
-					}
-					memcpy(size_text, p, size_text_end-p);
-					size_text[size_text_end-p] = 0;
-					memcpy(name_text, size_text_end+1, end-size_text_end-1);
-					name_text[end-size_text_end-1] = 0;
-					int file_size = atoi(size_text);
-					std::pair<int, int> pair(count, file_size);
-					info[name_text] = pair;
-					count += file_size;
-					total_size += file_size;
-				}
-				p += len + 1;
+			else {
+				load_v1(filename);
 			}
 
-			if (total_size > data_size) {
-				throw Error("Invalid CPA: total file sizes > data size");
-			}
+			build_sorted_list();
 		}
 		else {
 			throw FileNotFoundError("No CPA archive found");
@@ -211,15 +553,35 @@ CPA::CPA() :
 	catch (Error e) {
 		infomsg("Couldn't load CPA, trying to load from the filesystem...\n");
 		load_from_filesystem = true;
+		if (mapped_size > 0) {
+			unmap_file();
+		}
+		else {
+			delete[] bytes;
+			bytes = 0;
+		}
+		entries.clear();
+		hash_table.clear();
+		sorted.clear();
 	}
 #endif
 }
 
 CPA::~CPA()
 {
+	SDL_DestroyMutex(mutex);
+
 #ifndef LOAD_FROM_FILESYSTEM
 	if (load_from_filesystem == false) {
-		delete[] bytes;
+		for (size_t i = 0; i < entries.size(); i++) {
+			delete[] entries[i].inflated;
+		}
+		if (mapped_size > 0) {
+			unmap_file();
+		}
+		else {
+			delete[] bytes;
+		}
 	}
 #endif
 }
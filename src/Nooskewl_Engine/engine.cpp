@@ -1,3 +1,4 @@
+#include "Nooskewl_Engine/asset_loader.h"
 #include "Nooskewl_Engine/brain.h"
 #include "Nooskewl_Engine/cpa.h"
 #include "Nooskewl_Engine/engine.h"
@@ -8,19 +9,24 @@
 #include "Nooskewl_Engine/internal.h"
 #include "Nooskewl_Engine/inventory.h"
 #include "Nooskewl_Engine/item.h"
+#include "Nooskewl_Engine/light_renderer.h"
 #include "Nooskewl_Engine/map.h"
 #include "Nooskewl_Engine/map_entity.h"
 #include "Nooskewl_Engine/map_logic.h"
 #include "Nooskewl_Engine/mml.h"
 #include "Nooskewl_Engine/player_brain.h"
+#include "Nooskewl_Engine/render_queue.h"
 #include "Nooskewl_Engine/sample.h"
 #include "Nooskewl_Engine/shader.h"
 #include "Nooskewl_Engine/speech.h"
 #include "Nooskewl_Engine/spell.h"
 #include "Nooskewl_Engine/sprite.h"
 #include "Nooskewl_Engine/stats.h"
+#include "Nooskewl_Engine/tile_sheet_cache.h"
+#include "Nooskewl_Engine/tilemap.h"
 #include "Nooskewl_Engine/tokenizer.h"
 #include "Nooskewl_Engine/translation.h"
+#include "Nooskewl_Engine/utf8.h"
 #include "Nooskewl_Engine/vertex_cache.h"
 #include "Nooskewl_Engine/widgets.h"
 #include "Nooskewl_Engine/xml.h"
@@ -44,6 +50,8 @@ static int total_frames = 0;
 static Uint32 fps_start;
 static int fps = 0;
 static bool show_fps = false;
+static bool show_draw_calls = false;
+static int draw_call_frames = 0;
 
 using namespace Nooskewl_Engine;
 
@@ -191,6 +199,7 @@ Engine::Engine() :
 	key_b2(TGUIK_ESCAPE),
 	key_b3(TGUIK_TAB),
 	key_b4(TGUIK_t),
+	asset_loader(0),
 	map(0),
 	player(0),
 	last_map_name(""),
@@ -207,6 +216,7 @@ Engine::Engine() :
 	escape_triangle_size(8.0f),
 	fullscreen_window(false),
 	target_image(0),
+	gpu_lighting(false),
 	work_image(0),
 	is_waiting(false),
 	story_start_hour(7),
@@ -231,7 +241,10 @@ bool Engine::start(int argc, char **argv)
 	opengl = true;
 #endif
 	use_hires_font = check_args(argc, argv, "+hires-font") > 0;
+	use_sdf_font = opengl && check_args(argc, argv, "+sdf-font") > 0;
+	gpu_lighting = opengl && check_args(argc, argv, "+gpu-lighting") > 0;
 	show_fps = check_args(argc, argv, "+fps") > 0;
+	show_draw_calls = check_args(argc, argv, "+draw-calls") > 0;
 	use_custom_cursor = check_args(argc, argv, "-custom-cursor") < 0;
 
 	int flags = SDL_INIT_JOYSTICK | SDL_INIT_TIMER | SDL_INIT_VIDEO;
@@ -244,6 +257,7 @@ bool Engine::start(int argc, char **argv)
 	}
 
 	cpa = new CPA();
+	asset_loader = new Asset_Loader();
 
 	load_dll();
 
@@ -281,6 +295,16 @@ bool Engine::start(int argc, char **argv)
 
 	load_palette("palette.gpl");
 
+	if (check_args(argc, argv, "+benchmark-tilemap") > 0) {
+		benchmark_tilemap();
+		exit(0);
+	}
+
+	if (check_args(argc, argv, "+benchmark-paths") > 0) {
+		benchmark_paths();
+		exit(0);
+	}
+
 	int ignore_palette = check_args(argc, argv, "+ignore-palette");
 	int dump_colours = check_args(argc, argv, "+dump-colours");
 	int repalette_images = check_args(argc, argv, "+repalette-images");
@@ -422,6 +446,17 @@ void Engine::end()
 #endif
 	}
 
+	// Before the video and audio go since it can be holding Images, Samples and MML
+	prefetch_handles.clear();
+	prefetch_tilemap_handles.clear();
+	std::map<std::string, Tilemap *>::iterator it;
+	for (it = prefetched_tilemaps.begin(); it != prefetched_tilemaps.end(); it++) {
+		delete (*it).second;
+	}
+	prefetched_tilemaps.clear();
+	delete asset_loader;
+	asset_loader = 0;
+
 	shutdown_video();
 	shutdown_audio();
 
@@ -622,10 +657,26 @@ void Engine::init_video()
 
 	m.vertex_cache = new Vertex_Cache();
 	m.vertex_cache->init();
+
+	m.tile_sheet_cache = new Tile_Sheet_Cache();
+
+	m.render_queue = new Render_Queue();
+
+	if (gpu_lighting) {
+		m.light_renderer = new Light_Renderer();
+	}
 }
 
 void Engine::shutdown_video()
 {
+	delete m.light_renderer;
+	m.light_renderer = 0;
+	delete m.render_queue;
+	delete m.text_shadow_shader;
+	m.text_shadow_shader = 0;
+	delete m.sdf_text_shader;
+	m.sdf_text_shader = 0;
+	delete m.tile_sheet_cache;
 	delete m.vertex_cache;
 
 	delete default_shader;
@@ -705,7 +756,10 @@ bool Engine::handle_event(SDL_Event *sdl_event, bool is_joystick_repeat)
 			SDL_GetWindowSize(window, &width, &height);
 		}
 
-		destroy_fonts();
+		// Distance field fonts draw at any scale, the rest are made for one
+		if (use_sdf_font == false) {
+			destroy_fonts();
+		}
 
 		delete work_image;
 		work_image = 0;
@@ -745,7 +799,9 @@ bool Engine::handle_event(SDL_Event *sdl_event, bool is_joystick_repeat)
 		set_screen_size(width, height);
 		set_default_projection();
 
-		load_fonts();
+		if (use_sdf_font == false) {
+			load_fonts();
+		}
 
 		recreate_work_image();
 
@@ -941,6 +997,8 @@ bool Engine::update()
 {
 	check_joysticks();
 
+	asset_loader->update();
+
 	// joystick repeat
 	for (size_t i = 0; i < joystick_repeats.size(); i++) {
 		Joy_Repeat &jr = joystick_repeats[i];
@@ -1051,6 +1109,11 @@ bool Engine::update()
 				old_map = map;
 				last_map_name = old_map->get_map_name();
 
+				std::vector<std::string> &exits = known_exits[last_map_name];
+				if (std::find(exits.begin(), exits.end(), new_map_name) == exits.end()) {
+					exits.push_back(new_map_name);
+				}
+
 				std::map<std::string, std::pair<int, std::string> >::iterator it;
 				if ((it = map_saves.find(new_map_name)) != map_saves.end()) {
 					std::pair<std::string, std::pair<int, std::string> > p = *it;
@@ -1103,10 +1166,155 @@ bool Engine::update()
 
 		}
 	}
+	else if (map) {
+		if (map->get_map_name() != prefetched_map_name) {
+			prefetch_exits();
+		}
+		update_prefetch();
+	}
 
 	return true;
 }
 
+// Start loading the Tilemaps and (for maps we've been to before) the sprite images of the maps this
+// map leads to so changing maps doesn't have to wait on the disk/decoding. Tile sheets follow in
+// update_prefetch once the Tilemaps say which they use.
+void Engine::prefetch_exits()
+{
+	std::vector<int> old_handles = prefetch_handles;
+	prefetch_handles.clear();
+
+	prefetched_map_name = map->get_map_name();
+
+	std::vector<std::string> exits;
+	if (map->get_map_logic()) {
+		exits = map->get_map_logic()->get_exits();
+	}
+	// Plus wherever the player has gone from here before, for games that don't list them
+	std::vector<std::string> &known = known_exits[prefetched_map_name];
+	for (size_t i = 0; i < known.size(); i++) {
+		if (std::find(exits.begin(), exits.end(), known[i]) == exits.end()) {
+			exits.push_back(known[i]);
+		}
+	}
+	std::vector<std::string> sprite_directories;
+
+	// Drop Tilemaps for maps this one doesn't lead to
+	std::map<std::string, int>::iterator hit;
+	for (hit = prefetch_tilemap_handles.begin(); hit != prefetch_tilemap_handles.end();) {
+		if (std::find(exits.begin(), exits.end(), (*hit).first) == exits.end()) {
+			asset_loader->release((*hit).second);
+			prefetch_tilemap_handles.erase(hit++);
+		}
+		else {
+			hit++;
+		}
+	}
+	std::map<std::string, Tilemap *>::iterator tit;
+	for (tit = prefetched_tilemaps.begin(); tit != prefetched_tilemaps.end();) {
+		if (std::find(exits.begin(), exits.end(), (*tit).first) == exits.end()) {
+			delete (*tit).second;
+			prefetched_tilemaps.erase(tit++);
+		}
+		else {
+			tit++;
+		}
+	}
+
+	for (size_t i = 0; i < exits.size(); i++) {
+		if (prefetch_tilemap_handles.find(exits[i]) == prefetch_tilemap_handles.end() && prefetched_tilemaps.find(exits[i]) == prefetched_tilemaps.end()) {
+			prefetch_tilemap_handles[exits[i]] = asset_loader->load_tilemap(exits[i], Asset_Loader::LOW);
+		}
+
+		std::map<std::string, std::pair<int, std::string> >::iterator it;
+		if ((it = map_saves.find(exits[i])) == map_saves.end()) {
+			continue;
+		}
+
+		// Pick the sprites out of the saved entities (sprite=xml_filename:image_directory:...)
+		std::string &map_s = (*it).second.second;
+		size_t pos = 0;
+		while ((pos = map_s.find("sprite=", pos)) != std::string::npos) {
+			pos += 7;
+			size_t end = map_s.find_first_of(",\n", pos);
+			Tokenizer t(map_s.substr(pos, end == std::string::npos ? std::string::npos : end-pos), ':');
+			t.next(); // xml filename
+			std::string image_directory = t.next();
+			if (image_directory != "" && std::find(sprite_directories.begin(), sprite_directories.end(), image_directory) == sprite_directories.end()) {
+				sprite_directories.push_back(image_directory);
+			}
+		}
+	}
+
+	for (size_t i = 0; i < sprite_directories.size(); i++) {
+		std::vector<std::string> filenames = cpa->get_filenames(sprite_directories[i] + "/");
+		for (size_t j = 0; j < filenames.size(); j++) {
+			std::string &s = filenames[j];
+			if (s.length() > 4 && s.substr(s.length()-4) == ".tga") {
+				prefetch_handles.push_back(asset_loader->load_image(s, true, Asset_Loader::LOW));
+			}
+		}
+	}
+
+	// Released after queueing the new ones so anything shared stays cached
+	for (size_t i = 0; i < old_handles.size(); i++) {
+		asset_loader->release(old_handles[i]);
+	}
+}
+
+// Picks up prefetched Tilemaps as they finish and queues the tile sheets they use
+void Engine::update_prefetch()
+{
+	bool added = false;
+
+	std::map<std::string, int>::iterator it;
+	for (it = prefetch_tilemap_handles.begin(); it != prefetch_tilemap_handles.end();) {
+		if (asset_loader->is_ready((*it).second) == false) {
+			it++;
+			continue;
+		}
+		Tilemap *tilemap = asset_loader->get_tilemap((*it).second);
+		if (tilemap) {
+			prefetched_tilemaps[(*it).first] = tilemap;
+			added = true;
+		}
+		prefetch_tilemap_handles.erase(it++);
+	}
+
+	if (added == false) {
+		return;
+	}
+
+	std::vector<int> sheets;
+	std::map<std::string, Tilemap *>::iterator tit;
+	for (tit = prefetched_tilemaps.begin(); tit != prefetched_tilemaps.end(); tit++) {
+		std::vector<int> used = (*tit).second->get_sheets_used();
+		sheets.insert(sheets.end(), used.begin(), used.end());
+	}
+
+	m.tile_sheet_cache->prefetch(sheets);
+}
+
+Tilemap *Engine::take_prefetched_tilemap(std::string map_name)
+{
+	std::map<std::string, Tilemap *>::iterator tit = prefetched_tilemaps.find(map_name);
+	if (tit != prefetched_tilemaps.end()) {
+		Tilemap *tilemap = (*tit).second;
+		prefetched_tilemaps.erase(tit);
+		return tilemap;
+	}
+
+	// Still loading, but it's further along than starting over
+	std::map<std::string, int>::iterator it = prefetch_tilemap_handles.find(map_name);
+	if (it != prefetch_tilemap_handles.end()) {
+		int handle = (*it).second;
+		prefetch_tilemap_handles.erase(it);
+		return asset_loader->get_tilemap(handle);
+	}
+
+	return 0;
+}
+
 void Engine::draw()
 {
 	clear_buffers();
@@ -1250,6 +1458,20 @@ void Engine::draw()
 		font->draw(white, itos(fps), Point<float>(2.0f, 2.0f));
 	}
 
+	// Unbatched is what it would take if every queued quad was drawn on its own
+	if (show_draw_calls) {
+		draw_call_frames++;
+		if (draw_call_frames >= 300) {
+			Render_Queue::Stats stats = m.render_queue->get_stats();
+			int draw_calls = m.vertex_cache->get_draw_calls();
+			int unbatched = draw_calls - stats.batches + stats.quads;
+			infomsg("%d draw calls per frame (%d unbatched), %d queued quads in %d batches\n", draw_calls / draw_call_frames, unbatched / draw_call_frames, stats.quads / draw_call_frames, stats.batches / draw_call_frames);
+			m.vertex_cache->reset_draw_calls();
+			m.render_queue->reset_stats();
+			draw_call_frames = 0;
+		}
+	}
+
 	flip();
 
 	if (total_frames == 0) {
@@ -1504,6 +1726,11 @@ void Engine::set_screen_size(int w, int h)
 		screen_size.h = int(h / scale);
 	}
 
+	// Distance field glyphs are made once at a fixed size and scaled
+	if (use_sdf_font) {
+		font_scale = scale / Font::SDF_SCALE;
+	}
+
 	screen_offset = Point<int>(int(w-(screen_size.w*scale))/2, int(h-(screen_size.h*scale))/2);
 	if (screen_offset.x < scale) {
 		screen_offset.x = 0;
@@ -1694,7 +1921,7 @@ void Engine::fancy_draw(SDL_Colour colour, std::string text, Point<int> position
 {
 	Uint32 t = (SDL_GetTicks() - fancy_draw_start) % 2000;
 
-	int count = text.length();
+	int count = utf8_len(text);
 
 	if (t < 1000 || count < 2) {
 		font->draw(colour, text, position);
@@ -1703,8 +1930,9 @@ void Engine::fancy_draw(SDL_Colour colour, std::string text, Point<int> position
 		t = t - 1000;
 
 		float x = 0.0f;
+		UTF8_Iterator it(text);
 
-		for (size_t i = 0; i < text.length(); i++) {
+		for (int i = 0; i < count; i++, ++it) {
 			float section = 1000.0f / (count - i + 1);
 			float p = t / section;
 			if (p > 2.0f) {
@@ -1717,7 +1945,7 @@ void Engine::fancy_draw(SDL_Colour colour, std::string text, Point<int> position
 				p = 1.0f - p;
 			}
 			float dx = x * p;
-			std::string c = text.substr(i, 1);
+			std::string c(it.get_pointer(), it.get_size());
 			font->draw(colour, c, Point<float>(position.x + dx, (float)position.y));
 			x += font->get_text_width(c);
 		}
@@ -1822,7 +2050,12 @@ void Engine::play_music(std::string name)
 
 void Engine::load_fonts()
 {
-	font_scale = use_hires_font ? 1.0f : noo.scale;
+	if (use_sdf_font) {
+		font_scale = scale / Font::SDF_SCALE;
+	}
+	else {
+		font_scale = use_hires_font ? 1.0f : noo.scale;
+	}
 
 	font = new Font("font.ttf", 8);
 }
@@ -1923,6 +2156,13 @@ void Engine::set_window_icon()
 #endif
 }
 
+void Engine::get_matrices(glm::mat4 &model, glm::mat4 &view, glm::mat4 &proj)
+{
+	model = this->model;
+	view = this->view;
+	proj = this->proj;
+}
+
 void Engine::set_matrices(glm::mat4 &model, glm::mat4 &view, glm::mat4 &proj)
 {
 	this->model = model;
@@ -1932,11 +2172,21 @@ void Engine::set_matrices(glm::mat4 &model, glm::mat4 &view, glm::mat4 &proj)
 
 void Engine::update_projection()
 {
-	current_shader->set_matrix("model", glm::value_ptr(model));
-	current_shader->set_matrix("view", glm::value_ptr(view));
+	// Called on every Shader::use
+	static Shader::Uniform model_uniform = Shader::get_uniform("model");
+	static Shader::Uniform view_uniform = Shader::get_uniform("view");
+	static Shader::Uniform proj_uniform = Shader::get_uniform("proj");
 
-	glm::mat4 d3d_fix = glm::translate(glm::mat4(), glm::vec3(-1.0f / (float)real_screen_size.w, 1.0f / (float)real_screen_size.h, 0.0f));
-	current_shader->set_matrix("proj", glm::value_ptr(opengl ? proj : d3d_fix * proj));
+	current_shader->set_matrix(model_uniform, glm::value_ptr(model));
+	current_shader->set_matrix(view_uniform, glm::value_ptr(view));
+
+	if (opengl) {
+		current_shader->set_matrix(proj_uniform, glm::value_ptr(proj));
+	}
+	else {
+		glm::mat4 d3d_fix = glm::translate(glm::mat4(), glm::vec3(-1.0f / (float)real_screen_size.w, 1.0f / (float)real_screen_size.h, 0.0f));
+		current_shader->set_matrix(proj_uniform, glm::value_ptr(d3d_fix * proj));
+	}
 }
 
 #ifdef NOOSKEWL_ENGINE_WINDOWS
@@ -3,6 +3,7 @@
 #include "Nooskewl_Engine/font.h"
 #include "Nooskewl_Engine/image.h"
 #include "Nooskewl_Engine/internal.h"
+#include "Nooskewl_Engine/render_queue.h"
 #include "Nooskewl_Engine/shader.h"
 #include "Nooskewl_Engine/vertex_cache.h"
 #include "Nooskewl_Engine/utf8.h"
@@ -11,14 +12,234 @@
 
 using namespace Nooskewl_Engine;
 
+// Built in like the light shaders since games don't ship them. Draws text and
+// its shadow in one pass: a pixel not covered by the glyph is shadow if the
+// glyph covers it at any of the offsets (in texels, y down).
+static const char *shadow_vertex_source =
+	"#version 110\n"
+	"attribute vec3 in_position;\n"
+	"attribute vec2 in_texcoord;\n"
+	"attribute vec4 in_colour;\n"
+	"uniform mat4 model;\n"
+	"uniform mat4 view;\n"
+	"uniform mat4 proj;\n"
+	"varying vec2 texcoord;\n"
+	"varying vec4 colour;\n"
+	"void main()\n"
+	"{\n"
+	"	texcoord = in_texcoord;\n"
+	"	colour = in_colour;\n"
+	"	gl_Position = proj * view * model * vec4(in_position, 1.0);\n"
+	"}\n";
+
+// Text is given a nearer depth than shadow so with the depth buffer on text
+// is never covered by a neighbouring glyph's shadow and shadows that overlap
+// don't darken twice.
+static const char *shadow_fragment_source =
+	"#version 110\n"
+	"uniform sampler2D tex;\n"
+	"uniform float xstep;\n"
+	"uniform float ystep;\n"
+	"uniform vec4 shadow_colour;\n"
+	"uniform vec2 shadow_offsets[8];\n"
+	"uniform float num_shadow_offsets;\n"
+	"uniform float global_alpha;\n"
+	"varying vec2 texcoord;\n"
+	"varying vec4 colour;\n"
+	"float coverage(vec2 t)\n"
+	"{\n"
+	"	vec2 inside = step(vec2(0.0, 0.0), t) * step(t, vec2(1.0, 1.0));\n"
+	"	return texture2D(tex, t).a * inside.x * inside.y;\n"
+	"}\n"
+	"void main()\n"
+	"{\n"
+	"	vec4 c = texture2D(tex, texcoord);\n"
+	"	if (c.a > 0.5) {\n"
+	"		gl_FragColor = vec4(c.rgb * colour.rgb, c.a * colour.a * global_alpha);\n"
+	"		gl_FragDepth = 0.0;\n"
+	"		return;\n"
+	"	}\n"
+	"	float shadow = 0.0;\n"
+	"	for (int i = 0; i < 8; i++) {\n"
+	"		if (float(i) < num_shadow_offsets) {\n"
+	"			shadow = max(shadow, coverage(texcoord + vec2(-shadow_offsets[i].x * xstep, shadow_offsets[i].y * ystep)));\n"
+	"		}\n"
+	"	}\n"
+	"	gl_FragColor = vec4(shadow_colour.rgb, shadow_colour.a * shadow * global_alpha);\n"
+	"	gl_FragDepth = 0.5;\n"
+	"}\n";
+
+// For +sdf-font. Glyph alpha is a distance field, 0.5 on the edge. Pages are
+// nearest filtered so the field is filtered here. The shadow is the field at
+// an offset (in texels, y down) thickened by outline.
+static const char *sdf_fragment_source =
+	"#version 110\n"
+	"uniform sampler2D tex;\n"
+	"uniform float xstep;\n"
+	"uniform float ystep;\n"
+	"uniform vec4 shadow_colour;\n"
+	"uniform vec2 shadow_offset;\n"
+	"uniform float outline;\n"
+	"uniform float smoothing;\n"
+	"uniform float global_alpha;\n"
+	"varying vec2 texcoord;\n"
+	"varying vec4 colour;\n"
+	"float field(vec2 t)\n"
+	"{\n"
+	"	vec2 texel = vec2(xstep, ystep);\n"
+	"	vec2 p = t / texel - 0.5;\n"
+	"	vec2 f = fract(p);\n"
+	"	vec2 base = (floor(p) + 0.5) * texel;\n"
+	"	float a = texture2D(tex, base).a;\n"
+	"	float b = texture2D(tex, base + vec2(xstep, 0.0)).a;\n"
+	"	float c = texture2D(tex, base + vec2(0.0, ystep)).a;\n"
+	"	float d = texture2D(tex, base + texel).a;\n"
+	"	return mix(mix(a, b, f.x), mix(c, d, f.x), f.y);\n"
+	"}\n"
+	"void main()\n"
+	"{\n"
+	"	float text = smoothstep(0.5 - smoothing, 0.5 + smoothing, field(texcoord));\n"
+	"	float edge = 0.5 - outline;\n"
+	"	float shadow = smoothstep(edge - smoothing, edge + smoothing, field(texcoord + vec2(-shadow_offset.x * xstep, shadow_offset.y * ystep)));\n"
+	"	float text_alpha = colour.a * text;\n"
+	"	float shadow_alpha = shadow_colour.a * shadow * (1.0 - text_alpha);\n"
+	"	float alpha = text_alpha + shadow_alpha;\n"
+	"	vec3 rgb = alpha > 0.0 ? (colour.rgb * text_alpha + shadow_colour.rgb * shadow_alpha) / alpha : vec3(0.0, 0.0, 0.0);\n"
+	"	gl_FragColor = vec4(rgb, alpha * global_alpha);\n"
+	"	gl_FragDepth = text > 0.5 ? 0.0 : 0.5;\n"
+	"}\n";
+
+// Squared distances along a line to the nearest point where f is 0, from
+// Felzenszwalb and Huttenlocher's "Distance Transforms of Sampled Functions"
+static void distance_transform(const float *f, int n, float *d, int *v, float *z)
+{
+	const float inf = 1e20f;
+	int k = 0;
+
+	v[0] = 0;
+	z[0] = -inf;
+	z[1] = inf;
+
+	for (int q = 1; q < n; q++) {
+		float s = ((f[q] + q*q) - (f[v[k]] + v[k]*v[k])) / (2*q - 2*v[k]);
+		while (s <= z[k]) {
+			k--;
+			s = ((f[q] + q*q) - (f[v[k]] + v[k]*v[k])) / (2*q - 2*v[k]);
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k+1] = inf;
+	}
+
+	k = 0;
+
+	for (int q = 0; q < n; q++) {
+		while (z[k+1] < q) {
+			k++;
+		}
+		d[q] = (q-v[k])*(q-v[k]) + f[v[k]];
+	}
+}
+
+// grid is 0 at the pixels to measure to and huge elsewhere, and is replaced
+// by squared distances
+static void distance_transform(std::vector<float> &grid, Size<int> size)
+{
+	int n = MAX(size.w, size.h);
+	std::vector<float> f(n), d(n), z(n+1);
+	std::vector<int> v(n);
+
+	for (int x = 0; x < size.w; x++) {
+		for (int y = 0; y < size.h; y++) {
+			f[y] = grid[y*size.w+x];
+		}
+		distance_transform(&f[0], size.h, &d[0], &v[0], &z[0]);
+		for (int y = 0; y < size.h; y++) {
+			grid[y*size.w+x] = d[y];
+		}
+	}
+
+	for (int y = 0; y < size.h; y++) {
+		distance_transform(&grid[y*size.w], size.w, &d[0], &v[0], &z[0]);
+		memcpy(&grid[y*size.w], &d[0], size.w * sizeof(float));
+	}
+}
+
+// Signed distance from each pixel of a glyph surface, padding included, to the
+// glyph's edge (positive inside) mapped so spread either way is 0 to 255. Top
+// row first.
+static void make_distance_field(SDL_Surface *surface, int padding, int spread, std::vector<unsigned char> &out)
+{
+	Size<int> size(surface->w + padding * 2, surface->h + padding * 2);
+	std::vector<float> to_inside(size.w * size.h, 1e20f);
+	std::vector<float> to_outside(size.w * size.h, 0.0f);
+
+	for (int y = 0; y < surface->h; y++) {
+		unsigned char *p = (unsigned char *)surface->pixels + y * surface->pitch;
+		for (int x = 0; x < surface->w; x++) {
+			if (p[x*4+3] >= 128) {
+				int i = (y + padding) * size.w + x + padding;
+				to_inside[i] = 0.0f;
+				to_outside[i] = 1e20f;
+			}
+		}
+	}
+
+	distance_transform(to_inside, size);
+	distance_transform(to_outside, size);
+
+	out.resize(size.w * size.h);
+
+	for (int i = 0; i < size.w * size.h; i++) {
+		// Pixel centres are measured so the edge is half a pixel off
+		float distance;
+		if (to_inside[i] == 0.0f) {
+			distance = sqrtf(to_outside[i]) - 0.5f;
+		}
+		else {
+			distance = 0.5f - sqrtf(to_inside[i]);
+		}
+		float value = 0.5f + distance / (spread * 2);
+		out[i] = (unsigned char)(MAX(0.0f, MIN(1.0f, value)) * 255.0f + 0.5f);
+	}
+}
+
+// data is the page, steps are a texel
+static void set_glyph_steps(void *data, bool enable)
+{
+	static Shader::Uniform xstep = Shader::get_uniform("xstep");
+	static Shader::Uniform ystep = Shader::get_uniform("ystep");
+
+	if (enable) {
+		Image *page = static_cast<Image *>(data);
+		noo.current_shader->set_float(xstep, 1.0f / page->size.w);
+		noo.current_shader->set_float(ystep, 1.0f / page->size.h);
+	}
+}
+
 Font::Font(std::string filename, int size) :
+	current_page(0),
+	glyph_clock(0),
+	layout_clock(0),
 	size(size)
 {
+	// Enough room around each glyph in the pages for the widest shadow. A
+	// distance field needs its spread too, far enough from the next glyph's
+	// that offset shadows don't pick it up.
+	if (noo.use_sdf_font) {
+		glyph_padding = SDF_SPREAD + SDF_SCALE;
+	}
+	else {
+		glyph_padding = MAX(2, (int)ceil(noo.scale / noo.font_scale));
+	}
+
 	filename = "fonts/" + filename;
 
 	file = open_file(filename);
 
-	if (noo.use_hires_font) {
+	// font_scale makes this SDF_SCALE times size with +sdf-font
+	if (noo.use_hires_font || noo.use_sdf_font) {
 		font = TTF_OpenFontRW(file, true, int(size * noo.scale / noo.font_scale));
 	}
 	else {
@@ -44,28 +265,45 @@ Font::~Font()
 
 void Font::clear_cache()
 {
-	std::map<Uint32, Image *>::iterator it;
-	for  (it = glyphs.begin(); it != glyphs.end(); it++) {
-		std::pair<int, Image *> p = *it;
-		delete p.second;
+	for (size_t i = 0; i < pages.size(); i++) {
+		delete pages[i].image;
+		delete[] pages[i].pixels;
 	}
+	pages.clear();
 	glyphs.clear();
+	current_page = 0;
+
+	// Measured with the old glyphs
+	layouts.clear();
+	text_widths.clear();
 }
 
-float Font::get_text_width(std::string text)
+float Font::get_text_width(const std::string &text)
 {
-	cache_glyphs(text);
+	std::map<std::string, float>::iterator it = text_widths.find(text);
+	if (it != text_widths.end()) {
+		return (*it).second;
+	}
+
+	UTF8_Iterator begin(text);
+	UTF8_Iterator end(text, text.length());
+
+	cache_glyphs(begin, end);
 
 	int width = 0;
-	int offset = 0;
-	int ch;
 
-	while ((ch = utf8_char_next(text, offset)) != 0) {
-		Image *g = glyphs[ch];
-		width += g->size.w;
+	for (UTF8_Iterator it = begin; it != end; ++it) {
+		width += glyphs[*it].size.w;
 	}
 
-	return width / noo.scale * noo.font_scale;
+	float result = width / noo.scale * noo.font_scale;
+
+	if ((int)text_widths.size() >= MAX_TEXT_WIDTHS) {
+		text_widths.clear();
+	}
+	text_widths[text] = result;
+
+	return result;
 }
 
 float Font::get_height()
@@ -84,82 +322,246 @@ void Font::disable_shadow()
 	this->shadow_type = NO_SHADOW;
 }
 
-void Font::draw(SDL_Colour colour, std::string text, Point<float> dest_position)
+float Font::get_drop_shadow_distance()
 {
-	cache_glyphs(text);
+	float sub = (noo.use_hires_font || noo.use_sdf_font) ? 1.0f : 0.01f;
+	return noo.scale / noo.font_scale - sub;
+}
+
+void Font::draw(SDL_Colour colour, const std::string &text, Point<float> dest_position)
+{
+	draw_range(colour, UTF8_Iterator(text), UTF8_Iterator(text, text.length()), dest_position);
+}
+
+void Font::draw_range(SDL_Colour colour, UTF8_Iterator begin, UTF8_Iterator end, Point<float> dest_position)
+{
+	cache_glyphs(begin, end);
 
 	dest_position.x = dest_position.x * noo.scale / noo.font_scale;
 	dest_position.y = (dest_position.y-1) * noo.scale / noo.font_scale;
 
 	Point<float> pos = dest_position;
 
-	int offset = 0;
-	int ch;
+	// Anything queued goes under the text and isn't font scaled
+	m.render_queue->flush();
+
+	// Make any pages that got new glyphs before queueing
+	std::vector<Image *> page_images;
+	for (size_t i = 0; i < pages.size(); i++) {
+		page_images.push_back(get_page_image(i));
+	}
 
 	m.vertex_cache->enable_font_scaling(true);
 
-	// Optionally draw a shadow
-	if (shadow_type != NO_SHADOW) {
-		noo.enable_depth_buffer(true);
-		noo.clear_depth_buffer(1.0f);
+	// A draw per page, usually one for the whole string. Glyphs don't overlap
+	// each other, and shadows are all the same colour, so sort freely.
 
-		while ((ch = utf8_char_next(text, offset)) != 0) {
-			Image *g = glyphs[ch];
+	if (noo.use_sdf_font) {
+		draw_sdf(colour, begin, end, dest_position, page_images);
+	}
+	else if (shadow_type != NO_SHADOW && noo.opengl) {
+		draw_with_shadow(colour, begin, end, dest_position, page_images);
+	}
+	else {
+		// D3D has no shadow shader so the shadow is glyphs drawn underneath
+		if (shadow_type != NO_SHADOW) {
+			noo.enable_depth_buffer(true);
+			noo.clear_depth_buffer(1.0f);
+
+			for (UTF8_Iterator it = begin; it != end; ++it) {
+				Glyph &g = glyphs[*it];
+				if (g.page < 0) {
+					pos.x += g.size.w;
+					continue;
+				}
+				Image *page = page_images[g.page];
+				Point<float> source_position(g.position.x, g.position.y);
+				Size<float> size(g.size.w, g.size.h);
+
+				if (shadow_type == DROP_SHADOW) {
+					float d = get_drop_shadow_distance();
+					m.render_queue->add(page, shadow_colour, source_position, size, Point<float>(pos.x+d, pos.y), 0.0f, 0, set_glyph_steps, page);
+					m.render_queue->add(page, shadow_colour, source_position, size, Point<float>(pos.x, pos.y+d), 0.0f, 0, set_glyph_steps, page);
+					m.render_queue->add(page, shadow_colour, source_position, size, Point<float>(pos.x+d, pos.y+d), 0.0f, 0, set_glyph_steps, page);
+				}
+				else if (shadow_type == FULL_SHADOW) {
+					for (int y = -1; y <= 1; y++) {
+						for (int x = -1; x <= 1; x++) {
+							if (x != 0 || y != 0) {
+								m.render_queue->add(page, shadow_colour, source_position, size, pos+Point<float>(x*2.0f, y*2.0f), 0.0f, 0, set_glyph_steps, page);
+							}
+						}
+					}
+				}
 
-			g->start();
+				pos.x += g.size.w;
+			}
+
+			m.render_queue->flush(true);
+
+			noo.enable_depth_buffer(false);
+		}
 
-			noo.current_shader->set_float("xstep", 1.0f / g->size.w);
-			noo.current_shader->set_float("ystep", 1.0f / g->size.h);
+		pos.x = dest_position.x;
 
-			if (shadow_type == DROP_SHADOW) {
-				float sub = noo.use_hires_font ? 1.0f : 0.01f;
-				g->draw_tinted(shadow_colour, Point<float>(pos.x+noo.scale/noo.font_scale-sub, pos.y), Image::FLIP_V);
-				g->draw_tinted(shadow_colour, Point<float>(pos.x, pos.y+noo.scale/noo.font_scale-sub), Image::FLIP_V);
-				g->draw_tinted(shadow_colour, Point<float>(pos.x+noo.scale/noo.font_scale-sub, pos.y+noo.scale/noo.font_scale-sub), Image::FLIP_V);
+		for (UTF8_Iterator it = begin; it != end; ++it) {
+			Glyph &g = glyphs[*it];
+			if (g.page < 0) {
+				pos.x += g.size.w;
+				continue;
 			}
-			else if (shadow_type == FULL_SHADOW) {
-				g->draw_tinted(shadow_colour, pos+Point<float>(-2.0f, -2.0f), Image::FLIP_V);
-				g->draw_tinted(shadow_colour, pos+Point<float>(0.0f, -2.0f), Image::FLIP_V);
-				g->draw_tinted(shadow_colour, pos+Point<float>(2.0f, -2.0f), Image::FLIP_V);
-				g->draw_tinted(shadow_colour, pos+Point<float>(-2.0f, 0.0f), Image::FLIP_V);
-				g->draw_tinted(shadow_colour, pos+Point<float>(2.0f, 0.0f), Image::FLIP_V);
-				g->draw_tinted(shadow_colour, pos+Point<float>(-2.0f, 2.0f), Image::FLIP_V);
-				g->draw_tinted(shadow_colour, pos+Point<float>(0.0f, 2.0f), Image::FLIP_V);
-				g->draw_tinted(shadow_colour, pos+Point<float>(2.0f, 2.0f), Image::FLIP_V);
+			Image *page = page_images[g.page];
+
+			m.render_queue->add(page, colour, Point<float>(g.position.x, g.position.y), Size<float>(g.size.w, g.size.h), pos, 0.0f, 0, set_glyph_steps, page);
+
+			pos.x += g.size.w;
+		}
+
+		m.render_queue->flush(true);
+	}
+
+	m.vertex_cache->enable_font_scaling(false);
+}
+
+void Font::draw_with_shadow(SDL_Colour colour, UTF8_Iterator begin, UTF8_Iterator end, Point<float> dest_position, std::vector<Image *> &page_images)
+{
+	static Shader::Uniform shadow_colour_uniform = Shader::get_uniform("shadow_colour");
+	static Shader::Uniform shadow_offsets_uniform = Shader::get_uniform("shadow_offsets");
+	static Shader::Uniform num_shadow_offsets_uniform = Shader::get_uniform("num_shadow_offsets");
+
+	if (m.text_shadow_shader == 0) {
+		m.text_shadow_shader = new Shader(true, shadow_vertex_source, shadow_fragment_source);
+	}
+
+	float offsets[8*2];
+	int num_offsets = 0;
+
+	if (shadow_type == DROP_SHADOW) {
+		float d = MIN(get_drop_shadow_distance(), (float)glyph_padding);
+		float drop[3*2] = { d, 0.0f, 0.0f, d, d, d };
+		memcpy(offsets, drop, sizeof(drop));
+		num_offsets = 3;
+	}
+	else {
+		for (int y = -1; y <= 1; y++) {
+			for (int x = -1; x <= 1; x++) {
+				if (x != 0 || y != 0) {
+					offsets[num_offsets*2+0] = x * 2.0f;
+					offsets[num_offsets*2+1] = y * 2.0f;
+					num_offsets++;
+				}
 			}
-			g->end();
+		}
+	}
+
+	float shadow[4] = { shadow_colour.r / 255.0f, shadow_colour.g / 255.0f, shadow_colour.b / 255.0f, shadow_colour.a / 255.0f };
 
-			pos.x += g->size.w;
+	Shader *bak = noo.current_shader;
+	noo.current_shader = m.text_shadow_shader;
+	noo.current_shader->use();
+	noo.current_shader->set_global_alpha(bak->get_global_alpha());
+	noo.current_shader->set_float_vector(shadow_colour_uniform, 4, shadow, 1);
+	noo.current_shader->set_float_vector(shadow_offsets_uniform, 2, offsets, num_offsets);
+	noo.current_shader->set_float(num_shadow_offsets_uniform, (float)num_offsets);
+
+	noo.enable_depth_buffer(true);
+	noo.clear_depth_buffer(1.0f);
+
+	Point<float> pos = dest_position;
+	Point<float> padding((float)glyph_padding, (float)glyph_padding);
+
+	// Each glyph's quad grows by the padding to leave room for its shadow
+	for (UTF8_Iterator it = begin; it != end; ++it) {
+		Glyph &g = glyphs[*it];
+
+		if (g.page >= 0) {
+			Image *page = page_images[g.page];
+			Point<float> source_position = Point<float>(g.position.x, g.position.y) - padding;
+			Size<float> size(g.size.w + glyph_padding * 2, g.size.h + glyph_padding * 2);
+			m.render_queue->add(page, colour, source_position, size, pos - padding, 0.0f, 0, set_glyph_steps, page);
 		}
 
-		noo.enable_depth_buffer(false);
+		pos.x += g.size.w;
 	}
 
-	pos.x = dest_position.x;
-	offset = 0;
+	m.render_queue->flush(true);
 
-	while ((ch = utf8_char_next(text, offset)) != 0) {
-		Image *g = glyphs[ch];
+	noo.enable_depth_buffer(false);
 
-		noo.current_shader->set_float("xstep", 1.0f / g->size.w);
-		noo.current_shader->set_float("ystep", 1.0f / g->size.h);
+	noo.current_shader = bak;
+	noo.current_shader->use();
+}
 
-		/* Glyphs are rendered upside down, so we FLIP_V them rather than flip the memory which would be slow */
+void Font::draw_sdf(SDL_Colour colour, UTF8_Iterator begin, UTF8_Iterator end, Point<float> dest_position, std::vector<Image *> &page_images)
+{
+	static Shader::Uniform shadow_colour_uniform = Shader::get_uniform("shadow_colour");
+	static Shader::Uniform shadow_offset_uniform = Shader::get_uniform("shadow_offset");
+	static Shader::Uniform outline_uniform = Shader::get_uniform("outline");
+	static Shader::Uniform smoothing_uniform = Shader::get_uniform("smoothing");
 
-		g->start();
-		g->draw_tinted(colour, pos, Image::FLIP_V);
-		g->end();
+	if (m.sdf_text_shader == 0) {
+		m.sdf_text_shader = new Shader(true, shadow_vertex_source, sdf_fragment_source);
+	}
+
+	// In font pixels. The drop shadow is roughly what the three offset copies
+	// without distance fields cover, the full one is 2 game pixels around.
+	float shadow_offset[2] = { 0.0f, 0.0f };
+	float outline = 0.0f;
+	float shadow[4] = { shadow_colour.r / 255.0f, shadow_colour.g / 255.0f, shadow_colour.b / 255.0f, shadow_colour.a / 255.0f };
 
-		pos.x += g->size.w;
+	if (shadow_type == DROP_SHADOW) {
+		float d = get_drop_shadow_distance();
+		shadow_offset[0] = shadow_offset[1] = d / 2.0f;
+		outline = d / 2.0f;
+	}
+	else if (shadow_type == FULL_SHADOW) {
+		outline = 2.0f * SDF_SCALE;
+	}
+	else {
+		shadow[3] = 0.0f;
 	}
 
-	m.vertex_cache->enable_font_scaling(false);
+	Shader *bak = noo.current_shader;
+	noo.current_shader = m.sdf_text_shader;
+	noo.current_shader->use();
+	noo.current_shader->set_global_alpha(bak->get_global_alpha());
+	noo.current_shader->set_float_vector(shadow_colour_uniform, 4, shadow, 1);
+	noo.current_shader->set_float_vector(shadow_offset_uniform, 2, shadow_offset, 1);
+	// To field values, which go from 0 to 1 over SDF_SPREAD font pixels either side of the edge
+	noo.current_shader->set_float(outline_uniform, outline / (SDF_SPREAD * 2));
+	// Half a screen pixel of antialiasing, font pixels are font_scale screen pixels
+	noo.current_shader->set_float(smoothing_uniform, 0.5f / noo.font_scale / (SDF_SPREAD * 2));
+
+	noo.enable_depth_buffer(true);
+	noo.clear_depth_buffer(1.0f);
+
+	Point<float> pos = dest_position;
+	Point<float> padding((float)glyph_padding, (float)glyph_padding);
+
+	for (UTF8_Iterator it = begin; it != end; ++it) {
+		Glyph &g = glyphs[*it];
+
+		if (g.page >= 0) {
+			Image *page = page_images[g.page];
+			Point<float> source_position = Point<float>(g.position.x, g.position.y) - padding;
+			Size<float> size(g.size.w + glyph_padding * 2, g.size.h + glyph_padding * 2);
+			m.render_queue->add(page, colour, source_position, size, pos - padding, 0.0f, 0, set_glyph_steps, page);
+		}
+
+		pos.x += g.size.w;
+	}
+
+	m.render_queue->flush(true);
+
+	noo.enable_depth_buffer(false);
+
+	noo.current_shader = bak;
+	noo.current_shader->use();
 }
 
-int Font::draw_wrapped(SDL_Colour colour, std::string text, Point<float> dest_position, int w, int line_height, int max_lines, int started_time, int delay, bool dry_run, bool &full, int &num_lines, int &width)
+int Font::draw_wrapped(SDL_Colour colour, const std::string &text, Point<float> dest_position, int w, int line_height, int max_lines, int started_time, int delay, bool dry_run, bool &full, int &num_lines, int &width)
 {
 	full = false;
-	char buf[2] = { 0 };
 	float curr_y = dest_position.y;
 	bool done = false;
 	int lines = 0;
@@ -182,85 +584,61 @@ int Font::draw_wrapped(SDL_Colour colour, std::string text, Point<float> dest_po
 	}
 	int chars_drawn = 0;
 	float max_width = 0.0f;
-	std::string p = text;
-	int total_position = 0;
+
+	Layout &layout = get_layout(text, w);
+	size_t line_num = 0;
+
 	while (done == false && lines < max_lines) {
-		int count = 0;
-		int max = 0;
-		float this_w = 0.0f;
-		int chars_drawn_this_time = 0;
-		Uint32 ch = utf8_char(p, count);
-		bool set_full = false;
-		while (ch) {
-			cache_glyph(ch);
-			Image *g = glyphs[ch];
-			this_w += g->size.w;
-			if (ch == '^' || ch == '$' || this_w >= (w * noo.scale / noo.font_scale)) {
-				if (count == 0) {
-					done = true;
-				}
-				else {
-					if (ch == '^') {
-						max = count;
-						if (set_full) {
-							full = true;
-						}
-					}
-					else if (ch == '$') {
-						max = count;
-					}
-					else if (this_w > (w * noo.scale / noo.font_scale)) {
-						count--;
-					}
-				}
-				break;
-			}
-			if (ch == ' ') {
-				max = count;
-			}
-			count++;
-			ch =  utf8_char(p, count);
-			if (chars_drawn+count < chars_to_draw) {
-				chars_drawn_this_time++;
-				set_full = true;
+		Line &line = layout.lines[line_num];
+		int p = line.start; // where the rest of the text starts
+		if (line.empty) {
+			done = true;
+		}
+		else {
+			// How much of the line has been typed out
+			int shown = MAX(0, MIN(line.scanned, chars_to_draw - chars_drawn - 1));
+			bool all_shown = line.scanned > 0 && chars_drawn + line.scanned < chars_to_draw;
+			if (line.end_char == '^' && all_shown) {
+				full = true;
 			}
-			else {
-				set_full = false;
+			int max = MIN(shown, line.length);
+			float line_w = line.width;
+			if (max < line.length) {
+				line_w = 0.0f;
+				for (int i = 0; i < max; i++) {
+					// May have been evicted since the layout was made
+					Uint32 ch = layout.chars[line.start+i];
+					cache_glyph(ch);
+					line_w += glyphs[ch].size.w;
+				}
 			}
-		}
-		if (utf8_char(p, count) == 0) {
-			max = count;
-		}
-		int old_max = max;
-		max = MIN(chars_drawn_this_time, max);
-		if (done == false) {
-			std::string s = utf8_substr(p, 0, max);
-			float line_w = get_text_width(s);
+			line_w = line_w / noo.scale * noo.font_scale;
 			if (line_w > max_width) {
 				max_width = line_w;
 			}
 			if (dry_run == false) {
-				draw(colour, s, Point<float>(dest_position.x, curr_y));
+				UTF8_Iterator begin(text, layout.offsets[line.start]);
+				UTF8_Iterator end(text, layout.offsets[line.start+max]);
+				draw_range(colour, begin, end, Point<float>(dest_position.x, curr_y));
 			}
-			total_position += max;
-			p = utf8_substr(text, total_position);
-			Uint32 ch2 = utf8_char(p, 0);
-			if (ch2 == ' ') {
+			int total_position = line.start + max;
+			p = total_position;
+			if (layout.chars[total_position] == ' ') {
 				total_position++;
-				p = utf8_substr(text, total_position);
+				p = total_position;
 			}
-			else if (ch == '^') { // new window
+			else if (line.end_char == '^') { // new window
 				total_position++;
 				done = true;
 				// Don't include in printed string
 			}
-			else if (ch == '$') { // newline
+			else if (line.end_char == '$') { // newline
 				total_position++;
-				p = utf8_substr(text, total_position);
+				p = total_position;
 			}
 			chars_drawn = total_position;
 			curr_y += line_height;
-			if (max < old_max) {
+			if (max < line.length) {
 				done = true;
 			}
 			else {
@@ -269,8 +647,11 @@ int Font::draw_wrapped(SDL_Colour colour, std::string text, Point<float> dest_po
 					full = true;
 				}
 			}
+			if (line_num + 1 < layout.lines.size()) {
+				line_num++;
+			}
 		}
-		if (utf8_char(p, 0) == 0) {
+		if (layout.chars[p] == 0) {
 			done = true;
 			full = true;
 		}
@@ -285,32 +666,310 @@ int Font::draw_wrapped(SDL_Colour colour, std::string text, Point<float> dest_po
 	return chars_drawn;
 }
 
+Font::Layout &Font::get_layout(const std::string &text, int w)
+{
+	std::pair<std::string, int> key(text, w);
+
+	std::map<std::pair<std::string, int>, Layout>::iterator it = layouts.find(key);
+
+	if (it == layouts.end()) {
+		if ((int)layouts.size() >= MAX_LAYOUTS) {
+			std::map<std::pair<std::string, int>, Layout>::iterator lru = layouts.begin();
+			for (it = layouts.begin(); it != layouts.end(); it++) {
+				if ((*it).second.last_used < (*lru).second.last_used) {
+					lru = it;
+				}
+			}
+			layouts.erase(lru);
+		}
+
+		it = layouts.insert(std::pair< std::pair<std::string, int>, Layout >(key, Layout())).first;
+		build_layout((*it).second, text, w);
+	}
+
+	Layout &layout = (*it).second;
+	layout.last_used = layout_clock++;
+
+	return layout;
+}
+
+void Font::build_layout(Layout &layout, const std::string &text, int w)
+{
+	UTF8_Iterator it(text);
+
+	while (*it != 0) {
+		layout.chars.push_back(*it);
+		layout.offsets.push_back(it.get_pointer() - text.c_str());
+		++it;
+	}
+	layout.chars.push_back(0);
+	layout.offsets.push_back(it.get_pointer() - text.c_str());
+
+	glyph_clock++;
+
+	Uint32 ch;
+
+	float max_w = w * noo.scale / noo.font_scale;
+	int start = 0;
+
+	// Break lines the same way whatever is shown, stopping where draw_wrapped
+	// always would
+	while (true) {
+		Line line;
+		line.start = start;
+		line.empty = false;
+
+		int count = 0;
+		int max = 0;
+		float this_w = 0.0f;
+		ch = layout.chars[start];
+		while (ch) {
+			cache_glyph(ch);
+			this_w += glyphs[ch].size.w;
+			if (ch == '^' || ch == '$' || this_w >= max_w) {
+				if (count == 0) {
+					line.empty = true;
+				}
+				else if (ch == '^' || ch == '$') {
+					max = count;
+				}
+				break;
+			}
+			if (ch == ' ') {
+				max = count;
+			}
+			count++;
+			ch = layout.chars[start+count];
+		}
+		if (ch == 0) {
+			max = count;
+		}
+
+		line.length = max;
+		line.scanned = count;
+		line.end_char = ch;
+		line.width = 0.0f;
+		for (int i = 0; i < max; i++) {
+			line.width += glyphs[layout.chars[start+i]].size.w;
+		}
+
+		layout.lines.push_back(line);
+
+		if (line.empty || ch == '^') {
+			break;
+		}
+
+		int next = start + max;
+		if (layout.chars[next] == ' ' || ch == '$') {
+			next++;
+		}
+
+		// Stuck lines (a word too long for the width) repeat
+		if (layout.chars[next] == 0 || next == start) {
+			break;
+		}
+
+		start = next;
+	}
+}
+
 void Font::cache_glyph(Uint32 ch)
 {
-	if (glyphs.find(ch) != glyphs.end()) {
+	std::map<Uint32, Glyph>::iterator it = glyphs.find(ch);
+
+	if (it != glyphs.end()) {
+		if ((*it).second.page >= 0) {
+			pages[(*it).second.page].last_used = glyph_clock;
+		}
 		return;
 	}
 
-	std::string s = utf8_char_to_string(ch);
-	//SDL_Surface *surface = TTF_RenderUTF8_Blended(font, s.c_str(), noo.white);
-	SDL_Surface *surface = TTF_RenderUTF8_Solid(font, s.c_str(), noo.white);
+	// Zero sized and on no page if it can't be rendered
+	Glyph &g = glyphs[ch];
+	g.page = -1;
+	g.position = Point<int>(0, 0);
+	g.size = Size<int>(0, 0);
+
+	char s[7];
+	utf8_encode(ch, s);
+	//SDL_Surface *surface = TTF_RenderUTF8_Blended(font, s, noo.white);
+	SDL_Surface *surface = TTF_RenderUTF8_Solid(font, s, noo.white);
 	if (surface == 0) {
 		errormsg("Error rendering glyph\n");
 		return;
 	}
 
-	Image *g = new Image(surface);
+	// Same format Image uses for surfaces
+	SDL_PixelFormat format;
+	format.format = SDL_PIXELFORMAT_RGBA8888;
+	format.palette = 0;
+	format.BitsPerPixel = 32;
+	format.BytesPerPixel = 4;
+	format.Rmask = 0xff;
+	format.Gmask = 0xff00;
+	format.Bmask = 0xff0000;
+	format.Amask = 0xff000000;
+	SDL_Surface *tmp = SDL_ConvertSurface(surface, &format, 0);
 
 	SDL_FreeSurface(surface);
 
-	glyphs[ch] = g;
+	if (tmp == 0) {
+		errormsg("Error converting glyph\n");
+		return;
+	}
+
+	// Padding on each side for the shadow shader to look into, and a 1 pixel
+	// gap so glyphs don't bleed into each other
+	Size<int> size(tmp->w, tmp->h);
+	Size<int> padded = size + (glyph_padding * 2 + 1);
+
+	if (size.w == 0 || size.h == 0) {
+		SDL_FreeSurface(tmp);
+		return;
+	}
+
+	if (padded.w > PAGE_SIZE || padded.h > PAGE_SIZE) {
+		errormsg("Glyph too big for font page\n");
+		SDL_FreeSurface(tmp);
+		return;
+	}
+
+	if (pages.size() > 0) {
+		Page &p = pages[current_page];
+		if (p.next.x + padded.w > PAGE_SIZE) {
+			p.next.x = 0;
+			p.next.y += p.shelf_height;
+			p.shelf_height = 0;
+		}
+	}
+
+	if (pages.size() == 0 || pages[current_page].next.y + padded.h > PAGE_SIZE) {
+		current_page = get_empty_page();
+	}
+
+	Page &p = pages[current_page];
+
+	p.last_used = glyph_clock;
+
+	g.page = current_page;
+	g.position = p.next + Point<int>(glyph_padding, glyph_padding);
+	g.size = size;
+
+	// Surfaces are top row first, pages bottom row first
+	if (noo.use_sdf_font) {
+		// The field covers the padding too
+		std::vector<unsigned char> field;
+		make_distance_field(tmp, glyph_padding, SDF_SPREAD, field);
+		int w = size.w + glyph_padding * 2;
+		int h = size.h + glyph_padding * 2;
+		for (int row = 0; row < h; row++) {
+			int page_row = PAGE_SIZE - 1 - (p.next.y + row);
+			memcpy(p.pixels + page_row * PAGE_SIZE + p.next.x, &field[row*w], w);
+		}
+	}
+	else {
+		for (int row = 0; row < size.h; row++) {
+			int page_row = PAGE_SIZE - 1 - (g.position.y + row);
+			memcpy(p.pixels + (page_row * PAGE_SIZE + g.position.x) * 4, (unsigned char *)tmp->pixels + row * tmp->pitch, size.w * 4);
+		}
+	}
+
+	SDL_FreeSurface(tmp);
+
+	// The glyph's cell, in pixels rows
+	Point<int> topleft(p.next.x, PAGE_SIZE - (p.next.y + padded.h));
+	Point<int> bottomright(p.next.x + padded.w, PAGE_SIZE - p.next.y);
+
+	if (p.dirty_bottomright.x <= p.dirty_topleft.x) {
+		p.dirty_topleft = topleft;
+		p.dirty_bottomright = bottomright;
+	}
+	else {
+		p.dirty_topleft.x = MIN(p.dirty_topleft.x, topleft.x);
+		p.dirty_topleft.y = MIN(p.dirty_topleft.y, topleft.y);
+		p.dirty_bottomright.x = MAX(p.dirty_bottomright.x, bottomright.x);
+		p.dirty_bottomright.y = MAX(p.dirty_bottomright.y, bottomright.y);
+	}
+
+	p.next.x += padded.w;
+	p.shelf_height = MAX(p.shelf_height, padded.h);
+}
+
+int Font::get_empty_page()
+{
+	int bytes = PAGE_SIZE * PAGE_SIZE * (noo.use_sdf_font ? 1 : 4);
+
+	// Pages with glyphs in use since the clock last moved are kept, so a long
+	// enough string can take more than MAX_PAGES
+	if ((int)pages.size() >= MAX_PAGES) {
+		int lru = -1;
+		for (size_t i = 0; i < pages.size(); i++) {
+			if (pages[i].last_used != glyph_clock && (lru < 0 || pages[i].last_used < pages[lru].last_used)) {
+				lru = i;
+			}
+		}
+
+		if (lru >= 0) {
+			// Its glyphs are made again when next used
+			std::map<Uint32, Glyph>::iterator it;
+			for (it = glyphs.begin(); it != glyphs.end();) {
+				if ((*it).second.page == lru) {
+					glyphs.erase(it++);
+				}
+				else {
+					it++;
+				}
+			}
+
+			Page &p = pages[lru];
+			memset(p.pixels, 0, bytes);
+			p.dirty_topleft = Point<int>(0, 0);
+			p.dirty_bottomright = Point<int>(PAGE_SIZE, PAGE_SIZE);
+			p.next = Point<int>(0, 0);
+			p.shelf_height = 0;
+			p.last_used = glyph_clock;
+
+			return lru;
+		}
+	}
+
+	Page p;
+	p.pixels = new unsigned char[bytes];
+	memset(p.pixels, 0, bytes);
+	p.image = 0;
+	p.dirty_topleft = Point<int>(0, 0);
+	p.dirty_bottomright = Point<int>(0, 0);
+	p.next = Point<int>(0, 0);
+	p.shelf_height = 0;
+	p.last_used = glyph_clock;
+	pages.push_back(p);
+
+	return pages.size()-1;
 }
 
-void Font::cache_glyphs(std::string text)
+Image *Font::get_page_image(int page)
 {
-	int offset = 0;
-	int ch;
-	while ((ch = utf8_char_next(text, offset)) != 0) {
-		cache_glyph(ch);
+	Page &p = pages[page];
+
+	if (p.image == 0) {
+		p.image = new Image(p.pixels, Size<int>(PAGE_SIZE, PAGE_SIZE), noo.use_sdf_font);
+	}
+	else if (p.dirty_bottomright.x > p.dirty_topleft.x) {
+		// Only what's new rather than the whole page
+		p.image->update_region(p.pixels, p.dirty_topleft, Size<int>(p.dirty_bottomright.x - p.dirty_topleft.x, p.dirty_bottomright.y - p.dirty_topleft.y));
+	}
+
+	p.dirty_topleft = Point<int>(0, 0);
+	p.dirty_bottomright = Point<int>(0, 0);
+
+	return p.image;
+}
+
+void Font::cache_glyphs(UTF8_Iterator begin, UTF8_Iterator end)
+{
+	glyph_clock++;
+
+	for (UTF8_Iterator it = begin; it != end; ++it) {
+		cache_glyph(*it);
 	}
 }
@@ -0,0 +1,503 @@
+#include "Nooskewl_Engine/hpa_star.h"
+#include "Nooskewl_Engine/map.h"
+#include "Nooskewl_Engine/tilemap.h"
+
+using namespace Nooskewl_Engine;
+
+HPA_Star::HPA_Star(Map *map, A_Star *a_star) :
+	map(map),
+	a_star(a_star),
+	size(0, 0),
+	num_clusters(0, 0),
+	built(false),
+	generation(0)
+{
+}
+
+HPA_Star::~HPA_Star()
+{
+}
+
+A_Star::Path HPA_Star::find_path(Point<int> start, Point<int> goal)
+{
+	A_Star::Path path;
+
+	if (built == false) {
+		build();
+	}
+	else {
+		rebuild_dirty();
+	}
+
+	if (start.x < 0 || start.y < 0 || start.x >= size.w || start.y >= size.h) {
+		return path;
+	}
+	if (goal.x < 0 || goal.y < 0 || goal.x >= size.w || goal.y >= size.h) {
+		return path;
+	}
+
+	int start_cluster = get_cluster(start);
+	int goal_cluster = get_cluster(goal);
+
+	if (start_cluster == goal_cluster || is_walkable(start) == false || is_walkable(goal) == false) {
+		if (start_cluster == goal_cluster) {
+			Cluster &c = clusters[start_cluster];
+			path = a_star->find_path(start, goal, true, c.topleft, c.bottomright);
+			if (path.size() > 0) {
+				return path;
+			}
+		}
+		return a_star->find_path(start, goal);
+	}
+
+	// The start and goal are extra nodes joined to the nodes of their clusters
+	int start_node = nodes.size();
+	int goal_node = start_node + 1;
+
+	std::vector<Edge> start_edges;
+	std::vector<Edge> goal_edges;
+	Edge e;
+
+	get_distances(start_cluster, start, distances);
+	Cluster &sc = clusters[start_cluster];
+	for (size_t i = 0; i < sc.nodes.size(); i++) {
+		Point<int> p = nodes[sc.nodes[i]].position;
+		int d = distances[(p.y - sc.topleft.y) * (sc.bottomright.x - sc.topleft.x + 1) + (p.x - sc.topleft.x)];
+		if (d >= 0) {
+			e.node = sc.nodes[i];
+			e.cost = d;
+			start_edges.push_back(e);
+		}
+	}
+
+	get_distances(goal_cluster, goal, distances);
+	Cluster &gc = clusters[goal_cluster];
+	for (size_t i = 0; i < gc.nodes.size(); i++) {
+		Point<int> p = nodes[gc.nodes[i]].position;
+		int d = distances[(p.y - gc.topleft.y) * (gc.bottomright.x - gc.topleft.x + 1) + (p.x - gc.topleft.x)];
+		if (d >= 0) {
+			e.node = gc.nodes[i];
+			e.cost = d;
+			goal_edges.push_back(e);
+		}
+	}
+
+	if (start_edges.size() == 0 || goal_edges.size() == 0) {
+		return path; // walled into their clusters
+	}
+
+	if (search_nodes.size() < nodes.size() + 2) {
+		Search_Node s;
+		s.generation = 0;
+		search_nodes.resize(nodes.size() + 2, s);
+	}
+
+	generation++;
+	if (generation == 0) {
+		for (size_t i = 0; i < search_nodes.size(); i++) {
+			search_nodes[i].generation = 0;
+		}
+		generation = 1;
+	}
+
+	open.clear();
+
+	Search_Node &s = search_nodes[start_node];
+	s.generation = generation;
+	s.parent = -1;
+	s.cost_from_start = 0;
+	s.closed = false;
+
+	Open_Node o;
+	o.node = start_node;
+	o.cost_from_start = 0;
+	o.total_cost = heuristic(start, goal);
+	open.push_back(o);
+
+	std::vector<Edge> neighbours;
+	bool found = false;
+
+	while (open.size() > 0) {
+		Open_Node top = open.front();
+		std::pop_heap(open.begin(), open.end(), open_order);
+		open.pop_back();
+
+		Search_Node &node = search_nodes[top.node];
+
+		if (node.closed || top.cost_from_start != node.cost_from_start) {
+			continue;
+		}
+
+		node.closed = true;
+
+		if (top.node == goal_node) {
+			found = true;
+			break;
+		}
+
+		if (top.node == start_node) {
+			neighbours = start_edges;
+		}
+		else {
+			Node &n = nodes[top.node];
+			neighbours = n.edges;
+			e.node = n.partner;
+			e.cost = 1;
+			neighbours.push_back(e);
+			if (n.cluster == goal_cluster) {
+				for (size_t i = 0; i < goal_edges.size(); i++) {
+					if (goal_edges[i].node == top.node) {
+						e.node = goal_node;
+						e.cost = goal_edges[i].cost;
+						neighbours.push_back(e);
+						break;
+					}
+				}
+			}
+		}
+
+		for (size_t i = 0; i < neighbours.size(); i++) {
+			int to = neighbours[i].node;
+			int new_cost = node.cost_from_start + neighbours[i].cost;
+			Search_Node &t = search_nodes[to];
+
+			if (t.generation != generation) {
+				t.generation = generation;
+				t.parent = -1;
+				t.cost_from_start = INT_MAX;
+				t.closed = false;
+			}
+
+			if (t.closed || t.cost_from_start <= new_cost) {
+				continue;
+			}
+
+			t.parent = top.node;
+			t.cost_from_start = new_cost;
+
+			o.node = to;
+			o.cost_from_start = new_cost;
+			o.total_cost = new_cost + (to == goal_node ? 0 : heuristic(nodes[to].position, goal));
+			open.push_back(o);
+			std::push_heap(open.begin(), open.end(), open_order);
+		}
+	}
+
+	if (found == false) {
+		return path;
+	}
+
+	std::vector< Point<int> > waypoints;
+	waypoints.push_back(goal);
+	for (int i = search_nodes[goal_node].parent; i != start_node; i = search_nodes[i].parent) {
+		waypoints.push_back(nodes[i].position);
+	}
+	waypoints.push_back(start);
+	std::reverse(waypoints.begin(), waypoints.end());
+
+	// Fill in between waypoints, which are either side of an entrance or in
+	// the same cluster
+	for (size_t i = 0; i+1 < waypoints.size(); i++) {
+		Point<int> a = waypoints[i];
+		Point<int> b = waypoints[i+1];
+
+		if (a == b) {
+			continue;
+		}
+
+		if (get_cluster(a) != get_cluster(b)) {
+			if (map->is_solid(-1, 0, b, Size<int>(1, 1), true, false)) {
+				return a_star->find_path(start, goal);
+			}
+			path.push_back(b);
+			continue;
+		}
+
+		Cluster &c = clusters[get_cluster(a)];
+		A_Star::Path part = a_star->find_path(a, b, true, c.topleft, c.bottomright);
+		if (part.size() == 0) {
+			// Blocked by an entity
+			return a_star->find_path(start, goal);
+		}
+		path.insert(path.end(), part.begin(), part.end());
+	}
+
+	return path;
+}
+
+void HPA_Star::invalidate(Point<int> topleft, Point<int> bottomright)
+{
+	if (built == false) {
+		return;
+	}
+
+	int x1 = MAX(0, topleft.x) / CLUSTER_SIZE;
+	int y1 = MAX(0, topleft.y) / CLUSTER_SIZE;
+	int x2 = MIN(size.w-1, bottomright.x) / CLUSTER_SIZE;
+	int y2 = MIN(size.h-1, bottomright.y) / CLUSTER_SIZE;
+
+	for (int y = y1; y <= y2; y++) {
+		for (int x = x1; x <= x2; x++) {
+			clusters[y * num_clusters.w + x].dirty = true;
+		}
+	}
+}
+
+bool HPA_Star::open_order(const Open_Node &a, const Open_Node &b)
+{
+	if (a.total_cost != b.total_cost) {
+		return a.total_cost > b.total_cost;
+	}
+	return a.cost_from_start < b.cost_from_start;
+}
+
+void HPA_Star::build()
+{
+	size = map->get_tilemap()->get_size();
+	num_clusters.w = (size.w + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+	num_clusters.h = (size.h + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+
+	clusters.clear();
+	borders.clear();
+	nodes.clear();
+	free_nodes.clear();
+
+	for (int y = 0; y < num_clusters.h; y++) {
+		for (int x = 0; x < num_clusters.w; x++) {
+			Cluster c;
+			c.topleft = Point<int>(x * CLUSTER_SIZE, y * CLUSTER_SIZE);
+			c.bottomright = Point<int>(MIN(size.w, (x+1) * CLUSTER_SIZE) - 1, MIN(size.h, (y+1) * CLUSTER_SIZE) - 1);
+			c.dirty = false;
+			clusters.push_back(c);
+		}
+	}
+
+	for (int y = 0; y < num_clusters.h; y++) {
+		for (int x = 0; x < num_clusters.w; x++) {
+			int cluster = y * num_clusters.w + x;
+			Border b;
+			b.cluster = cluster;
+			if (x+1 < num_clusters.w) {
+				b.other = cluster + 1;
+				b.vertical = true;
+				clusters[b.cluster].borders.push_back(borders.size());
+				clusters[b.other].borders.push_back(borders.size());
+				borders.push_back(b);
+			}
+			if (y+1 < num_clusters.h) {
+				b.other = cluster + num_clusters.w;
+				b.vertical = false;
+				clusters[b.cluster].borders.push_back(borders.size());
+				clusters[b.other].borders.push_back(borders.size());
+				borders.push_back(b);
+			}
+		}
+	}
+
+	for (size_t i = 0; i < borders.size(); i++) {
+		build_border(i);
+	}
+
+	for (size_t i = 0; i < clusters.size(); i++) {
+		build_edges(i);
+	}
+
+	built = true;
+}
+
+void HPA_Star::rebuild_dirty()
+{
+	std::vector<int> affected;
+
+	for (size_t i = 0; i < clusters.size(); i++) {
+		Cluster &c = clusters[i];
+		if (c.dirty == false) {
+			continue;
+		}
+		c.dirty = false;
+
+		// Entrances on every side change, and with them the nodes of the
+		// neighbours on the other side
+		affected.push_back(i);
+		for (size_t j = 0; j < c.borders.size(); j++) {
+			Border &b = borders[c.borders[j]];
+			build_border(c.borders[j]);
+			affected.push_back(b.cluster == (int)i ? b.other : b.cluster);
+		}
+	}
+
+	std::sort(affected.begin(), affected.end());
+	affected.erase(std::unique(affected.begin(), affected.end()), affected.end());
+
+	for (size_t i = 0; i < affected.size(); i++) {
+		build_edges(affected[i]);
+	}
+}
+
+void HPA_Star::build_border(int border)
+{
+	Border &b = borders[border];
+
+	for (size_t i = 0; i < b.nodes.size(); i++) {
+		free_node(b.nodes[i]);
+	}
+	b.nodes.clear();
+
+	Cluster &c = clusters[b.cluster];
+
+	// Walk along the border in the cluster, with the other cluster a step away
+	Point<int> first = b.vertical ? Point<int>(c.bottomright.x, c.topleft.y) : Point<int>(c.topleft.x, c.bottomright.y);
+	Point<int> along = b.vertical ? Point<int>(0, 1) : Point<int>(1, 0);
+	Point<int> across = b.vertical ? Point<int>(1, 0) : Point<int>(0, 1);
+	int length = b.vertical ? c.bottomright.y - c.topleft.y + 1 : c.bottomright.x - c.topleft.x + 1;
+
+	int run_start = -1;
+
+	for (int i = 0; i <= length; i++) {
+		Point<int> p = first + along * i;
+		bool open = i < length && is_walkable(p) && is_walkable(p + across);
+
+		if (open && run_start < 0) {
+			run_start = i;
+		}
+		else if (open == false && run_start >= 0) {
+			int run_end = i - 1;
+			std::vector<int> positions;
+			if (run_end - run_start + 1 < MAX_ENTRANCE_WIDTH) {
+				positions.push_back((run_start + run_end) / 2);
+			}
+			else {
+				positions.push_back(run_start);
+				positions.push_back(run_end);
+			}
+			for (size_t j = 0; j < positions.size(); j++) {
+				Point<int> here = first + along * positions[j];
+				int n1 = add_node(here, b.cluster);
+				int n2 = add_node(here + across, b.other);
+				nodes[n1].partner = n2;
+				nodes[n2].partner = n1;
+				b.nodes.push_back(n1);
+				b.nodes.push_back(n2);
+			}
+			run_start = -1;
+		}
+	}
+}
+
+void HPA_Star::build_edges(int cluster)
+{
+	Cluster &c = clusters[cluster];
+
+	c.nodes.clear();
+	for (size_t i = 0; i < c.borders.size(); i++) {
+		Border &b = borders[c.borders[i]];
+		for (size_t j = 0; j < b.nodes.size(); j++) {
+			if (nodes[b.nodes[j]].cluster == cluster) {
+				c.nodes.push_back(b.nodes[j]);
+			}
+		}
+	}
+
+	int w = c.bottomright.x - c.topleft.x + 1;
+
+	for (size_t i = 0; i < c.nodes.size(); i++) {
+		Node &n = nodes[c.nodes[i]];
+		n.edges.clear();
+		get_distances(cluster, n.position, distances);
+		for (size_t j = 0; j < c.nodes.size(); j++) {
+			if (i == j) {
+				continue;
+			}
+			Point<int> p = nodes[c.nodes[j]].position;
+			int d = distances[(p.y - c.topleft.y) * w + (p.x - c.topleft.x)];
+			if (d >= 0) {
+				Edge e;
+				e.node = c.nodes[j];
+				e.cost = d;
+				n.edges.push_back(e);
+			}
+		}
+	}
+}
+
+int HPA_Star::add_node(Point<int> position, int cluster)
+{
+	int index;
+
+	if (free_nodes.size() > 0) {
+		index = free_nodes.back();
+		free_nodes.pop_back();
+	}
+	else {
+		index = nodes.size();
+		nodes.push_back(Node());
+	}
+
+	Node &n = nodes[index];
+	n.position = position;
+	n.cluster = cluster;
+	n.partner = -1;
+	n.edges.clear();
+
+	return index;
+}
+
+void HPA_Star::free_node(int node)
+{
+	nodes[node].cluster = -1;
+	nodes[node].edges.clear();
+	free_nodes.push_back(node);
+}
+
+void HPA_Star::get_distances(int cluster, Point<int> from, std::vector<int> &distances)
+{
+	static const Point<int> offsets[4] = {
+		Point<int>(0, -1),
+		Point<int>(-1, 0),
+		Point<int>(1, 0),
+		Point<int>(0, 1)
+	};
+
+	Cluster &c = clusters[cluster];
+	int w = c.bottomright.x - c.topleft.x + 1;
+	int h = c.bottomright.y - c.topleft.y + 1;
+
+	distances.assign(w * h, -1);
+	queue.clear();
+
+	// Steps all cost the same so a breadth first search gives the shortest
+	distances[(from.y - c.topleft.y) * w + (from.x - c.topleft.x)] = 0;
+	queue.push_back(from);
+
+	for (size_t i = 0; i < queue.size(); i++) {
+		Point<int> p = queue[i];
+		int d = distances[(p.y - c.topleft.y) * w + (p.x - c.topleft.x)];
+		for (int j = 0; j < 4; j++) {
+			Point<int> q = p + offsets[j];
+			if (q.x < c.topleft.x || q.y < c.topleft.y || q.x > c.bottomright.x || q.y > c.bottomright.y) {
+				continue;
+			}
+			int index = (q.y - c.topleft.y) * w + (q.x - c.topleft.x);
+			if (distances[index] >= 0 || is_walkable(q) == false) {
+				continue;
+			}
+			distances[index] = d + 1;
+			queue.push_back(q);
+		}
+	}
+}
+
+int HPA_Star::get_cluster(Point<int> position)
+{
+	return (position.y / CLUSTER_SIZE) * num_clusters.w + position.x / CLUSTER_SIZE;
+}
+
+bool HPA_Star::is_walkable(Point<int> position)
+{
+	return map->get_tilemap()->is_solid(-1, position) == false;
+}
+
+int HPA_Star::heuristic(Point<int> start, Point<int> end)
+{
+	return abs(start.x - end.x) + abs(start.y - end.y);
+}
@@ -1,5 +1,7 @@
 // http://paulbourke.net/dataformats/tga/
 
+#include "Nooskewl_Engine/asset_loader.h"
+#include "Nooskewl_Engine/cpa.h"
 #include "Nooskewl_Engine/engine.h"
 #include "Nooskewl_Engine/error.h"
 #include "Nooskewl_Engine/image.h"
@@ -180,6 +182,23 @@ unsigned char *Image::read_tga(std::string filename, Size<int> &out_size, SDL_Co
 	return pixels;
 }
 
+bool Image::read_tga_size(std::string filename, Size<int> &out_size)
+{
+	SDL_RWops *file = noo.cpa->open(filename);
+	if (file == 0) {
+		return false;
+	}
+
+	// Width and height are 12 bytes into the header
+	SDL_RWseek(file, 12, RW_SEEK_SET);
+	out_size.w = SDL_ReadLE16(file);
+	out_size.h = SDL_ReadLE16(file);
+
+	SDL_RWclose(file);
+
+	return true;
+}
+
 void Image::merge_bytes(unsigned char *pixel, unsigned char *p, int bytes, TGA_Header *header)
 {
 	if (header->colourmaptype == 1) {
@@ -296,6 +315,33 @@ Image::Image(Size<int> size) :
 	free(pixels);
 }
 
+Image::Image(unsigned char *pixels, Size<int> size, bool alpha_only) :
+	filename("--FROM SURFACE--"), // handled the same
+	size(size)
+{
+	internal = new Internal(pixels, size, false, alpha_only);
+}
+
+Image::Image(std::string filename, unsigned char *pixels, Size<int> size) :
+	filename(filename)
+{
+	// Could have been loaded synchronously while it was decoding
+	for (size_t i = 0; i < loaded_images.size(); i++) {
+		Internal *ii = loaded_images[i];
+		if (ii->filename == filename) {
+			ii->refcount++;
+			internal = ii;
+			this->size = internal->size;
+			delete[] pixels;
+			return;
+		}
+	}
+
+	internal = new Internal(filename, pixels, size, keep_data);
+	this->size = size;
+	loaded_images.push_back(internal);
+}
+
 Image::~Image()
 {
 	release();
@@ -327,6 +373,11 @@ void Image::reload()
 		return;
 	}
 
+	// If it's being loaded in the background, finish that rather than load it twice
+	if (noo.asset_loader != 0) {
+		noo.asset_loader->finish_image(filename);
+	}
+
 	for (size_t i = 0; i < loaded_images.size(); i++) {
 		Internal *ii = loaded_images[i];
 		if (ii->filename == filename) {
@@ -415,6 +466,11 @@ bool Image::save(std::string filename)
 	return true;
 }
 
+void Image::update_region(unsigned char *pixels, Point<int> position, Size<int> region_size)
+{
+	internal->upload_region(pixels, position, region_size);
+}
+
 unsigned char Image::find_colour_in_palette(unsigned char *p)
 {
 	for (unsigned int i = 0; i < 256; i++) {
@@ -678,7 +734,8 @@ Image::Internal::Internal(std::string filename, bool keep_data, bool support_ren
 	loaded_data(0),
 	filename(filename),
 	refcount(1),
-	has_render_to_texture(support_render_to_texture)
+	has_render_to_texture(support_render_to_texture),
+	alpha_only(false)
 {
 	unsigned char *pixels = reload(keep_data);
 
@@ -691,15 +748,40 @@ Image::Internal::Internal(std::string filename, bool keep_data, bool support_ren
 	}
 }
 
-Image::Internal::Internal(unsigned char *pixels, Size<int> size, bool support_render_to_texture) :
+Image::Internal::Internal(unsigned char *pixels, Size<int> size, bool support_render_to_texture, bool alpha_only) :
 	loaded_data(0),
 	size(size),
-	has_render_to_texture(support_render_to_texture)
+	has_render_to_texture(support_render_to_texture),
+	alpha_only(alpha_only)
 {
 	filename = "--FROM SURFACE--";
 	upload(pixels);
 }
 
+Image::Internal::Internal(std::string filename, unsigned char *pixels, Size<int> size, bool keep_data) :
+	loaded_data(0),
+	filename(filename),
+	size(size),
+	refcount(1),
+	has_render_to_texture(false),
+	alpha_only(false)
+{
+	try {
+		upload(pixels);
+	}
+	catch (Error e) {
+		delete[] pixels;
+		throw e;
+	}
+
+	if (keep_data) {
+		loaded_data = pixels;
+	}
+	else {
+		delete[] pixels;
+	}
+}
+
 Image::Internal::~Internal()
 {
 	release();
@@ -717,6 +799,9 @@ void Image::Internal::release()
 
 		glDeleteTextures(1, &texture);
 		printGLerror("glDeleteTextures");
+
+		// Its name can be given to the next texture created
+		Shader::forget_bound_texture();
 	}
 #ifdef NOOSKEWL_ENGINE_WINDOWS
 	else {
@@ -760,7 +845,7 @@ unsigned char *Image::Internal::reload(bool keep_data)
 void Image::Internal::upload(unsigned char *pixels)
 {
 	// To get a complete palette..
-	if (dumping_colours) {
+	if (dumping_colours && alpha_only == false) {
 		unsigned char *rgb = pixels;
 		for (int i = 0; i < size.w*size.h; i++) {
 			if (rgb[3] != 0) {
@@ -783,8 +868,21 @@ void Image::Internal::upload(unsigned char *pixels)
 		glBindTexture(GL_TEXTURE_2D, texture);
 		printGLerror("glBindTexture");
 
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size.w, size.h, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
-		printGLerror("glTexImage2D");
+		Shader::forget_bound_texture();
+
+		if (alpha_only) {
+			// Rows of single bytes aren't 4 byte aligned
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			printGLerror("glPixelStorei");
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, size.w, size.h, 0, GL_ALPHA, GL_UNSIGNED_BYTE, pixels);
+			printGLerror("glTexImage2D");
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			printGLerror("glPixelStorei");
+		}
+		else {
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size.w, size.h, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+			printGLerror("glTexImage2D");
+		}
 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 		printGLerror("glTexParameteri");
@@ -868,6 +966,23 @@ void Image::Internal::upload(unsigned char *pixels)
 				infomsg("UpdateTexture failed\n");
 			}
 		}
+		else if (alpha_only) {
+			err = noo.d3d_device->CreateTexture(size.w, size.h, 1, 0, D3DFMT_A8, D3DPOOL_MANAGED, &video_texture, 0);
+			if (err != D3D_OK) {
+				infomsg("CreateTexture failed for video texture\n");
+			}
+
+			D3DLOCKED_RECT locked_rect;
+			if (video_texture->LockRect(0, &locked_rect, 0, 0) == D3D_OK) {
+				for (int y = 0; y < size.h; y++) {
+					memcpy(((unsigned char *)locked_rect.pBits) + y * locked_rect.Pitch, pixels + y * size.w, size.w);
+				}
+				video_texture->UnlockRect(0);
+			}
+			else {
+				infomsg("Unable to lock video texture\n");
+			}
+		}
 		else {
 			err = noo.d3d_device->CreateTexture(size.w, size.h, 1, 0, D3DFMT_A8R8G8B8, D3DPOOL_MANAGED, &video_texture, 0);
 			if (err != D3D_OK) {
@@ -900,3 +1015,79 @@ void Image::Internal::upload(unsigned char *pixels)
 	}
 #endif
 }
+
+void Image::Internal::upload_region(unsigned char *pixels, Point<int> position, Size<int> region_size)
+{
+	if (noo.opengl) {
+		glActiveTexture(GL_TEXTURE0);
+		printGLerror("glActiveTexture");
+
+		glBindTexture(GL_TEXTURE_2D, texture);
+		printGLerror("glBindTexture");
+
+		Shader::forget_bound_texture();
+
+		// Rows of the region are a whole image row apart
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, size.w);
+		printGLerror("glPixelStorei");
+
+		if (alpha_only) {
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			printGLerror("glPixelStorei");
+			glTexSubImage2D(GL_TEXTURE_2D, 0, position.x, position.y, region_size.w, region_size.h, GL_ALPHA, GL_UNSIGNED_BYTE, pixels + position.y * size.w + position.x);
+			printGLerror("glTexSubImage2D");
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			printGLerror("glPixelStorei");
+		}
+		else {
+			glTexSubImage2D(GL_TEXTURE_2D, 0, position.x, position.y, region_size.w, region_size.h, GL_RGBA, GL_UNSIGNED_BYTE, pixels + (position.y * size.w + position.x) * 4);
+			printGLerror("glTexSubImage2D");
+		}
+
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		printGLerror("glPixelStorei");
+	}
+#ifdef NOOSKEWL_ENGINE_WINDOWS
+	else {
+		LPDIRECT3DTEXTURE9 locked_texture = has_render_to_texture ? system_texture : video_texture;
+
+		RECT rect;
+		rect.left = position.x;
+		rect.top = position.y;
+		rect.right = position.x + region_size.w;
+		rect.bottom = position.y + region_size.h;
+
+		D3DLOCKED_RECT locked_rect;
+		if (locked_texture->LockRect(0, &locked_rect, &rect, 0) == D3D_OK) {
+			for (int y = 0; y < region_size.h; y++) {
+				if (alpha_only) {
+					memcpy(((unsigned char *)locked_rect.pBits) + y * locked_rect.Pitch, pixels + (position.y + y) * size.w + position.x, region_size.w);
+					continue;
+				}
+				unsigned char *src = pixels + ((position.y + y) * size.w + position.x) * 4;
+				unsigned char *dest = ((unsigned char *)locked_rect.pBits) + y * locked_rect.Pitch;
+				for (int x = 0; x < region_size.w; x++) {
+					unsigned char r = *src++;
+					unsigned char g = *src++;
+					unsigned char b = *src++;
+					unsigned char a = *src++;
+					*dest++ = b;
+					*dest++ = g;
+					*dest++ = r;
+					*dest++ = a;
+				}
+			}
+			locked_texture->UnlockRect(0);
+		}
+		else {
+			infomsg("Unable to lock texture\n");
+		}
+
+		if (has_render_to_texture) {
+			if (noo.d3d_device->UpdateTexture((IDirect3DBaseTexture9 *)system_texture, (IDirect3DBaseTexture9 *)video_texture) != D3D_OK) {
+				infomsg("UpdateTexture failed\n");
+			}
+		}
+	}
+#endif
+}
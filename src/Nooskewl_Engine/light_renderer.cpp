@@ -0,0 +1,177 @@
+#include "Nooskewl_Engine/engine.h"
+#include "Nooskewl_Engine/image.h"
+#include "Nooskewl_Engine/internal.h"
+#include "Nooskewl_Engine/light_renderer.h"
+#include "Nooskewl_Engine/shader.h"
+#include "Nooskewl_Engine/vertex_buffer.h"
+
+using namespace Nooskewl_Engine;
+
+// Built in rather than in shaders/ since games don't ship them. The light is
+// a quad with texture coordinates -1 to 1 from its centre. Its vertex colours
+// are white but are used anyway, so in_colour isn't optimised out.
+static const char *light_vertex_source =
+	"#version 110\n"
+	"attribute vec3 in_position;\n"
+	"attribute vec2 in_texcoord;\n"
+	"attribute vec4 in_colour;\n"
+	"uniform mat4 model;\n"
+	"uniform mat4 view;\n"
+	"uniform mat4 proj;\n"
+	"uniform float radius;\n"
+	"varying vec2 offset;\n"
+	"varying vec4 colour;\n"
+	"void main()\n"
+	"{\n"
+	"	offset = in_texcoord * radius;\n"
+	"	colour = in_colour;\n"
+	"	gl_Position = proj * view * model * vec4(in_position, 1.0);\n"
+	"}\n";
+
+// Same falloff as Tilemap::get_light_amount. Walls are found by stepping
+// through the occluder from the light to the pixel.
+static const char *light_fragment_source =
+	"#version 110\n"
+	"uniform sampler2D tex;\n"
+	"uniform vec2 map_size;\n"
+	"uniform vec3 light_position;\n"
+	"uniform vec4 light_colour;\n"
+	"uniform float reach;\n"
+	"uniform float falloff;\n"
+	"varying vec2 offset;\n"
+	"varying vec4 colour;\n"
+	"void main()\n"
+	"{\n"
+	"	float distance = length(vec3(offset, -light_position.z));\n"
+	"	float mul = distance <= reach ? 1.0 : clamp(1.0 - (distance - reach) / falloff, 0.0, 1.0);\n"
+	"	vec2 light_tile = floor(light_position.xy + 0.5);\n"
+	"	vec2 tile = floor(light_position.xy + offset + 0.5);\n"
+	"	for (int i = 1; i < 32 && mul > 0.0; i++) {\n"
+	"		vec2 p = floor(mix(light_position.xy, light_position.xy + offset, float(i) / 32.0) + 0.5);\n"
+	"		if (p == tile) {\n"
+	"			break;\n"
+	"		}\n"
+	"		if (p == light_tile) {\n"
+	"			continue;\n"
+	"		}\n"
+	"		float top = texture2D(tex, vec2((p.x + 0.5) / map_size.x, 1.0 - (p.y + 0.5) / map_size.y)).r * 255.0;\n"
+	"		if (top > 0.5 && top - 1.0 >= light_position.z) {\n"
+	"			mul = 0.0;\n"
+	"		}\n"
+	"	}\n"
+	"	gl_FragColor = vec4(light_colour.rgb * colour.rgb * mul, 1.0);\n"
+	"}\n";
+
+Light_Renderer::Light_Renderer() :
+	buffer(0)
+{
+	shader = new Shader(true, light_vertex_source, light_fragment_source);
+
+	float vertices[6*5] = {
+		-1.0f, -1.0f, 0.0f, -1.0f, -1.0f,
+		1.0f, -1.0f, 0.0f, 1.0f, -1.0f,
+		1.0f, 1.0f, 0.0f, 1.0f, 1.0f,
+		-1.0f, -1.0f, 0.0f, -1.0f, -1.0f,
+		1.0f, 1.0f, 0.0f, 1.0f, 1.0f,
+		-1.0f, 1.0f, 0.0f, -1.0f, 1.0f
+	};
+
+	quad = new Vertex_Buffer(vertices, 6);
+}
+
+Light_Renderer::~Light_Renderer()
+{
+	delete buffer;
+	delete quad;
+	delete shader;
+}
+
+void Light_Renderer::start(SDL_Colour base)
+{
+	// Drawn at game resolution, the same as everything else before scaling
+	if (buffer == 0 || buffer->size.w != noo.screen_size.w || buffer->size.h != noo.screen_size.h) {
+		delete buffer;
+		buffer = new Image(noo.screen_size);
+	}
+
+	old_target = noo.target_image;
+	old_shader = noo.current_shader;
+	old_depth_buffer_enabled = noo.is_depth_buffer_enabled();
+	noo.get_matrices(old_model, old_view, old_proj);
+
+	noo.enable_depth_buffer(false);
+
+	noo.set_target_image(buffer);
+	noo.clear(base);
+
+	noo.current_shader = shader;
+	noo.current_shader->use();
+
+	// Lights add up
+	glBlendFunc(GL_ONE, GL_ONE);
+	printGLerror("glBlendFunc");
+}
+
+void Light_Renderer::draw_light(Point<float> map_offset, Vec3D<float> position, SDL_Colour colour, float reach, float falloff, Image *occluder)
+{
+	float radius = reach + falloff;
+
+	if (radius <= 0.0f) {
+		return;
+	}
+
+	// Pixels are lit by their centre, like a tile is by its position
+	Point<float> centre = map_offset + Point<float>((position.x + 0.5f) * noo.tile_size, (position.y + 0.5f) * noo.tile_size);
+
+	glm::mat4 model, view, proj;
+	noo.get_matrices(model, view, proj);
+	model = glm::translate(glm::mat4(), glm::vec3(centre.x, centre.y, 0.0f));
+	model = glm::scale(model, glm::vec3(radius * noo.tile_size, radius * noo.tile_size, 1.0f));
+	noo.set_matrices(model, view, proj);
+	noo.update_projection();
+
+	float map_size[2] = { (float)occluder->size.w, (float)occluder->size.h };
+	float light_position[3] = { position.x, position.y, position.z };
+	float light_colour[4] = { colour.r / 255.0f, colour.g / 255.0f, colour.b / 255.0f, 1.0f };
+
+	shader->set_texture("tex", occluder);
+	shader->set_float_vector("map_size", 2, map_size, 1);
+	shader->set_float_vector("light_position", 3, light_position, 1);
+	shader->set_float_vector("light_colour", 4, light_colour, 1);
+	shader->set_float("radius", radius);
+	shader->set_float("reach", reach);
+	shader->set_float("falloff", falloff);
+
+	quad->draw(0, 6);
+}
+
+void Light_Renderer::end()
+{
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	printGLerror("glBlendFunc");
+
+	noo.current_shader = old_shader;
+	noo.current_shader->use();
+
+	if (old_target) {
+		noo.set_target_image(old_target);
+	}
+	else {
+		noo.set_target_backbuffer();
+	}
+
+	// Back to whatever projection was in use, which may be the map transition
+	noo.set_matrices(old_model, old_view, old_proj);
+	noo.update_projection();
+
+	// Multiply
+	glBlendFunc(GL_DST_COLOR, GL_ZERO);
+	printGLerror("glBlendFunc");
+
+	buffer->draw_single(Point<float>(0.0f, 0.0f));
+
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	printGLerror("glBlendFunc");
+
+	noo.enable_depth_buffer(old_depth_buffer_enabled);
+}
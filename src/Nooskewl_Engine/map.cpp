@@ -1,11 +1,15 @@
 #include "Nooskewl_Engine/a_star.h"
 #include "Nooskewl_Engine/brain.h"
 #include "Nooskewl_Engine/engine.h"
+#include "Nooskewl_Engine/hpa_star.h"
 #include "Nooskewl_Engine/image.h"
 #include "Nooskewl_Engine/internal.h"
 #include "Nooskewl_Engine/map.h"
 #include "Nooskewl_Engine/map_entity.h"
 #include "Nooskewl_Engine/map_logic.h"
+#include "Nooskewl_Engine/path_cache.h"
+#include "Nooskewl_Engine/path_scheduler.h"
+#include "Nooskewl_Engine/render_queue.h"
 #include "Nooskewl_Engine/speech.h"
 #include "Nooskewl_Engine/sprite.h"
 #include "Nooskewl_Engine/tilemap.h"
@@ -68,7 +72,7 @@ static void walk_close_to_bed(Sit_Sleep_Data *data)
 			pos.x--;
 			break;
 	}
-	std::list<A_Star::Node *> path = noo.map->find_path(data->entity->get_position(), pos, false);
+	A_Star::Path path = noo.map->find_path(data->entity->get_position(), pos, false);
 	data->entity->set_path(path, sit_sleep_handler, data);
 }
 
@@ -98,29 +102,62 @@ void Map::sit_sleep_callback(void *data)
 Map::Map(std::string map_name, bool been_here_before, int last_visited_time) :
 	offset(0.0f, 0.0f),
 	panning(false),
+	occupancy_dirty(true),
+	occupancy_version(0),
 	speech(0),
 	map_name(map_name),
 	new_map_name(""),
 	a_star(0),
+	hpa_star(0),
+	path_scheduler(0),
+	path_cache(0),
 	been_here_before(been_here_before)
 {
-	tilemap = new Tilemap(map_name);
+	tilemap = noo.take_prefetched_tilemap(map_name);
+	if (tilemap == 0) {
+		tilemap = new Tilemap(map_name);
+	}
 
 	ml = m.dll_get_map_logic(map_name, last_visited_time);
 }
 
+Map::Map(Tilemap *tilemap) :
+	tilemap(tilemap),
+	offset(0.0f, 0.0f),
+	panning(false),
+	occupancy_dirty(true),
+	occupancy_version(0),
+	speech(0),
+	map_name(""),
+	new_map_name(""),
+	ml(0),
+	a_star(0),
+	hpa_star(0),
+	path_scheduler(0),
+	path_cache(0),
+	been_here_before(false)
+{
+}
+
 Map::~Map()
 {
 	delete ml;
 
 	delete tilemap;
 
+	delete path_scheduler;
+	delete path_cache;
+	delete hpa_star;
 	delete a_star;
 
 	for (size_t i = 0; i < entities.size(); i++) {
 		if (entities[i] != noo.player && std::find(noo.party.begin(), noo.party.end(), entities[i]) == noo.party.end()) {
 			delete entities[i];
 		}
+		else if (entities[i]->get_map() == this) {
+			// Kept for the next map, which may not have it yet
+			entities[i]->set_map(0);
+		}
 	}
 }
 
@@ -136,6 +173,9 @@ void Map::start()
 	start_audio();
 
 	a_star = new A_Star(this);
+	hpa_star = new HPA_Star(this, a_star);
+	path_scheduler = new Path_Scheduler(this);
+	path_cache = new Path_Cache();
 
 	if (ml) {
 		ml->start(been_here_before);
@@ -152,6 +192,80 @@ void Map::end()
 void Map::add_entity(Map_Entity *entity)
 {
 	entities.push_back(entity);
+	entity->set_map(this);
+	update_light(entity);
+	invalidate_occupancy();
+}
+
+void Map::update_light(Map_Entity *entity)
+{
+	if (std::find(entities.begin(), entities.end(), entity) == entities.end()) {
+		return;
+	}
+
+	Brain *brain = entity->get_brain();
+	Light_Brain *light_brain = brain ? dynamic_cast<Light_Brain *>(brain) : 0;
+
+	if (light_brain == 0) {
+		remove_light(entity);
+		return;
+	}
+
+	std::vector<Map_Entity *>::iterator it = std::find(lights.entities.begin(), lights.entities.end(), entity);
+	int index;
+
+	if (it == lights.entities.end()) {
+		index = lights.entities.size();
+		lights.entities.push_back(entity);
+		lights.brains.push_back(light_brain);
+		lights.positions.push_back(Vec3D<float>(0.0f, 0.0f, 0.0f));
+		lights.colours.push_back(noo.black);
+		lights.reaches.push_back(0.0f);
+		lights.falloffs.push_back(0.0f);
+	}
+	else {
+		index = it - lights.entities.begin();
+		lights.brains[index] = light_brain;
+	}
+
+	refresh_light(index);
+}
+
+void Map::remove_light(Map_Entity *entity)
+{
+	std::vector<Map_Entity *>::iterator it = std::find(lights.entities.begin(), lights.entities.end(), entity);
+
+	if (it == lights.entities.end()) {
+		return;
+	}
+
+	// Order doesn't matter, move the last one into its place
+	int index = it - lights.entities.begin();
+	int last = lights.entities.size() - 1;
+
+	lights.entities[index] = lights.entities[last];
+	lights.brains[index] = lights.brains[last];
+	lights.positions[index] = lights.positions[last];
+	lights.colours[index] = lights.colours[last];
+	lights.reaches[index] = lights.reaches[last];
+	lights.falloffs[index] = lights.falloffs[last];
+
+	lights.entities.pop_back();
+	lights.brains.pop_back();
+	lights.positions.pop_back();
+	lights.colours.pop_back();
+	lights.reaches.pop_back();
+	lights.falloffs.pop_back();
+}
+
+void Map::refresh_light(int index)
+{
+	Light_Brain *light_brain = lights.brains[index];
+
+	lights.positions[index] = light_brain->get_position();
+	lights.colours[index] = light_brain->get_colour();
+	lights.reaches[index] = light_brain->get_reach();
+	lights.falloffs[index] = light_brain->get_falloff();
 }
 
 void Map::add_speech(Speech *s)
@@ -214,7 +328,14 @@ std::vector<Map_Entity *> Map::get_colliding_entities(int layer, Point<int> posi
 
 bool Map::is_solid(int layer, Map_Entity *collide_with, Point<int> position, Size<int> size, bool check_entities, bool check_tiles)
 {
-	if (check_entities) {
+	// Collisions are reported for every entity touched, solid or not, so
+	// only checks without collide_with can use the occupancy bits
+	if (check_entities && collide_with == 0) {
+		if (is_occupied(position, size)) {
+			return true;
+		}
+	}
+	else if (check_entities) {
 		std::vector<Map_Entity *> colliding_entities = get_colliding_entities(layer, position, size);
 		for (size_t i = 0; i < colliding_entities.size(); i++) {
 			Map_Entity *e = colliding_entities[i];
@@ -241,6 +362,90 @@ bool Map::is_solid(int layer, Map_Entity *collide_with, Point<int> position, Siz
 	return false;
 }
 
+void Map::invalidate_occupancy()
+{
+	occupancy_dirty = true;
+}
+
+Uint32 Map::get_occupancy_version()
+{
+	if (occupancy_dirty) {
+		update_occupancy();
+	}
+
+	return occupancy_version;
+}
+
+void Map::update_occupancy()
+{
+	Size<int> tilemap_size = tilemap->get_size();
+
+	std::vector<Uint32> old_occupancy;
+	old_occupancy.swap(occupancy);
+
+	occupancy.assign((tilemap_size.w * tilemap_size.h + 31) / 32, 0);
+
+	for (size_t i = 0; i < entities.size(); i++) {
+		Map_Entity *e = entities[i];
+		if (e->is_solid() == false) {
+			continue;
+		}
+
+		// Every tile the entity's box overlaps, as in get_colliding_entities
+		Point<int> pos = e->get_position() * noo.tile_size;
+		Size<int> size = e->get_size();
+		pos.y -= (size.h - noo.tile_size);
+
+		int x1 = (int)floorf((float)pos.x / noo.tile_size);
+		int y1 = (int)floorf((float)pos.y / noo.tile_size);
+		int x2 = (pos.x + size.w + noo.tile_size - 1) / noo.tile_size - 1;
+		int y2 = (pos.y + size.h + noo.tile_size - 1) / noo.tile_size - 1;
+
+		x1 = MAX(0, x1);
+		y1 = MAX(0, y1);
+		x2 = MIN(tilemap_size.w-1, x2);
+		y2 = MIN(tilemap_size.h-1, y2);
+
+		for (int y = y1; y <= y2; y++) {
+			for (int x = x1; x <= x2; x++) {
+				int index = y * tilemap_size.w + x;
+				occupancy[index >> 5] |= 1u << (index & 31);
+			}
+		}
+	}
+
+	// Entities moving around without changing what's covered (or not solid)
+	// shouldn't restart searches
+	if (occupancy != old_occupancy) {
+		occupancy_version++;
+	}
+
+	occupancy_dirty = false;
+}
+
+bool Map::is_occupied(Point<int> position, Size<int> size)
+{
+	if (occupancy_dirty) {
+		update_occupancy();
+	}
+
+	Size<int> tilemap_size = tilemap->get_size();
+
+	for (int y = position.y; y < position.y + size.h; y++) {
+		for (int x = position.x; x < position.x + size.w; x++) {
+			if (x < 0 || y < 0 || x >= tilemap_size.w || y >= tilemap_size.h) {
+				continue;
+			}
+			int index = y * tilemap_size.w + x;
+			if (occupancy[index >> 5] & (1u << (index & 31))) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
 void Map::check_triggers(Map_Entity *entity)
 {
 	if (ml) {
@@ -295,9 +500,79 @@ Point<float> Map::get_pan()
 	return pan;
 }
 
-std::list<A_Star::Node *> Map::find_path(Point<int> start, Point<int> goal, bool check_solids)
+A_Star::Path Map::find_path(Point<int> start, Point<int> goal, bool check_solids, bool shortest)
+{
+	A_Star::Path path;
+
+	// What's cached may have come from HPA_Star
+	if (shortest == false && find_cached_path(start, goal, check_solids, path)) {
+		return path;
+	}
+
+	// Searches this long would visit more tiles than the cluster graph has nodes
+	if (shortest == false && check_solids && abs(start.x - goal.x) + abs(start.y - goal.y) >= HPA_Star::CLUSTER_SIZE) {
+		path = hpa_star->find_path(start, goal);
+	}
+	else {
+		path = a_star->find_path(start, goal, check_solids);
+	}
+
+	cache_path(start, goal, check_solids, path);
+
+	return path;
+}
+
+int Map::request_path(Point<int> start, Point<int> goal, bool check_solids, Callback callback, void *callback_data)
+{
+	return path_scheduler->request(start, goal, check_solids, callback, callback_data);
+}
+
+Path_Scheduler *Map::get_path_scheduler()
+{
+	return path_scheduler;
+}
+
+Path_Cache *Map::get_path_cache()
 {
-	return a_star->find_path(start, goal, check_solids);
+	return path_cache;
+}
+
+bool Map::find_cached_path(Point<int> start, Point<int> goal, bool check_solids, A_Star::Path &path)
+{
+	// Ignoring solids, paths only depend on the map size
+	if (check_solids) {
+		return path_cache->find(start, goal, check_solids, path, path_is_clear, this);
+	}
+	else {
+		return path_cache->find(start, goal, check_solids, path);
+	}
+}
+
+void Map::cache_path(Point<int> start, Point<int> goal, bool check_solids, const A_Star::Path &path)
+{
+	// No path with check_solids may be entities in the way, which won't be
+	// there for long
+	if (check_solids && path.size() == 0) {
+		return;
+	}
+
+	path_cache->add(start, goal, check_solids, path);
+}
+
+bool Map::is_path_clear(const A_Star::Path &path)
+{
+	for (size_t i = 0; i < path.size(); i++) {
+		if (is_occupied(path[i], Size<int>(1, 1))) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool Map::path_is_clear(const A_Star::Path &path, void *data)
+{
+	return static_cast<Map *>(data)->is_path_clear(path);
 }
 
 bool Map::is_speech_active()
@@ -315,6 +590,11 @@ std::vector<Map_Entity *> &Map::get_entities()
 	return entities;
 }
 
+Map::Lights &Map::get_lights()
+{
+	return lights;
+}
+
 void Map::handle_event(TGUI_Event *event)
 {
 	if (speech) {
@@ -369,8 +649,11 @@ void Map::update_camera()
 		std::vector<Map_Entity *>::iterator it = std::find(entities.begin(), entities.end(), entity_to_destroy);
 		if (it != entities.end()) {
 			Map_Entity *entity = *it;
+			remove_light(entity);
+			path_scheduler->cancel(entity);
 			entities.erase(it);
 			delete entity;
+			invalidate_occupancy();
 		}
 	}
 	entities_to_destroy.clear();
@@ -424,14 +707,25 @@ bool Map::update()
 			b->update();
 		}
 		if (e->update(speech != 0) == false) {
+			remove_light(e);
+			path_scheduler->cancel(e);
 			delete e;
 			it = entities.erase(it);
+			invalidate_occupancy();
 		}
 		else {
 			it++;
 		}
 	}
 
+	// After brains so paths they asked for can start this frame
+	path_scheduler->update();
+
+	// Brains are done moving and flickering for this frame
+	for (size_t i = 0; i < lights.brains.size(); i++) {
+		refresh_light(i);
+	}
+
 	update_camera();
 
 	// Reset pan gradually when the user lets go of mouse
@@ -463,26 +757,34 @@ void Map::draw(bool use_depth_buffer)
 	int nlayers = tilemap->get_num_layers();
 	int layer;
 
+	tilemap->update_light_map();
+
 	for (layer = 0; layer < nlayers/2; layer++) {
 		tilemap->draw(layer, offset);
 	}
 
+	// Entities are queued so ones sharing a sprite sheet image are drawn together.
+	// Low and high ones can overlap without the depth buffer so keep their order.
 	for (size_t i = 0; i < entities.size(); i++) {
 		Map_Entity *e = entities[i];
 		if (e->is_low() && e->get_sprite() != 0) {
-			e->draw(e->get_draw_position() + offset, use_depth_buffer);
+			e->draw(e->get_draw_position() + offset, use_depth_buffer, false, m.render_queue);
 		}
 	}
 
+	m.render_queue->flush();
+
 	noo.enable_depth_buffer(use_depth_buffer);
 
 	for (size_t i = 0; i < entities.size(); i++) {
 		Map_Entity *e = entities[i];
 		if (!e->is_high() && !e->is_low() && e->get_sprite() != 0) {
-			e->draw(e->get_draw_position() + offset, use_depth_buffer);
+			e->draw(e->get_draw_position() + offset, use_depth_buffer, false, m.render_queue);
 		}
 	}
 
+	m.render_queue->flush(use_depth_buffer);
+
 	tilemap->draw(layer, offset, use_depth_buffer);
 
 	layer++;
@@ -496,13 +798,17 @@ void Map::draw(bool use_depth_buffer)
 	for (size_t i = 0; i < entities.size(); i++) {
 		Map_Entity *e = entities[i];
 		if (e->is_high() && e->get_sprite() != 0) {
-			e->draw(e->get_draw_position() + offset, use_depth_buffer);
+			e->draw(e->get_draw_position() + offset, use_depth_buffer, false, m.render_queue);
 		}
 		else if (e->is_sitting() && e->get_direction() == N && e->get_sprite() != 0) {
-			e->draw(e->get_draw_position() + offset, use_depth_buffer, true);
+			e->draw(e->get_draw_position() + offset, use_depth_buffer, true, m.render_queue);
 		}
 	}
 
+	m.render_queue->flush();
+
+	tilemap->draw_lights(offset);
+
 	if (speech) {
 		speech->draw();
 	}
@@ -588,7 +894,7 @@ bool Map::activate(Map_Entity *entity)
 
 			Direction direction = entity->get_direction();
 
-			std::list<A_Star::Node *> path;
+			A_Star::Path path;
 
 			bool is_chair = true;
 			Point<int> draw_offset(0, 0);
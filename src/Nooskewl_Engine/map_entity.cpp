@@ -8,6 +8,8 @@
 #include "Nooskewl_Engine/item.h"
 #include "Nooskewl_Engine/map.h"
 #include "Nooskewl_Engine/map_entity.h"
+#include "Nooskewl_Engine/path_scheduler.h"
+#include "Nooskewl_Engine/render_queue.h"
 #include "Nooskewl_Engine/shader.h"
 #include "Nooskewl_Engine/spell.h"
 #include "Nooskewl_Engine/sprite.h"
@@ -26,6 +28,37 @@ static void make_solid_callback(void *data)
 	entity->set_solid(true);
 }
 
+// The path to stand up on, from the map's Path_Scheduler
+static void stand_path_callback(void *data)
+{
+	Path_Scheduler::Callback_Data *pscd = static_cast<Path_Scheduler::Callback_Data *>(data);
+
+	Map_Entity *entity = static_cast<Map_Entity *>(pscd->userdata);
+
+	// Already stood up from a path found earlier
+	if (entity->get_pre_sit_sleep_direction() == DIRECTION_UNKNOWN) {
+		return;
+	}
+
+	if (pscd->path.size() > 0) {
+		entity->set_pre_sit_sleep_direction(DIRECTION_UNKNOWN);
+		entity->set_path(pscd->path, make_solid_callback, entity);
+	}
+}
+
+// data is the colour to swap for yellow (eyes)
+static void set_substitute_colour(void *data, bool enable)
+{
+	static Shader::Uniform substitute_yellow = Shader::get_uniform("substitute_yellow");
+	static Shader::Uniform substitute_colour = Shader::get_uniform("substitute_colour");
+
+	noo.current_shader->set_bool(substitute_yellow, enable);
+
+	if (enable) {
+		noo.current_shader->set_float_vector(substitute_colour, 4, static_cast<float *>(data), 1);
+	}
+}
+
 static int current_id;
 
 void Map_Entity::new_game_started()
@@ -66,12 +99,13 @@ void Map_Entity::end_sleep_callback(void *data)
 			break;
 	}
 
-	std::list<A_Star::Node *> path = noo.map->find_path(entity->get_position(), pos, false);
+	A_Star::Path path = noo.map->find_path(entity->get_position(), pos, false);
 	entity->set_path(path, make_solid_callback, entity);
 }
 
 Map_Entity::Map_Entity(std::string name) :
 	name(name),
+	map(0),
 	direction(S),
 	sprite(0),
 	brain(0),
@@ -88,6 +122,7 @@ Map_Entity::Map_Entity(std::string name) :
 	sleeping(false),
 	input_enabled(true),
 	following_path(false),
+	path_step(0),
 	path_callback(0),
 	has_blink(false),
 	type(OTHER),
@@ -150,6 +185,9 @@ void Map_Entity::set_brain(Brain *brain)
 		// Update the brain one time so there are no potential flashes of state
 		brain->update();
 	}
+	if (noo.map) {
+		noo.map->update_light(this);
+	}
 }
 
 void Map_Entity::load_sprite(std::string name)
@@ -168,11 +206,17 @@ void Map_Entity::set_sprite(Sprite *sprite)
 void Map_Entity::set_position(Point<int> position)
 {
 	this->position = position;
+	if (map) {
+		map->invalidate_occupancy();
+	}
 }
 
 void Map_Entity::set_size(Size<int> size)
 {
 	this->size = size;
+	if (map) {
+		map->invalidate_occupancy();
+	}
 }
 
 void Map_Entity::set_offset(Point<float> offset)
@@ -286,6 +330,9 @@ void Map_Entity::set_direction(Direction direction)
 void Map_Entity::set_solid(bool solid)
 {
 	this->solid = solid;
+	if (map) {
+		map->invalidate_occupancy();
+	}
 }
 
 void Map_Entity::set_sitting(bool sitting)
@@ -298,11 +345,12 @@ void Map_Entity::set_sleeping(bool sleeping)
 	set_sitting_sleeping(false, sleeping);
 }
 
-void Map_Entity::set_path(std::list<A_Star::Node *> path, Callback callback, void *callback_data)
+void Map_Entity::set_path(const A_Star::Path &path, Callback callback, void *callback_data)
 {
 	if (path.size() > 0) {
 		path_count++;
 		this->path = path;
+		path_step = 0;
 		following_path = true;
 		path_callback = callback;
 		path_callback_data = callback_data;
@@ -387,6 +435,11 @@ void Map_Entity::set_should_face_activator(bool should_face)
 	this->should_face = should_face;
 }
 
+void Map_Entity::set_map(Map *map)
+{
+	this->map = map;
+}
+
 int Map_Entity::get_id()
 {
 	return id;
@@ -397,6 +450,11 @@ std::string Map_Entity::get_name()
 	return name;
 }
 
+Map *Map_Entity::get_map()
+{
+	return map;
+}
+
 Brain *Map_Entity::get_brain()
 {
 	return brain;
@@ -653,6 +711,10 @@ bool Map_Entity::maybe_move()
 		}
 	}
 
+	if (ret && map) {
+		map->invalidate_occupancy();
+	}
+
 	return ret;
 }
 
@@ -861,7 +923,7 @@ bool Map_Entity::update(bool can_move)
 	return true;
 }
 
-void Map_Entity::draw(Point<float> draw_pos, bool use_depth_buffer, bool sitting_n)
+void Map_Entity::draw(Point<float> draw_pos, bool use_depth_buffer, bool sitting_n, Render_Queue *queue)
 {
 	draw_pos += draw_offset;
 
@@ -898,17 +960,18 @@ void Map_Entity::draw(Point<float> draw_pos, bool use_depth_buffer, bool sitting
 	}
 
 	if (source_size.w > 0.0f && source_size.h > 0.0f) {
+		float *substitute_colour = 0;
+
 		if (has_blink) {
-			noo.current_shader->set_bool("substitute_yellow", true);
 			Uint32 ticks = SDL_GetTicks();
 			if (ticks > next_blink) {
 				if (ticks > next_blink + 50) {
 					set_next_blink();
 				}
-				noo.current_shader->set_float_vector("substitute_colour", 4, blink_colour, 1);
+				substitute_colour = blink_colour;
 			}
 			else {
-				noo.current_shader->set_float_vector("substitute_colour", 4, eye_colour, 1);
+				substitute_colour = eye_colour;
 			}
 		}
 
@@ -917,10 +980,19 @@ void Map_Entity::draw(Point<float> draw_pos, bool use_depth_buffer, bool sitting
 		SDL_Colour tint;
 		noo.map->get_tilemap()->get_tile_lighting(position, tint);
 
-		image->draw_region_tinted_z_single(tint, source_position, source_size, draw_pos, draw_z, flags);
+		if (queue) {
+			queue->add(image, tint, source_position, source_size, draw_pos, draw_z, flags, substitute_colour ? set_substitute_colour : 0, substitute_colour);
+		}
+		else {
+			if (substitute_colour) {
+				set_substitute_colour(substitute_colour, true);
+			}
+
+			image->draw_region_tinted_z_single(tint, source_position, source_size, draw_pos, draw_z, flags);
 
-		if (has_blink) {
-			noo.current_shader->set_bool("substitute_yellow", false);
+			if (substitute_colour) {
+				set_substitute_colour(substitute_colour, false);
+			}
 		}
 	}
 }
@@ -946,7 +1018,7 @@ void Map_Entity::follow_path()
 		return;
 	}
 
-	if (path.size() == 0) {
+	if (path_step >= path.size()) {
 		int old_path_count = path_count;
 		if (path_callback) {
 			Generic_Callback_Data gcbd;
@@ -961,10 +1033,9 @@ void Map_Entity::follow_path()
 		}
 		return;
 	}
-	A_Star::Node *node = path.front();
-	path.pop_front();
-	int dx = node->position.x - position.x;
-	int dy = node->position.y - position.y;
+	Point<int> next = path[path_step++];
+	int dx = next.x - position.x;
+	int dy = next.y - position.y;
 	if (abs(dx)+abs(dy) != 1) {
 		end_a_star();
 		stop_now();
@@ -995,6 +1066,7 @@ void Map_Entity::end_a_star()
 {
 	following_path = false;
 	path.clear();
+	path_step = 0;
 	if (activate_next_tile) {
 		activate_next_tile = false;
 		noo.map->activate(this);
@@ -1204,11 +1276,8 @@ void Map_Entity::set_sitting_sleeping(bool sitting, bool onoff)
 			set_z_add(get_z_add() + 1);
 		}
 		if (sitting && pre_sit_sleep_direction != DIRECTION_UNKNOWN) {
-			std::list<A_Star::Node *> path = noo.map->find_path(position, stand_position);
-			if (path.size() > 0) {
-				pre_sit_sleep_direction = DIRECTION_UNKNOWN;
-				set_path(path, make_solid_callback, this);
-			}
+			noo.map->get_path_scheduler()->cancel(this); // a search from an earlier try
+			noo.map->request_path(position, stand_position, true, stand_path_callback, this);
 		}
 		else if (sitting == false) {
 			set_input_enabled(false);
@@ -30,3 +30,8 @@ Map_Entity *Map_Logic::mutate_loaded_entity(Map_Entity *entity)
 {
 	return entity;
 }
+
+std::vector<std::string> Map_Logic::get_exits()
+{
+	return std::vector<std::string>();
+}
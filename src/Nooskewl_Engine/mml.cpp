@@ -823,17 +823,23 @@ MML::MML(std::string filename, bool load_from_filesystem) :
 	name(filename)
 {
 	internal = new MML::Internal(filename, load_from_filesystem);
+
+	// These can be created on Asset_Loader threads
+	SDL_LockMutex(m.mixer_mutex);
 	loaded_mml.push_back(internal);
+	SDL_UnlockMutex(m.mixer_mutex);
 }
 
 MML::~MML()
 {
+	SDL_LockMutex(m.mixer_mutex);
 	for (size_t i = 0; i < loaded_mml.size(); i++) {
 		if (loaded_mml[i] == internal) {
 			loaded_mml.erase(loaded_mml.begin()+i);
 			break;
 		}
 	}
+	SDL_UnlockMutex(m.mixer_mutex);
 
 	delete internal;
 }
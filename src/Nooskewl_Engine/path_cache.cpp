@@ -0,0 +1,113 @@
+#include "Nooskewl_Engine/path_cache.h"
+
+using namespace Nooskewl_Engine;
+
+Path_Cache::Path_Cache(int max_size) :
+	max_size(max_size)
+{
+	reset_stats();
+}
+
+Path_Cache::~Path_Cache()
+{
+}
+
+bool Path_Cache::find(Point<int> start, Point<int> goal, bool check_solids, A_Star::Path &path, Path_Check check, void *check_data)
+{
+	std::map<Key, Entry>::iterator it = entries.find(make_key(start, goal, check_solids));
+
+	if (it == entries.end()) {
+		stats.misses++;
+		return false;
+	}
+
+	Entry &e = it->second;
+
+	if (check && check(e.path, check_data) == false) {
+		// Something's in the way
+		lru.erase(e.lru_position);
+		entries.erase(it);
+		stats.misses++;
+		return false;
+	}
+
+	lru.splice(lru.begin(), lru, e.lru_position);
+
+	path = e.path;
+
+	stats.hits++;
+
+	return true;
+}
+
+void Path_Cache::add(Point<int> start, Point<int> goal, bool check_solids, const A_Star::Path &path)
+{
+	if (max_size <= 0) {
+		return;
+	}
+
+	Key key = make_key(start, goal, check_solids);
+
+	std::map<Key, Entry>::iterator it = entries.find(key);
+
+	if (it != entries.end()) {
+		Entry &e = it->second;
+		e.path = path;
+		lru.splice(lru.begin(), lru, e.lru_position);
+		return;
+	}
+
+	if ((int)entries.size() >= max_size) {
+		entries.erase(lru.back());
+		lru.pop_back();
+	}
+
+	lru.push_front(key);
+
+	Entry &e = entries[key];
+	e.path = path;
+	e.lru_position = lru.begin();
+}
+
+void Path_Cache::clear()
+{
+	entries.clear();
+	lru.clear();
+}
+
+Path_Cache::Stats Path_Cache::get_stats()
+{
+	return stats;
+}
+
+void Path_Cache::reset_stats()
+{
+	stats.hits = 0;
+	stats.misses = 0;
+}
+
+bool Path_Cache::Key::operator<(const Key &rhs) const
+{
+	if (start.x != rhs.start.x) {
+		return start.x < rhs.start.x;
+	}
+	if (start.y != rhs.start.y) {
+		return start.y < rhs.start.y;
+	}
+	if (goal.x != rhs.goal.x) {
+		return goal.x < rhs.goal.x;
+	}
+	if (goal.y != rhs.goal.y) {
+		return goal.y < rhs.goal.y;
+	}
+	return check_solids < rhs.check_solids;
+}
+
+Path_Cache::Key Path_Cache::make_key(Point<int> start, Point<int> goal, bool check_solids)
+{
+	Key k;
+	k.start = start;
+	k.goal = goal;
+	k.check_solids = check_solids;
+	return k;
+}
@@ -0,0 +1,179 @@
+#include "Nooskewl_Engine/a_star.h"
+#include "Nooskewl_Engine/map.h"
+#include "Nooskewl_Engine/path_cache.h"
+#include "Nooskewl_Engine/path_scheduler.h"
+#include "Nooskewl_Engine/tilemap.h"
+
+using namespace Nooskewl_Engine;
+
+const float Path_Scheduler::DEFAULT_MAX_MILLISECONDS = 2.0f;
+
+Path_Scheduler::Path_Scheduler(Map *map) :
+	map(map),
+	searching(false),
+	search_version(0),
+	next_id(0),
+	max_nodes(DEFAULT_MAX_NODES),
+	max_milliseconds(DEFAULT_MAX_MILLISECONDS)
+{
+	a_star = new A_Star(map);
+
+	reset_stats();
+}
+
+Path_Scheduler::~Path_Scheduler()
+{
+	delete a_star;
+}
+
+int Path_Scheduler::request(Point<int> start, Point<int> goal, bool check_solids, Callback callback, void *callback_data)
+{
+	Request r;
+
+	r.id = next_id++;
+	r.start = start;
+	r.goal = goal;
+	r.check_solids = check_solids;
+	r.callback = callback;
+	r.callback_data = callback_data;
+	r.restarts = 0;
+
+	requests.push_back(r);
+
+	return r.id;
+}
+
+void Path_Scheduler::cancel(int id)
+{
+	std::list<Request>::iterator it;
+	for (it = requests.begin(); it != requests.end(); it++) {
+		if (it->id == id) {
+			if (it == requests.begin()) {
+				searching = false;
+			}
+			requests.erase(it);
+			return;
+		}
+	}
+}
+
+void Path_Scheduler::cancel(void *callback_data)
+{
+	std::list<Request>::iterator it;
+	for (it = requests.begin(); it != requests.end();) {
+		if (it->callback_data == callback_data) {
+			if (it == requests.begin()) {
+				searching = false;
+			}
+			it = requests.erase(it);
+		}
+		else {
+			it++;
+		}
+	}
+}
+
+bool Path_Scheduler::is_pending(int id)
+{
+	std::list<Request>::iterator it;
+	for (it = requests.begin(); it != requests.end(); it++) {
+		if (it->id == id) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void Path_Scheduler::update()
+{
+	Uint64 start_ticks = SDL_GetPerformanceCounter();
+	Uint64 max_ticks = Uint64(max_milliseconds / 1000.0f * SDL_GetPerformanceFrequency());
+	int nodes = 0;
+
+	while (requests.size() > 0) {
+		if (nodes >= max_nodes || SDL_GetPerformanceCounter() - start_ticks >= max_ticks) {
+			stats.frames_over_budget++;
+			return;
+		}
+
+		Request &r = requests.front();
+
+		if (searching == false) {
+			A_Star::Path path;
+			if (map->find_cached_path(r.start, r.goal, r.check_solids, path)) {
+				finish(path);
+				continue;
+			}
+			start_search(r);
+			searching = true;
+		}
+
+		int count = 0;
+		A_Star::Search_State state = a_star->step(MIN(NODES_PER_STEP, max_nodes - nodes), count);
+		nodes += count;
+		stats.nodes += count;
+
+		if (state != A_Star::SEARCHING) {
+			A_Star::Path path = a_star->get_path(); // empty if it failed
+			// Entities may have moved while it was searched over several frames.
+			// Searched again a few times if they got in the way (or out of it,
+			// if there was no path), then it's the best there is.
+			if (r.check_solids && map->get_occupancy_version() != search_version) {
+				bool blocked = path.size() == 0 || map->is_path_clear(path) == false;
+				if (blocked && r.restarts < MAX_RESTARTS) {
+					r.restarts++;
+					start_search(r);
+					continue;
+				}
+			}
+			map->cache_path(r.start, r.goal, r.check_solids, path);
+			finish(path);
+		}
+	}
+}
+
+void Path_Scheduler::set_budget(int max_nodes, float max_milliseconds)
+{
+	this->max_nodes = max_nodes;
+	this->max_milliseconds = max_milliseconds;
+}
+
+Path_Scheduler::Stats Path_Scheduler::get_stats()
+{
+	return stats;
+}
+
+void Path_Scheduler::reset_stats()
+{
+	stats.nodes = 0;
+	stats.completed = 0;
+	stats.frames_over_budget = 0;
+}
+
+void Path_Scheduler::start_search(const Request &r)
+{
+	search_version = r.check_solids ? map->get_occupancy_version() : 0;
+
+	Size<int> size = map->get_tilemap()->get_size();
+	a_star->start_search(r.start, r.goal, r.check_solids, Point<int>(0, 0), Point<int>(size.w-1, size.h-1));
+}
+
+void Path_Scheduler::finish(const A_Star::Path &path)
+{
+	// Off the queue first, the callback may request or cancel
+	Request r = requests.front();
+	requests.pop_front();
+	searching = false;
+
+	stats.completed++;
+
+	if (r.callback) {
+		Callback_Data cbd;
+		cbd.userdata = r.callback_data;
+		cbd.id = r.id;
+		cbd.start = r.start;
+		cbd.goal = r.goal;
+		cbd.path = path;
+		r.callback(&cbd);
+	}
+}
@@ -216,7 +216,7 @@ void Player_Brain::handle_event(TGUI_Event *event)
 									}
 								}
 								if (activated == false) {
-									std::list<A_Star::Node *> path = noo.map->find_path(player_pos, click);
+									A_Star::Path path = noo.map->find_path(player_pos, click, true, true);
 									if (path.size() > 0) {
 										noo.player->set_path(path);
 									}
@@ -0,0 +1,154 @@
+#include "Nooskewl_Engine/engine.h"
+#include "Nooskewl_Engine/image.h"
+#include "Nooskewl_Engine/internal.h"
+#include "Nooskewl_Engine/render_queue.h"
+#include "Nooskewl_Engine/shader.h"
+#include "Nooskewl_Engine/vertex_cache.h"
+
+using namespace Nooskewl_Engine;
+
+Render_Queue::Render_Queue()
+{
+	reset_stats();
+}
+
+Render_Queue::~Render_Queue()
+{
+}
+
+void Render_Queue::add(Image *image, SDL_Colour colours[4], Point<float> source_position, Size<float> source_size, Point<float> dest_position, float z, int flags, State_Setter set_state, void *state_data)
+{
+	Quad q;
+
+	q.image = image;
+	q.shader = noo.current_shader;
+	q.set_state = set_state;
+	q.state_data = state_data;
+	for (int i = 0; i < 4; i++) {
+		q.colours[i] = colours[i];
+	}
+	q.source_position = source_position;
+	q.source_size = source_size;
+	q.dest_position = dest_position;
+	q.z = z;
+	q.flags = flags;
+
+	quads.push_back(q);
+}
+
+void Render_Queue::add(Image *image, SDL_Colour tint, Point<float> source_position, Size<float> source_size, Point<float> dest_position, float z, int flags, State_Setter set_state, void *state_data)
+{
+	SDL_Colour colours[4];
+	colours[0] = colours[1] = colours[2] = colours[3] = tint;
+	add(image, colours, source_position, source_size, dest_position, z, flags, set_state, state_data);
+}
+
+void Render_Queue::flush(bool sort)
+{
+	if (quads.size() == 0) {
+		return;
+	}
+
+	// Pointers so sorting doesn't copy quads around
+	order.clear();
+	for (size_t i = 0; i < quads.size(); i++) {
+		order.push_back(&quads[i]);
+	}
+
+	if (sort) {
+		// Stable so quads in the same batch keep their order
+		std::stable_sort(order.begin(), order.end(), batch_order);
+	}
+
+	Shader *bak = noo.current_shader;
+
+	start_batch(order[0]);
+
+	for (size_t i = 0; i < order.size(); i++) {
+		Quad *q = order[i];
+
+		if (i > 0 && same_batch(q, order[i-1]) == false) {
+			end_batch(order[i-1]);
+			start_batch(q);
+		}
+
+		m.vertex_cache->cache_z(q->colours, q->source_position, q->source_size, q->dest_position, q->z, q->source_size, q->flags);
+	}
+
+	end_batch(order[order.size()-1]);
+
+	if (noo.current_shader != bak) {
+		noo.current_shader = bak;
+		noo.current_shader->use();
+	}
+
+	stats.quads += quads.size();
+
+	quads.clear();
+}
+
+int Render_Queue::get_size()
+{
+	return quads.size();
+}
+
+Render_Queue::Stats Render_Queue::get_stats()
+{
+	return stats;
+}
+
+void Render_Queue::reset_stats()
+{
+	stats.quads = 0;
+	stats.batches = 0;
+}
+
+bool Render_Queue::same_batch(const Quad *a, const Quad *b)
+{
+	return a->image == b->image && a->shader == b->shader && a->set_state == b->set_state && a->state_data == b->state_data;
+}
+
+bool Render_Queue::batch_order(const Quad *a, const Quad *b)
+{
+	// Shader changes cost the most so they come first
+	if (a->shader != b->shader) {
+		return a->shader < b->shader;
+	}
+	if (a->set_state != b->set_state) {
+		return (void *)a->set_state < (void *)b->set_state;
+	}
+	if (a->state_data != b->state_data) {
+		return a->state_data < b->state_data;
+	}
+	return a->image < b->image;
+}
+
+void Render_Queue::start_batch(Quad *q)
+{
+	if (q->shader != noo.current_shader) {
+		noo.current_shader = q->shader;
+		noo.current_shader->use();
+	}
+
+	if (q->set_state) {
+		q->set_state(q->state_data, true);
+	}
+
+	if (q->image) {
+		m.vertex_cache->start(q->image);
+	}
+	else {
+		m.vertex_cache->start();
+	}
+}
+
+void Render_Queue::end_batch(Quad *q)
+{
+	m.vertex_cache->end();
+
+	if (q->set_state) {
+		q->set_state(q->state_data, false);
+	}
+
+	stats.batches++;
+}
@@ -7,6 +7,14 @@
 using namespace Nooskewl_Engine;
 
 std::vector<Shader::Internal *> Shader::loaded_shaders;
+std::map<std::string, int> Shader::uniform_ids;
+std::vector<std::string> Shader::uniform_names;
+GLuint Shader::bound_texture;
+
+Shader::Uniform::Uniform() :
+	id(-1)
+{
+}
 
 void Shader::release_all()
 {
@@ -20,6 +28,30 @@ void Shader::reload_all()
 	for (size_t i = 0; i < loaded_shaders.size(); i++) {
 		loaded_shaders[i]->reload();
 	}
+
+	forget_bound_texture();
+}
+
+Shader::Uniform Shader::get_uniform(const std::string &name)
+{
+	Uniform uniform;
+
+	std::map<std::string, int>::iterator it = uniform_ids.find(name);
+	if (it != uniform_ids.end()) {
+		uniform.id = it->second;
+	}
+	else {
+		uniform.id = uniform_names.size();
+		uniform_ids[name] = uniform.id;
+		uniform_names.push_back(name);
+	}
+
+	return uniform;
+}
+
+void Shader::forget_bound_texture()
+{
+	bound_texture = 0;
 }
 
 Shader::Shader(bool opengl, std::string vertex_source, std::string fragment_source) :
@@ -58,24 +90,37 @@ void Shader::use()
 	noo.update_projection();
 }
 
-void Shader::set_texture(std::string name, Image *image)
+void Shader::set_texture(Uniform uniform, Image *image)
 {
 	if (internal->opengl) {
 		if (image) {
-			glActiveTexture(GL_TEXTURE0);
-			printGLerror("glActiveTexture");
+			GLuint texture = image->internal->texture;
 
-			glBindTexture(GL_TEXTURE_2D, image->internal->texture);
-			printGLerror("glBindTexture");
+			if (texture != bound_texture) {
+				glActiveTexture(GL_TEXTURE0);
+				printGLerror("glActiveTexture");
 
-			GLint loc = glGetUniformLocation(internal->opengl_shader, "tex");
-			glUniform1i(loc, 0);
+				glBindTexture(GL_TEXTURE_2D, texture);
+				printGLerror("glBindTexture");
+
+				bound_texture = texture;
+			}
+
+			Internal::Uniform_State &state = internal->get_uniform_state(uniform.id);
+			float unit = 0.0f;
+			if (state.location != -1 && internal->update_value(state, &unit, 1)) {
+				glUniform1i(state.location, 0);
+				printGLerror("glUniform1i");
+			}
 		}
 	}
 #ifdef NOOSKEWL_ENGINE_WINDOWS
 	else {
+		Internal::Uniform_State &state = internal->get_uniform_state(uniform.id);
 		if (image != 0) {
-			internal->d3d_effect->SetTexture("tex", image->internal->video_texture);
+			if (state.d3d_handle != 0) {
+				internal->d3d_effect->SetTexture(state.d3d_handle, image->internal->video_texture);
+			}
 			noo.d3d_device->SetTexture(0, image->internal->video_texture);
 		}
 		else {
@@ -85,100 +130,143 @@ void Shader::set_texture(std::string name, Image *image)
 #endif
 }
 
-void Shader::set_matrix(std::string name, const float *matrix)
+void Shader::set_matrix(Uniform uniform, const float *matrix)
 {
+	Internal::Uniform_State &state = internal->get_uniform_state(uniform.id);
+
 	if (internal->opengl) {
-		GLint uni = glGetUniformLocation(internal->opengl_shader, name.c_str());
-		printGLerror("glGetUniformLocation");
-		if (uni != -1) {
-			glUniformMatrix4fv(uni, 1, GL_FALSE, matrix);
+		if (state.location != -1 && internal->update_value(state, matrix, 16)) {
+			glUniformMatrix4fv(state.location, 1, GL_FALSE, matrix);
 			printGLerror("glUniformMatrix4fv");
 		}
 	}
 #ifdef NOOSKEWL_ENGINE_WINDOWS
 	else {
-		internal->d3d_effect->SetMatrix(name.c_str(), (D3DXMATRIX *)matrix);
+		if (state.d3d_handle != 0 && internal->update_value(state, matrix, 16)) {
+			internal->d3d_effect->SetMatrix(state.d3d_handle, (D3DXMATRIX *)matrix);
+		}
 	}
 #endif
 }
 
-void Shader::set_float(std::string name, float value)
+void Shader::set_float(Uniform uniform, float value)
 {
+	Internal::Uniform_State &state = internal->get_uniform_state(uniform.id);
+
 	if (internal->opengl) {
-		GLint uni = glGetUniformLocation(internal->opengl_shader, name.c_str());
-		printGLerror("glGetUniformLocation");
-		if (uni != -1) {
-			glUniform1f(uni, value);
+		if (state.location != -1 && internal->update_value(state, &value, 1)) {
+			glUniform1f(state.location, value);
 			printGLerror("glUniform1f");
 		}
 	}
 #ifdef NOOSKEWL_ENGINE_WINDOWS
 	else {
-		internal->d3d_effect->SetFloat(name.c_str(), value);
+		if (state.d3d_handle != 0 && internal->update_value(state, &value, 1)) {
+			internal->d3d_effect->SetFloat(state.d3d_handle, value);
+		}
 	}
 #endif
 }
 
 // Taken from Allegro
-bool Shader::set_float_vector(std::string name, int num_components, float *vector, int num_elements)
+bool Shader::set_float_vector(Uniform uniform, int num_components, float *vector, int num_elements)
 {
-	if (noo.opengl) {
-		GLint handle;
-
-		handle = glGetUniformLocation(internal->opengl_shader, name.c_str());
+	Internal::Uniform_State &state = internal->get_uniform_state(uniform.id);
 
-		if (handle < 0) {
+	if (internal->opengl) {
+		if (state.location < 0 || num_components < 1 || num_components > 4) {
 			return false;
 		}
 
+		if (internal->update_value(state, vector, num_components * num_elements) == false) {
+			return true;
+		}
+
 		switch (num_components) {
 			case 1:
-				glUniform1fv(handle, num_elements, vector);
+				glUniform1fv(state.location, num_elements, vector);
 				break;
 			case 2:
-				glUniform2fv(handle, num_elements, vector);
+				glUniform2fv(state.location, num_elements, vector);
 				break;
 			case 3:
-				glUniform3fv(handle, num_elements, vector);
+				glUniform3fv(state.location, num_elements, vector);
 				break;
 			case 4:
-				glUniform4fv(handle, num_elements, vector);
+				glUniform4fv(state.location, num_elements, vector);
 				break;
-			default:
-				return false;
 		}
 	}
 #ifdef NOOSKEWL_ENGINE_WINDOWS
 	else {
-		return internal->d3d_effect->SetFloatArray(name.c_str(), vector, num_components * num_elements) == D3D_OK;
+		if (state.d3d_handle == 0) {
+			return false;
+		}
+		if (internal->update_value(state, vector, num_components * num_elements) == false) {
+			return true;
+		}
+		return internal->d3d_effect->SetFloatArray(state.d3d_handle, vector, num_components * num_elements) == D3D_OK;
 	}
 #endif
 
 	return true;
 }
 
-void Shader::set_bool(std::string name, bool value)
+void Shader::set_bool(Uniform uniform, bool value)
 {
+	Internal::Uniform_State &state = internal->get_uniform_state(uniform.id);
+	float f = value ? 1.0f : 0.0f;
+
 	if (internal->opengl) {
-		GLint uni = glGetUniformLocation(internal->opengl_shader, name.c_str());
-		printGLerror("glGetUniformLocation");
-		if (uni != -1) {
-			glUniform1i(uni, value);
+		if (state.location != -1 && internal->update_value(state, &f, 1)) {
+			glUniform1i(state.location, value);
 			printGLerror("glUniform1i");
 		}
 	}
 #ifdef NOOSKEWL_ENGINE_WINDOWS
 	else {
-		internal->d3d_effect->SetBool(name.c_str(), value);
+		if (state.d3d_handle != 0 && internal->update_value(state, &f, 1)) {
+			internal->d3d_effect->SetBool(state.d3d_handle, value);
+		}
 	}
 #endif
 }
 
+void Shader::set_texture(const std::string &name, Image *image)
+{
+	set_texture(get_uniform(name), image);
+}
+
+void Shader::set_matrix(const std::string &name, const float *matrix)
+{
+	set_matrix(get_uniform(name), matrix);
+}
+
+void Shader::set_float(const std::string &name, float value)
+{
+	set_float(get_uniform(name), value);
+}
+
+bool Shader::set_float_vector(const std::string &name, int num_components, float *vector, int num_elements)
+{
+	return set_float_vector(get_uniform(name), num_components, vector, num_elements);
+}
+
+void Shader::set_bool(const std::string &name, bool value)
+{
+	set_bool(get_uniform(name), value);
+}
+
 GLuint Shader::get_opengl_shader()
 {
 	return internal->opengl_shader;
 }
 
+GLint Shader::get_opengl_attribute(Attribute attribute)
+{
+	return internal->opengl_attributes[attribute];
+}
+
 #ifdef NOOSKEWL_ENGINE_WINDOWS
 LPD3DXEFFECT Shader::get_d3d_effect()
 {
@@ -188,6 +276,8 @@ LPD3DXEFFECT Shader::get_d3d_effect()
 
 void Shader::Internal::release()
 {
+	uniforms.clear();
+
 	if (opengl) {
 		glDeleteShader(opengl_vertex_shader);
 		printGLerror("glDeleteShader");
@@ -205,6 +295,8 @@ void Shader::Internal::release()
 
 void Shader::Internal::reload()
 {
+	// New program, so locations and values are looked up and set again
+	uniforms.clear();
 
 	if (opengl) {
 		GLint status;
@@ -248,6 +340,13 @@ void Shader::Internal::reload()
 		printGLerror("glAttachShader");
 		glLinkProgram(opengl_shader);
 		printGLerror("glLinkProgram");
+
+		// Vertex_Cache needs these every flush
+		const char *attribute_names[NUM_ATTRIBUTES] = { "in_position", "in_texcoord", "in_colour" };
+		for (int i = 0; i < NUM_ATTRIBUTES; i++) {
+			opengl_attributes[i] = glGetAttribLocation(opengl_shader, attribute_names[i]);
+			printGLerror("glGetAttribLocation (%s)", attribute_names[i]);
+		}
 	}
 #ifdef NOOSKEWL_ENGINE_WINDOWS
 	else {
@@ -279,6 +378,58 @@ void Shader::Internal::reload()
 #endif
 }
 
+Shader::Internal::Uniform_State &Shader::Internal::get_uniform_state(int id)
+{
+	if (id < 0) {
+		// Uniform() that never came from get_uniform
+		missing.resolved = true;
+		missing.location = -1;
+#ifdef NOOSKEWL_ENGINE_WINDOWS
+		missing.d3d_handle = 0;
+#endif
+		return missing;
+	}
+
+	if (id >= (int)uniforms.size()) {
+		Uniform_State state;
+		state.resolved = false;
+		state.location = -1;
+#ifdef NOOSKEWL_ENGINE_WINDOWS
+		state.d3d_handle = 0;
+#endif
+		uniforms.resize(id+1, state);
+	}
+
+	Uniform_State &state = uniforms[id];
+
+	if (state.resolved == false) {
+		const char *name = uniform_names[id].c_str();
+		if (opengl) {
+			state.location = glGetUniformLocation(opengl_shader, name);
+			printGLerror("glGetUniformLocation (%s)", name);
+		}
+#ifdef NOOSKEWL_ENGINE_WINDOWS
+		else {
+			state.d3d_handle = d3d_effect->GetParameterByName(0, name);
+		}
+#endif
+		state.resolved = true;
+	}
+
+	return state;
+}
+
+bool Shader::Internal::update_value(Uniform_State &state, const float *value, int count)
+{
+	if ((int)state.value.size() == count && memcmp(&state.value[0], value, count * sizeof(float)) == 0) {
+		return false;
+	}
+
+	state.value.assign(value, value + count);
+
+	return true;
+}
+
 float Shader::get_global_alpha()
 {
 	return global_alpha;
@@ -8,6 +8,7 @@
 #include "Nooskewl_Engine/speech.h"
 #include "Nooskewl_Engine/sprite.h"
 #include "Nooskewl_Engine/tokenizer.h"
+#include "Nooskewl_Engine/utf8.h"
 
 using namespace Nooskewl_Engine;
 
@@ -156,12 +157,18 @@ void Speech::draw()
 	int drawn = noo.font->draw_wrapped(noo.black, text.substr(offset), Point<int>(win_x + pad, win_y + pad), win_w - pad * 2, line_height, 3, start_time, TEXT_DELAY, true, full, num_lines, width);
 
 	if (full) {
-		if (unsigned(offset+drawn) >= text.length()) {
+		// drawn is in characters, offset in bytes
+		UTF8_Iterator it(text, offset);
+		for (int i = 0; i < drawn && *it != 0; i++) {
+			++it;
+		}
+		int end = it.get_pointer() - text.c_str();
+		if (end >= (int)text.length()) {
 			done = true;
 		}
 		else {
 			advance = true;
-			skip = drawn;
+			skip = end - offset;
 		}
 	}
 
@@ -1,3 +1,5 @@
+#include "Nooskewl_Engine/cpa.h"
+#include "Nooskewl_Engine/engine.h"
 #include "Nooskewl_Engine/error.h"
 #include "Nooskewl_Engine/image.h"
 #include "Nooskewl_Engine/internal.h"
@@ -62,6 +64,10 @@ void Sprite::load(std::string xml_filename, std::string image_directory, bool ab
 		std::vector<Image *> images;
 		for (count = 0; count < 1024 /* NOTE: hardcoded max frames */; count++) {
 			std::string filename = image_directory + "/" + anim->get_name() + itos(count) + ".tga";
+			// Cheap check for the end of the animation rather than catching an exception
+			if (noo.cpa->exists(filename) == false) {
+				break;
+			}
 			Image *image;
 			try {
 				image = new Image(filename, true);
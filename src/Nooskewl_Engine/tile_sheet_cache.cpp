@@ -0,0 +1,248 @@
+#include "Nooskewl_Engine/asset_loader.h"
+#include "Nooskewl_Engine/engine.h"
+#include "Nooskewl_Engine/error.h"
+#include "Nooskewl_Engine/image.h"
+#include "Nooskewl_Engine/internal.h"
+#include "Nooskewl_Engine/tile_sheet_cache.h"
+
+using namespace Nooskewl_Engine;
+
+static std::string sheet_filename(int sheet)
+{
+	return "tiles/tiles" + itos(sheet) + ".tga";
+}
+
+static bool taller(const std::pair<int, int> &a, const std::pair<int, int> &b)
+{
+	return a.first > b.first;
+}
+
+Tile_Sheet_Cache::Tile_Sheet_Cache(int budget_mb) :
+	budget(budget_mb * 1024 * 1024),
+	resident_bytes(0)
+{
+	for (int i = 0; i < 256; i++) {
+		Size<int> size;
+		if (Image::read_tga_size(sheet_filename(i), size) == false) {
+			break;
+		}
+		sheet_sizes.push_back(size);
+	}
+
+	int max_texture_size = 2048;
+	if (noo.opengl) {
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+		printGLerror("glGetIntegerv");
+	}
+	int max_size = MIN(4096, max_texture_size);
+
+	// Shelf pack, tallest sheets first
+	std::vector< std::pair<int, int> > order; // height, sheet
+	for (size_t i = 0; i < sheet_sizes.size(); i++) {
+		order.push_back(std::pair<int, int>(sheet_sizes[i].h, i));
+	}
+	std::stable_sort(order.begin(), order.end(), taller);
+
+	locations.resize(sheet_sizes.size());
+
+	Point<int> pos(0, 0);
+	int shelf_height = 0;
+	int current = -1; // atlas being filled
+
+	for (size_t i = 0; i < order.size(); i++) {
+		int sheet = order[i].second;
+		Size<int> size = sheet_sizes[sheet];
+
+		if (size.w > max_texture_size || size.h > max_texture_size) {
+			throw LoadError(sheet_filename(sheet) + " is bigger than the largest texture size");
+		}
+
+		Atlas a;
+		a.image = 0;
+		a.size = Size<int>(0, 0);
+		a.last_used = 0;
+
+		// Too big to share, gets an atlas to itself
+		if (size.w > max_size || size.h > max_size) {
+			a.size = size;
+			a.sheets.push_back(sheet);
+			locations[sheet].atlas = atlases.size();
+			locations[sheet].offset = Point<int>(0, 0);
+			atlases.push_back(a);
+			continue;
+		}
+
+		if (pos.x + size.w > max_size) {
+			pos.x = 0;
+			pos.y += shelf_height;
+			shelf_height = 0;
+		}
+
+		if (current < 0 || pos.y + size.h > max_size) {
+			current = atlases.size();
+			atlases.push_back(a);
+			pos = Point<int>(0, 0);
+			shelf_height = 0;
+		}
+
+		Atlas &atlas = atlases[current];
+		atlas.sheets.push_back(sheet);
+		atlas.size.w = MAX(atlas.size.w, pos.x + size.w);
+		atlas.size.h = MAX(atlas.size.h, pos.y + size.h);
+
+		locations[sheet].atlas = current;
+		locations[sheet].offset = pos;
+
+		pos.x += size.w;
+		shelf_height = MAX(shelf_height, size.h);
+	}
+}
+
+Tile_Sheet_Cache::~Tile_Sheet_Cache()
+{
+	for (size_t i = 0; i < atlases.size(); i++) {
+		delete atlases[i].image;
+	}
+}
+
+int Tile_Sheet_Cache::get_num_sheets()
+{
+	return sheet_sizes.size();
+}
+
+Tile_Sheet_Cache::Location Tile_Sheet_Cache::get_location(int sheet)
+{
+	return locations[sheet];
+}
+
+Image *Tile_Sheet_Cache::get_atlas(int atlas)
+{
+	Atlas &a = atlases[atlas];
+
+	if (a.image == 0) {
+		load(a);
+	}
+
+	a.last_used = SDL_GetTicks();
+
+	return a.image;
+}
+
+Size<int> Tile_Sheet_Cache::get_atlas_size(int atlas)
+{
+	return atlases[atlas].size;
+}
+
+void Tile_Sheet_Cache::prefetch(const std::vector<int> &sheets)
+{
+	std::map<int, int> old_prefetched = prefetched;
+	prefetched.clear();
+
+	for (size_t i = 0; i < sheets.size(); i++) {
+		int sheet = sheets[i];
+		if (sheet < 0 || sheet >= (int)sheet_sizes.size() || atlases[locations[sheet].atlas].image != 0) {
+			continue;
+		}
+		std::map<int, int>::iterator it = old_prefetched.find(sheet);
+		if (it != old_prefetched.end()) {
+			prefetched[sheet] = (*it).second;
+			old_prefetched.erase(it);
+		}
+		else {
+			prefetched[sheet] = noo.asset_loader->load_pixels(sheet_filename(sheet), Asset_Loader::LOW);
+		}
+	}
+
+	std::map<int, int>::iterator it;
+	for (it = old_prefetched.begin(); it != old_prefetched.end(); it++) {
+		noo.asset_loader->release((*it).second);
+	}
+}
+
+void Tile_Sheet_Cache::set_budget(int mb)
+{
+	budget = mb * 1024 * 1024;
+	evict(0);
+}
+
+int Tile_Sheet_Cache::get_resident_bytes()
+{
+	return resident_bytes;
+}
+
+void Tile_Sheet_Cache::load(Atlas &atlas)
+{
+	int bytes = atlas.size.w * atlas.size.h * 4;
+
+	evict(bytes);
+
+	unsigned char *pixels = new unsigned char[bytes];
+	memset(pixels, 0, bytes);
+
+	for (size_t i = 0; i < atlas.sheets.size(); i++) {
+		int sheet = atlas.sheets[i];
+		Point<int> offset = locations[sheet].offset;
+		Size<int> size;
+		unsigned char *sheet_pixels = 0;
+
+		std::map<int, int>::iterator it = prefetched.find(sheet);
+		if (it != prefetched.end()) {
+			sheet_pixels = noo.asset_loader->get_pixels((*it).second, size);
+			prefetched.erase(it);
+		}
+		if (sheet_pixels == 0) {
+			sheet_pixels = Image::read_tga(sheet_filename(sheet), size);
+		}
+
+		size.w = MIN(size.w, sheet_sizes[sheet].w);
+		size.h = MIN(size.h, sheet_sizes[sheet].h);
+
+		// read_tga gives the bottom row first, keep it that way in the atlas
+		for (int row = 0; row < size.h; row++) {
+			int atlas_row = atlas.size.h - offset.y - size.h + row;
+			memcpy(pixels + (atlas_row * atlas.size.w + offset.x) * 4, sheet_pixels + row * size.w * 4, size.w * 4);
+		}
+
+		delete[] sheet_pixels;
+	}
+
+	try {
+		atlas.image = new Image(pixels, atlas.size);
+	}
+	catch (Error e) {
+		delete[] pixels;
+		throw e;
+	}
+
+	delete[] pixels;
+
+	resident_bytes += bytes;
+}
+
+void Tile_Sheet_Cache::evict(int needed_bytes)
+{
+	Uint32 now = SDL_GetTicks();
+
+	while (resident_bytes + needed_bytes > budget) {
+		int lru = -1;
+		for (size_t i = 0; i < atlases.size(); i++) {
+			Atlas &a = atlases[i];
+			if (a.image == 0 || now - a.last_used < IN_USE_TIME) {
+				continue;
+			}
+			if (lru < 0 || a.last_used < atlases[lru].last_used) {
+				lru = i;
+			}
+		}
+
+		if (lru < 0) {
+			// Everything left is in use, go over budget rather than thrash
+			break;
+		}
+
+		Atlas &a = atlases[lru];
+		delete a.image;
+		a.image = 0;
+		resident_bytes -= a.size.w * a.size.h * 4;
+	}
+}
@@ -2,46 +2,35 @@
 #include "Nooskewl_Engine/error.h"
 #include "Nooskewl_Engine/image.h"
 #include "Nooskewl_Engine/internal.h"
+#include "Nooskewl_Engine/light_renderer.h"
 #include "Nooskewl_Engine/map.h"
 #include "Nooskewl_Engine/map_entity.h"
 #include "Nooskewl_Engine/shader.h"
+#include "Nooskewl_Engine/tile_sheet_cache.h"
 #include "Nooskewl_Engine/tilemap.h"
+#include "Nooskewl_Engine/vertex_buffer.h"
+#include "Nooskewl_Engine/vertex_cache.h"
+
+// Same as Vertex_Cache uses so tiles don't bleed into their neighbours in the atlas
+#define SMALL_TEXTURE_OFFSET 0.00001f
 
 using namespace Nooskewl_Engine;
 
 Tilemap::Tilemap(std::string map_filename) :
-	lighting_enabled(false)
+	lighting_enabled(false),
+	indoors(false),
+	outdoor_effect(0),
+	max_wall_extent(0),
+	occluder(0)
 {
 	map_filename = "maps/" + map_filename;
 
-	for (int i = 0; i < 256; i++) {
-		std::string filename = std::string("tiles/tiles" + itos(i) + ".tga");
-		Image *image;
-		try {
-			image = new Image(filename, true);
-		}
-		catch (Error e) {
-			if (i == 0) {
-				throw LoadError("no tile sheets!");
-			}
-			else {
-				break;
-			}
-		}
-		sheets.push_back(image);
+	// Tile sheets are shared by all maps and loaded when first drawn
+	if (m.tile_sheet_cache->get_num_sheets() == 0) {
+		throw LoadError("no tile sheets!");
 	}
 
-	SDL_RWops *f;
-	try {
-		f = open_file(map_filename);
-	}
-	catch (Error e) {
-		for (size_t i = 0; i < sheets.size(); i++) {
-			delete sheets[i];
-		}
-		sheets.clear();
-		throw e;
-	}
+	SDL_RWops *f = open_file(map_filename);
 
 	size.w = SDL_ReadLE16(f);
 	size.h = SDL_ReadLE16(f);
@@ -104,10 +93,126 @@ Tilemap::Tilemap(std::string map_filename) :
 
 	SDL_RWclose(f);
 
+	init();
+}
+
+Tilemap::Tilemap(Size<int> size, int num_layers, int solid_percent) :
+	size(size),
+	num_layers(num_layers),
+	lighting_enabled(false),
+	indoors(false),
+	outdoor_effect(0),
+	max_wall_extent(0),
+	occluder(0)
+{
+	if (m.tile_sheet_cache->get_num_sheets() == 0) {
+		throw LoadError("no tile sheets!");
+	}
+
+	layers = new Layer[num_layers];
+
 	for (int layer = 0; layer < num_layers; layer++) {
-		std::sort(layers[layer].sheets_used.begin(), layers[layer].sheets_used.end());
+		layers[layer].sheet = new int *[size.h];
+		layers[layer].x = new int *[size.h];
+		layers[layer].y = new int *[size.h];
+		layers[layer].solid = new bool *[size.h];
+		for (int row = 0; row < size.h; row++) {
+			layers[layer].sheet[row] = new int[size.w];
+			layers[layer].x[row] = new int[size.w];
+			layers[layer].y[row] = new int[size.w];
+			layers[layer].solid[row] = new bool[size.w];
+			for (int col = 0; col < size.w; col++) {
+				layers[layer].x[row][col] = 0;
+				layers[layer].y[row][col] = 0;
+				layers[layer].sheet[row][col] = 0;
+				layers[layer].solid[row][col] = layer == 0 && rand() % 100 < solid_percent;
+			}
+		}
+		layers[layer].sheets_used.push_back(0);
+	}
+
+	init();
+}
+
+void Tilemap::init()
+{
+	// Solidity doesn't change after loading, so checks across all layers (the
+	// usual kind, from movement and A*) only need one bit per tile
+	solid_bits.resize((size.w * size.h + 31) / 32, 0);
+
+	for (int row = 0; row < size.h; row++) {
+		for (int col = 0; col < size.w; col++) {
+			for (int layer = 0; layer < num_layers; layer++) {
+				if (layers[layer].solid[row][col]) {
+					int i = row * size.w + col;
+					solid_bits[i >> 5] |= 1u << (i & 31);
+					break;
+				}
+			}
+		}
 	}
 
+	ambient_light = noo.black;
+
+	for (int row = 0; row < size.h; row++) {
+		for (int col = 0; col < size.w; col++) {
+			tile_walls.push_back(get_tile_wall(Point<int>(col, row)));
+		}
+	}
+
+	for (size_t i = 0; i < walls.size(); i++) {
+		Wall *w = walls[i];
+		max_wall_extent = MAX(max_wall_extent, (int)(w->position.z + w->size.z + w->size.y - 1));
+	}
+
+	light_map.resize(size.w * size.h * 3, 0);
+
+	num_chunks.w = (size.w + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	num_chunks.h = (size.h + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+	Chunk empty_chunk;
+	empty_chunk.num_tiles = 0;
+	empty_chunk.baked = false;
+	empty_chunk.buffer = 0;
+	empty_chunk.lit = false;
+
+	for (int layer = 0; layer < num_layers; layer++) {
+		Layer &l = layers[layer];
+		std::sort(l.sheets_used.begin(), l.sheets_used.end());
+		for (size_t i = 0; i < l.sheets_used.size(); i++) {
+			int atlas = m.tile_sheet_cache->get_location(l.sheets_used[i]).atlas;
+			if (std::find(l.atlases_used.begin(), l.atlases_used.end(), atlas) == l.atlases_used.end()) {
+				l.atlases_used.push_back(atlas);
+			}
+		}
+		// Baked the first time they're drawn
+		l.chunks.resize(num_chunks.w * num_chunks.h, empty_chunk);
+		// Bounds of what's in each chunk, so draw can skip it without looking at the tiles
+		for (int row = 0; row < size.h; row++) {
+			for (int col = 0; col < size.w; col++) {
+				if (l.x[row][col] < 0) {
+					continue;
+				}
+				Chunk &chunk = l.chunks[(row / CHUNK_SIZE) * num_chunks.w + col / CHUNK_SIZE];
+				Point<int> topleft(col * noo.tile_size, row * noo.tile_size);
+				Point<int> bottomright = topleft + noo.tile_size;
+				if (chunk.num_tiles == 0) {
+					chunk.topleft = topleft;
+					chunk.bottomright = bottomright;
+				}
+				else {
+					chunk.topleft.x = MIN(chunk.topleft.x, topleft.x);
+					chunk.topleft.y = MIN(chunk.topleft.y, topleft.y);
+					chunk.bottomright.x = MAX(chunk.bottomright.x, bottomright.x);
+					chunk.bottomright.y = MAX(chunk.bottomright.y, bottomright.y);
+				}
+				chunk.num_tiles++;
+			}
+		}
+	}
+
+	reset_draw_stats();
+
 	Day_Night_Portion p;
 	p.colour = noo.colours[15];
 	p.percent = 30;
@@ -137,10 +242,6 @@ Tilemap::Tilemap(std::string map_filename) :
 
 Tilemap::~Tilemap()
 {
-	for (size_t i = 0; i < sheets.size(); i++) {
-		delete sheets[i];
-	}
-
 	if (layers) {
 		for (int layer = 0; layer < num_layers; layer++) {
 			for (int row = 0; row < size.h; row++) {
@@ -156,10 +257,15 @@ Tilemap::~Tilemap()
 			for (size_t i = 0; i < layers[layer].groups.size(); i++) {
 				delete layers[layer].groups[i];
 			}
+			for (size_t i = 0; i < layers[layer].chunks.size(); i++) {
+				delete layers[layer].chunks[i].buffer;
+			}
 		}
 
 		delete[] layers;
 	}
+
+	delete occluder;
 }
 
 int Tilemap::get_num_layers()
@@ -172,23 +278,34 @@ Size<int> Tilemap::get_size()
 	return size;
 }
 
+std::vector<int> Tilemap::get_sheets_used()
+{
+	std::vector<int> sheets;
+
+	for (int layer = 0; layer < num_layers; layer++) {
+		Layer &l = layers[layer];
+		for (size_t i = 0; i < l.sheets_used.size(); i++) {
+			if (std::find(sheets.begin(), sheets.end(), l.sheets_used[i]) == sheets.end()) {
+				sheets.push_back(l.sheets_used[i]);
+			}
+		}
+	}
+
+	return sheets;
+}
+
 bool Tilemap::is_solid(int layer, Point<int> position)
 {
 	if (position.x < 0 || position.y < 0 || position.x >= size.w || position.y >= size.h) {
 		return true;
 	}
 
-	int start_layer = layer < 0 ? 0 : layer;
-	int end_layer = layer < 0 ? num_layers - 1 : layer;
-
-	for (int i = start_layer; i <= end_layer; i++) {
-		Layer l = layers[i];
-		if (l.solid[position.y][position.x]) {
-			return true;
-		}
+	if (layer < 0) {
+		int i = position.y * size.w + position.x;
+		return (solid_bits[i >> 5] & (1u << (i & 31))) != 0;
 	}
 
-	return false;
+	return layers[layer].solid[position.y][position.x];
 }
 
 bool Tilemap::collides(int layer, Point<int> topleft, Point<int> bottomright)
@@ -206,8 +323,20 @@ bool Tilemap::collides(int layer, Point<int> topleft, Point<int> bottomright)
 	start_row = MIN(size.h-1, MAX(0, start_row));
 	end_row = MIN(size.h-1, MAX(0, end_row));
 
+	if (layer < 0) {
+		for (int row = start_row; row <= end_row; row++) {
+			for (int column = start_column; column <= end_column; column++) {
+				int i = row * size.w + column;
+				if (solid_bits[i >> 5] & (1u << (i & 31))) {
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
 	for (int i = start_layer; i <= end_layer; i++) {
-		Layer l = layers[i];
+		Layer &l = layers[i];
 
 		for (int row = start_row; row <= end_row; row++) {
 			for (int column = start_column; column <= end_column; column++) {
@@ -223,54 +352,102 @@ bool Tilemap::collides(int layer, Point<int> topleft, Point<int> bottomright)
 
 void Tilemap::draw(int layer, Point<float> position, bool use_depth_buffer)
 {
-	Layer l = layers[layer];
+	Uint64 start_ticks = SDL_GetPerformanceCounter();
 
-	for (size_t sheet = 0; sheet < l.sheets_used.size(); sheet++) {
-		int sheet_num = l.sheets_used[sheet];
+	Layer &l = layers[layer];
 
-		sheets[sheet_num]->start();
+	// Chunks are baked at the map origin in map pixels. Move them into place
+	// with the model matrix, the same way Vertex_Cache would scale and move
+	// each vertex. z is flattened when not using the depth buffer.
+	glm::mat4 model, view, proj;
+	noo.get_matrices(model, view, proj);
 
-		for (int row = 0; row < size.h; row++) {
-			for (int col = 0; col < size.w; col++) {
-				int s = l.sheet[row][col];
-				if (s == sheet_num) {
-					int x = l.x[row][col];
-					int y = l.y[row][col];
-					int sx = x * noo.tile_size;
-					int sy = y * noo.tile_size;
-					float dx = position.x + col * noo.tile_size;
-					float dy = position.y + row * noo.tile_size;
-					int dw = noo.tile_size;
-					int dh = noo.tile_size;
-
-					// Clipping
-					if (dx < -noo.tile_size || dy < -noo.tile_size || dx >= noo.screen_size.w+noo.tile_size || dy >= noo.screen_size.h+noo.tile_size) {
-						continue;
-					}
-
-					SDL_Colour light;
-
-					if (lighting_enabled) {
-						get_tile_lighting(Point<int>(col, row), light);
-					}
-					else {
-						light = noo.white;
-					}
-
-					sheets[s]->draw_region_tinted_z(
-						light,
-						Point<int>(sx, sy),
-						Size<int>(dw, dh),
-						Point<float>(dx, dy),
-						use_depth_buffer ? get_z(layer, col, row) : 0.0f,
-						0
-					);
-				}
+	Point<float> scale, translation;
+	m.vertex_cache->get_transform(scale, translation);
+
+	glm::mat4 chunk_model = glm::translate(model, glm::vec3(translation.x, translation.y, 0.0f));
+	chunk_model = glm::scale(chunk_model, glm::vec3(scale.x, scale.y, use_depth_buffer ? 1.0f : 0.0f));
+	chunk_model = glm::translate(chunk_model, glm::vec3(position.x, position.y, 0.0f));
+
+	noo.set_matrices(chunk_model, view, proj);
+	noo.update_projection();
+
+	int chunk_pixels = CHUNK_SIZE * noo.tile_size;
+
+	// The camera rect in map pixels, with a tile of slack like the per tile clipping used to have
+	Point<float> camera_topleft = -position - noo.tile_size;
+	Point<float> camera_bottomright = -position + noo.screen_size + noo.tile_size;
+
+	// Only the chunks under the camera are looked at, so this doesn't grow with the map
+	int start_cx = MAX(0, (int)floor(camera_topleft.x / chunk_pixels));
+	int start_cy = MAX(0, (int)floor(camera_topleft.y / chunk_pixels));
+	int end_cx = MIN(num_chunks.w - 1, (int)floor(camera_bottomright.x / chunk_pixels));
+	int end_cy = MIN(num_chunks.h - 1, (int)floor(camera_bottomright.y / chunk_pixels));
+
+	std::vector<Chunk *> visible;
+
+	for (int cy = start_cy; cy <= end_cy; cy++) {
+		for (int cx = start_cx; cx <= end_cx; cx++) {
+			int chunk_num = cy * num_chunks.w + cx;
+			Chunk &chunk = l.chunks[chunk_num];
+
+			draw_stats.chunks_visited++;
+
+			if (chunk.num_tiles == 0 || chunk.bottomright.x <= camera_topleft.x || chunk.bottomright.y <= camera_topleft.y || chunk.topleft.x >= camera_bottomright.x || chunk.topleft.y >= camera_bottomright.y) {
+				continue;
+			}
+
+			if (chunk.baked == false) {
+				bake(layer, chunk_num);
 			}
+
+			if (chunk.lit == false) {
+				light(chunk);
+			}
+
+			visible.push_back(&chunk);
+
+			draw_stats.chunks_drawn++;
+			draw_stats.tiles_drawn += chunk.num_tiles;
 		}
+	}
 
-		sheets[sheet_num]->end();
+	// One pass per atlas rather than per sheet, usually all the sheets are in one
+	for (size_t i = 0; i < l.atlases_used.size() && visible.size() > 0; i++) {
+		Image *atlas = m.tile_sheet_cache->get_atlas(l.atlases_used[i]);
+
+		m.vertex_cache->start(atlas);
+
+		for (size_t j = 0; j < visible.size(); j++) {
+			std::pair<int, int> &range = visible[j]->atlas_ranges[i];
+			visible[j]->buffer->draw(range.first, range.second);
+		}
 	}
+
+	noo.set_matrices(model, view, proj);
+	noo.update_projection();
+
+	draw_stats.draws++;
+	draw_stats.ticks += SDL_GetPerformanceCounter() - start_ticks;
+}
+
+Tilemap::Draw_Stats Tilemap::get_draw_stats()
+{
+	return draw_stats;
+}
+
+void Tilemap::reset_draw_stats()
+{
+	draw_stats.draws = 0;
+	draw_stats.chunks_visited = 0;
+	draw_stats.chunks_drawn = 0;
+	draw_stats.tiles_drawn = 0;
+	draw_stats.ticks = 0;
+}
+
+int Tilemap::get_num_chunks()
+{
+	return num_chunks.w * num_chunks.h;
 }
 
 std::vector<Tilemap::Group *> Tilemap::get_groups(int layer)
@@ -366,10 +543,20 @@ bool Tilemap::checkcoll_line_wall(Point<float> tile_pos, Point<float> orig_tile_
 
 void Tilemap::get_tile_lighting(Point<int> tile_position, SDL_Colour &out)
 {
-	Point<int> orig_tile_pos = tile_position;
+	if (use_gpu_lighting()) {
+		out = noo.white;
+		return;
+	}
+
+	if (lighting_inputs.size() == 0) {
+		update_light_map();
+	}
 
+	tile_position.x = MIN(size.w-1, MAX(0, tile_position.x));
+	tile_position.y = MIN(size.h-1, MAX(0, tile_position.y));
+
+	int *light = &light_map[(tile_position.y * size.w + tile_position.x) * 3];
 	int out_colour[3];
-	SDL_Colour day_time_colour = get_day_time_colour();
 
 	if (indoors) {
 		out_colour[0] = ambient_light.r;
@@ -382,109 +569,420 @@ void Tilemap::get_tile_lighting(Point<int> tile_position, SDL_Colour &out)
 		out_colour[2] = day_time_colour.b;
 	}
 
-	Wall *tile_wall = get_tile_wall(tile_position);
+	out_colour[0] += light[0] / 256;
+	out_colour[1] += light[1] / 256;
+	out_colour[2] += light[2] / 256;
 
-	if (tile_wall) {
-		tile_position.y = tile_wall->position.y + tile_wall->size.y - 1;
+	out.r = MIN(255, out_colour[0]);
+	out.g = MIN(255, out_colour[1]);
+	out.b = MIN(255, out_colour[2]);
+	out.a = 255;
+
+	if (indoors) {
+		float outdoor_percent = outdoor_effect / 100.0f;
+		out.r *= 1.0f - outdoor_percent;
+		out.g *= 1.0f - outdoor_percent;
+		out.b *= 1.0f - outdoor_percent;
+		out.r += outdoor_percent * day_time_colour.r;
+		out.g += outdoor_percent * day_time_colour.g;
+		out.b += outdoor_percent * day_time_colour.b;
+	}
+}
+
+void Tilemap::draw_lights(Point<float> position)
+{
+	if (use_gpu_lighting() == false) {
+		return;
 	}
 
-	std::vector<Map_Entity *> &entities = noo.map->get_entities();
-	int num_lights = 1;
+	if (occluder == 0) {
+		// Laid out like read_tga, bottom row first
+		std::vector<unsigned char> pixels(size.w * size.h * 4, 0);
+		for (size_t i = 0; i < walls.size(); i++) {
+			Wall *w = walls[i];
+			int top = MIN(255, (int)(w->position.z + w->size.z) + 1);
+			for (int row = MAX(0, (int)w->position.y); row < MIN(size.h, (int)(w->position.y + w->size.y)); row++) {
+				for (int col = MAX(0, (int)w->position.x); col < MIN(size.w, (int)(w->position.x + w->size.x)); col++) {
+					unsigned char *p = &pixels[((size.h - row - 1) * size.w + col) * 4];
+					p[0] = MAX(p[0], top);
+					p[3] = 255;
+				}
+			}
+		}
+		occluder = new Image(&pixels[0], size);
+	}
+
+	SDL_Colour day_time_colour = get_day_time_colour();
+	SDL_Colour base = indoors ? ambient_light : day_time_colour;
+
+	// Outdoor light mixed in up front rather than after, so only differs from the CPU version where it's saturated
+	float outdoor_percent = indoors ? outdoor_effect / 100.0f : 0.0f;
+
+	base.r = base.r * (1.0f - outdoor_percent) + day_time_colour.r * outdoor_percent;
+	base.g = base.g * (1.0f - outdoor_percent) + day_time_colour.g * outdoor_percent;
+	base.b = base.b * (1.0f - outdoor_percent) + day_time_colour.b * outdoor_percent;
+	base.a = 255;
+
+	m.light_renderer->start(base);
 
-	for (size_t i = 0; i < entities.size(); i++) {
-		Map_Entity *map_entity = entities[i];
+	Map::Lights &lights = noo.map->get_lights();
 
-		if (indoors && map_entity == noo.player) {
+	for (size_t i = 0; i < lights.brains.size(); i++) {
+		if (indoors && lights.entities[i] == noo.player) {
 			continue;
 		}
+		SDL_Colour colour = lights.colours[i];
+		colour.r *= 1.0f - outdoor_percent;
+		colour.g *= 1.0f - outdoor_percent;
+		colour.b *= 1.0f - outdoor_percent;
+		m.light_renderer->draw_light(position, lights.positions[i], colour, lights.reaches[i], lights.falloffs[i], occluder);
+	}
 
-		Brain *brain = map_entity->get_brain();
+	m.light_renderer->end();
+}
 
-		if (brain == 0) {
-			continue;
+void Tilemap::enable_lighting(bool enabled)
+{
+	lighting_enabled = enabled;
+}
+
+void Tilemap::set_lighting_parameters(bool indoors, int outdoor_effect, SDL_Colour ambient_light)
+{
+	this->indoors = indoors;
+	this->outdoor_effect = outdoor_effect;
+	this->ambient_light = ambient_light;
+}
+
+void Tilemap::bake(int layer, int chunk_num)
+{
+	Layer &l = layers[layer];
+	Chunk &chunk = l.chunks[chunk_num];
+
+	int start_col = (chunk_num % num_chunks.w) * CHUNK_SIZE;
+	int start_row = (chunk_num / num_chunks.w) * CHUNK_SIZE;
+	int end_col = MIN(size.w, start_col + CHUNK_SIZE);
+	int end_row = MIN(size.h, start_row + CHUNK_SIZE);
+
+	std::vector<float> vertices; // x, y, z, u, v
+
+	// Grouped by atlas so each is one draw
+	for (size_t i = 0; i < l.atlases_used.size(); i++) {
+		int atlas_num = l.atlases_used[i];
+		Size<int> atlas_size = m.tile_sheet_cache->get_atlas_size(atlas_num);
+		int first = vertices.size() / 5;
+
+		for (int row = start_row; row < end_row; row++) {
+			for (int col = start_col; col < end_col; col++) {
+				int x = l.x[row][col];
+				if (x < 0) {
+					continue;
+				}
+				Tile_Sheet_Cache::Location location = m.tile_sheet_cache->get_location(l.sheet[row][col]);
+				if (location.atlas != atlas_num) {
+					continue;
+				}
+
+				int y = l.y[row][col];
+				float sx = location.offset.x + x * noo.tile_size;
+				float sy = location.offset.y + y * noo.tile_size;
+
+				float tu = (sx + SMALL_TEXTURE_OFFSET) / atlas_size.w;
+				float tv = 1.0f - (sy + SMALL_TEXTURE_OFFSET) / atlas_size.h;
+				float tu2 = (sx + noo.tile_size - SMALL_TEXTURE_OFFSET) / atlas_size.w;
+				float tv2 = 1.0f - (sy + noo.tile_size - SMALL_TEXTURE_OFFSET) / atlas_size.h;
+
+				float dx = (float)(col * noo.tile_size);
+				float dy = (float)(row * noo.tile_size);
+				float dx2 = dx + noo.tile_size;
+				float dy2 = dy + noo.tile_size;
+				float z = get_z(layer, col, row);
+
+				// Same order as Vertex_Cache::cache_z
+				float quad[6][5] = {
+					{ dx, dy, z, tu, tv },
+					{ dx2, dy, z, tu2, tv },
+					{ dx2, dy2, z, tu2, tv2 },
+					{ dx, dy, z, tu, tv },
+					{ dx2, dy2, z, tu2, tv2 },
+					{ dx, dy2, z, tu, tv2 }
+				};
+
+				vertices.insert(vertices.end(), &quad[0][0], &quad[0][0] + 6 * 5);
+
+				chunk.tiles.push_back(Point<int>(col, row));
+			}
 		}
 
-		Light_Brain *light_brain = dynamic_cast<Light_Brain *>(brain);
+		chunk.atlas_ranges.push_back(std::pair<int, int>(first, vertices.size() / 5 - first));
+	}
 
-		if (light_brain == 0) {
-			continue;
+	if (chunk.tiles.size() > 0) {
+		chunk.buffer = new Vertex_Buffer(&vertices[0], vertices.size() / 5);
+	}
+
+	chunk.baked = true;
+	chunk.lit = false;
+}
+
+void Tilemap::light(Chunk &chunk)
+{
+	std::vector<float> colours(chunk.tiles.size() * 6 * 4);
+
+	for (size_t i = 0; i < chunk.tiles.size(); i++) {
+		SDL_Colour light;
+
+		if (lighting_enabled && use_gpu_lighting() == false) {
+			get_tile_lighting(chunk.tiles[i], light);
+		}
+		else {
+			light = noo.white;
 		}
 
-		num_lights++;
+		for (int v = 0; v < 6; v++) {
+			float *c = &colours[(i * 6 + v) * 4];
+			c[0] = light.r / 255.0f;
+			c[1] = light.g / 255.0f;
+			c[2] = light.b / 255.0f;
+			c[3] = light.a / 255.0f;
+		}
+	}
 
-		Vec3D<float> lposition = light_brain->get_position();
-		SDL_Colour lcolour = light_brain->get_colour();
-		float lreach = light_brain->get_reach();
-		float lfalloff = light_brain->get_falloff();
+	chunk.buffer->set_colours(&colours[0]);
 
-		Point<float> light_pos(lposition.x, lposition.y);
-		float light_z = lposition.z;
-		Wall *light_wall = get_tile_wall(light_pos);
+	chunk.lit = true;
+}
 
-		bool hits_wall = false;
+bool Tilemap::use_gpu_lighting()
+{
+	return lighting_enabled && noo.gpu_lighting && m.light_renderer != 0;
+}
 
-		for (size_t j = 0; j < walls.size(); j++) {
-			Wall *w = walls[j];
+void Tilemap::update_light_map()
+{
+	day_time_colour = get_day_time_colour();
+
+	if (lighting_enabled == false) {
+		// Lights are forgotten and everything goes back to plain colours once
+		if (lighting_inputs.size() > 0) {
+			lighting_inputs.clear();
+			light_states.clear();
+			std::fill(light_map.begin(), light_map.end(), 0);
+			relight_chunks(Point<int>(0, 0), Point<int>(size.w-1, size.h-1));
+		}
+		return;
+	}
 
-			if (w->position.z + w->size.z < light_z) {
-				continue;
-			}
+	// When any of these change every tile's colour does
+	std::vector<float> inputs;
 
-			if (checkcoll_line_wall(tile_position, orig_tile_pos, light_pos, light_z, w, tile_wall, light_wall)) {
-				hits_wall = true;
-				break;
-			}
+	inputs.push_back(lighting_enabled);
+	inputs.push_back(indoors);
+	inputs.push_back(outdoor_effect);
+	inputs.push_back(ambient_light.r);
+	inputs.push_back(ambient_light.g);
+	inputs.push_back(ambient_light.b);
+	inputs.push_back(day_time_colour.r);
+	inputs.push_back(day_time_colour.g);
+	inputs.push_back(day_time_colour.b);
+
+	inputs.push_back(use_gpu_lighting());
+
+	if (inputs != lighting_inputs) {
+		lighting_inputs = inputs;
+		relight_chunks(Point<int>(0, 0), Point<int>(size.w-1, size.h-1));
+	}
+
+	// Light_Renderer does the lights
+	if (use_gpu_lighting()) {
+		return;
+	}
+
+	// Lights are only redone where they've changed
+	std::map<Light_Brain *, Light_State>::iterator it;
+
+	for (it = light_states.begin(); it != light_states.end(); it++) {
+		it->second.seen = false;
+	}
+
+	Map::Lights &lights = noo.map->get_lights();
+
+	for (size_t i = 0; i < lights.brains.size(); i++) {
+		// Player's light is only used outdoors
+		if (indoors && lights.entities[i] == noo.player) {
+			continue;
 		}
 
-		if (hits_wall) {
+		Light_Brain *light_brain = lights.brains[i];
+		Vec3D<float> &position = lights.positions[i];
+		SDL_Colour colour = lights.colours[i];
+		float reach = lights.reaches[i];
+		float falloff = lights.falloffs[i];
+
+		it = light_states.find(light_brain);
+
+		if (it == light_states.end()) {
+			Light_State state;
+			state.colour = colour;
+			state.footprint.position = position;
+			state.footprint.reach = reach;
+			state.footprint.falloff = falloff;
+			state.previous_footprint = state.footprint;
+			state.previous_footprint.reach = -1.0f; // never matches
+			state.seen = true;
+			compute_footprint(state.footprint);
+			Light_State &added = light_states[light_brain] = state;
+			apply_light(added, 1);
 			continue;
 		}
 
-		float distance_light_to_tile = (Vec3D<float>(tile_position.x, tile_position.y, 0) - lposition).length();
+		Light_State &state = it->second;
+		Light_Footprint &f = state.footprint;
+		Light_Footprint &p = state.previous_footprint;
 
-		float mul;
+		state.seen = true;
 
-		if (distance_light_to_tile <= lreach) {
-			mul = 1.0f;
+		bool same_footprint = f.position.x == position.x && f.position.y == position.y && f.position.z == position.z && f.reach == reach && f.falloff == falloff;
+		bool same_colour = state.colour.r == colour.r && state.colour.g == colour.g && state.colour.b == colour.b;
+
+		if (same_footprint && same_colour) {
+			continue;
 		}
-		else if (distance_light_to_tile - lreach <= lfalloff) {
-			mul = 1.0f - ((distance_light_to_tile - lreach) / lfalloff);
+
+		apply_light(state, -1);
+
+		if (same_footprint == false) {
+			std::swap(f, p);
+			if (!(f.position.x == position.x && f.position.y == position.y && f.position.z == position.z && f.reach == reach && f.falloff == falloff)) {
+				f.position = position;
+				f.reach = reach;
+				f.falloff = falloff;
+				compute_footprint(f);
+			}
+		}
+
+		state.colour = colour;
+
+		apply_light(state, 1);
+	}
+
+	for (it = light_states.begin(); it != light_states.end();) {
+		if (it->second.seen == false) {
+			apply_light(it->second, -1);
+			light_states.erase(it++);
 		}
 		else {
-			mul = 0.0f;
+			it++;
 		}
+	}
+}
+
+void Tilemap::compute_footprint(Light_Footprint &footprint)
+{
+	footprint.tiles.clear();
 
-		out_colour[0] += lcolour.r * mul;
-		out_colour[1] += lcolour.g * mul;
-		out_colour[2] += lcolour.b * mul;
+	Vec3D<float> &position = footprint.position;
+	float radius = footprint.reach + footprint.falloff;
+
+	// Walls move a tile's lighting position down, so look further up for those
+	int start_col = MAX(0, (int)floor(position.x - radius));
+	int end_col = MIN(size.w-1, (int)ceil(position.x + radius));
+	int start_row = MAX(0, (int)floor(position.y - radius) - max_wall_extent);
+	int end_row = MIN(size.h-1, (int)ceil(position.y + radius));
+
+	Wall *light_wall = get_tile_wall(Point<float>(position.x, position.y));
+
+	for (int row = start_row; row <= end_row; row++) {
+		for (int col = start_col; col <= end_col; col++) {
+			float amount = get_light_amount(Point<int>(col, row), position, footprint.reach, footprint.falloff, light_wall);
+			if (amount <= 0.0f) {
+				continue;
+			}
+			if (footprint.tiles.size() == 0) {
+				footprint.topleft = Point<int>(col, row);
+				footprint.bottomright = Point<int>(col, row);
+			}
+			else {
+				footprint.topleft.x = MIN(footprint.topleft.x, col);
+				footprint.topleft.y = MIN(footprint.topleft.y, row);
+				footprint.bottomright.x = MAX(footprint.bottomright.x, col);
+				footprint.bottomright.y = MAX(footprint.bottomright.y, row);
+			}
+			footprint.tiles.push_back(std::pair<int, float>(row * size.w + col, amount));
+		}
 	}
+}
 
-	out.r = MIN(255, out_colour[0]);
-	out.g = MIN(255, out_colour[1]);
-	out.b = MIN(255, out_colour[2]);
-	out.a = 255;
+float Tilemap::get_light_amount(Point<int> tile_position, Vec3D<float> light_position, float reach, float falloff, Wall *light_wall)
+{
+	Point<int> orig_tile_pos = tile_position;
 
-	if (indoors) {
-		float outdoor_percent = outdoor_effect / 100.0f;
-		out.r *= 1.0f - outdoor_percent;
-		out.g *= 1.0f - outdoor_percent;
-		out.b *= 1.0f - outdoor_percent;
-		out.r += outdoor_percent * day_time_colour.r;
-		out.g += outdoor_percent * day_time_colour.g;
-		out.b += outdoor_percent * day_time_colour.b;
+	Wall *tile_wall = tile_walls[tile_position.y * size.w + tile_position.x];
+
+	if (tile_wall) {
+		tile_position.y = tile_wall->position.y + tile_wall->size.y - 1;
+	}
+
+	Point<float> light_pos(light_position.x, light_position.y);
+	float light_z = light_position.z;
+
+	for (size_t i = 0; i < walls.size(); i++) {
+		Wall *w = walls[i];
+
+		if (w->position.z + w->size.z < light_z) {
+			continue;
+		}
+
+		if (checkcoll_line_wall(tile_position, orig_tile_pos, light_pos, light_z, w, tile_wall, light_wall)) {
+			return 0.0f;
+		}
+	}
+
+	float distance_light_to_tile = (Vec3D<float>(tile_position.x, tile_position.y, 0) - light_position).length();
+
+	if (distance_light_to_tile <= reach) {
+		return 1.0f;
+	}
+	else if (distance_light_to_tile - reach <= falloff) {
+		return 1.0f - ((distance_light_to_tile - reach) / falloff);
+	}
+	else {
+		return 0.0f;
 	}
 }
 
-void Tilemap::enable_lighting(bool enabled)
+void Tilemap::apply_light(Light_State &state, int sign)
 {
-	lighting_enabled = enabled;
+	Light_Footprint &footprint = state.footprint;
+
+	// Fixed point so taking a light away leaves exactly what was there before
+	for (size_t i = 0; i < footprint.tiles.size(); i++) {
+		int *light = &light_map[footprint.tiles[i].first * 3];
+		float amount = footprint.tiles[i].second * 256.0f;
+		light[0] += sign * (int)(state.colour.r * amount);
+		light[1] += sign * (int)(state.colour.g * amount);
+		light[2] += sign * (int)(state.colour.b * amount);
+	}
+
+	// Chunk colours are all white without lighting
+	if (lighting_enabled && footprint.tiles.size() > 0) {
+		relight_chunks(footprint.topleft, footprint.bottomright);
+	}
 }
 
-void Tilemap::set_lighting_parameters(bool indoors, int outdoor_effect, SDL_Colour ambient_light)
+void Tilemap::relight_chunks(Point<int> topleft, Point<int> bottomright)
 {
-	this->indoors = indoors;
-	this->outdoor_effect = outdoor_effect;
-	this->ambient_light = ambient_light;
+	int start_cx = topleft.x / CHUNK_SIZE;
+	int start_cy = topleft.y / CHUNK_SIZE;
+	int end_cx = bottomright.x / CHUNK_SIZE;
+	int end_cy = bottomright.y / CHUNK_SIZE;
+
+	for (int layer = 0; layer < num_layers; layer++) {
+		for (int cy = start_cy; cy <= end_cy; cy++) {
+			for (int cx = start_cx; cx <= end_cx; cx++) {
+				layers[layer].chunks[cy * num_chunks.w + cx].lit = false;
+			}
+		}
+	}
 }
 
 float Tilemap::get_z(int layer, int x, int y)
@@ -2,124 +2,143 @@
 
 namespace Nooskewl_Engine {
 
-static int utf8_size(unsigned const char *p)
+UTF8_Iterator::UTF8_Iterator() :
+	p(0),
+	ch(0),
+	size(0)
 {
-	unsigned char ch = *p;
+}
 
-	if (ch == 0) {
-		return 0;
-	}
+UTF8_Iterator::UTF8_Iterator(const char *text) :
+	p((const unsigned char *)text)
+{
+	decode();
+}
 
-	if ((ch & 0x80) == 0) {
-		return 1;
-	}
-	else if ((ch & 0xE0) == 0xC0) {
-		return 2;
-	}
-	else if ((ch & 0xF0) == 0xE0) {
-		return 3;
-	}
-	else if ((ch & 0xF8) == 0xF0) {
-		return 4;
-	}
-	else if ((ch & 0xFC) == 0xF8) {
-		return 5;
-	}
-	else {
-		return 6;
-	}
+UTF8_Iterator::UTF8_Iterator(const std::string &text, int offset) :
+	p((const unsigned char *)text.c_str() + offset)
+{
+	decode();
+}
+
+const Uint32 &UTF8_Iterator::operator*() const
+{
+	return ch;
+}
+
+UTF8_Iterator &UTF8_Iterator::operator++()
+{
+	p += size;
+	decode();
+	return *this;
+}
+
+UTF8_Iterator UTF8_Iterator::operator++(int)
+{
+	UTF8_Iterator tmp = *this;
+	++*this;
+	return tmp;
+}
+
+bool UTF8_Iterator::operator==(const UTF8_Iterator &rhs) const
+{
+	return p == rhs.p;
+}
+
+bool UTF8_Iterator::operator!=(const UTF8_Iterator &rhs) const
+{
+	return p != rhs.p;
+}
+
+const char *UTF8_Iterator::get_pointer() const
+{
+	return (const char *)p;
 }
 
-static Uint32 utf8_next(unsigned const char *p)
+int UTF8_Iterator::get_size() const
 {
-	unsigned char ch = *p;
-	Uint32 result;
+	return size;
+}
+
+void UTF8_Iterator::decode()
+{
+	if (p == 0 || *p == 0) {
+		ch = 0;
+		size = 0;
+		return;
+	}
+
+	unsigned char lead = *p;
+	int bytes;
 
-	if ((ch & 0x80) == 0) {
-		result = *p;
+	if ((lead & 0x80) == 0) {
+		ch = lead;
+		size = 1;
+		return;
 	}
-	else if ((ch & 0xE0) == 0xC0) {
-		unsigned char a = *p++;
-		unsigned char b = *p;
-		result = ((a & 0x1F) << 6) | (b & 0x3F);
+	else if ((lead & 0xE0) == 0xC0) {
+		ch = lead & 0x1F;
+		bytes = 2;
 	}
-	else if ((ch & 0xF0) == 0xE0) {
-		unsigned char a = *p++;
-		unsigned char b = *p++;
-		unsigned char c = *p;
-		result = ((a & 0xF) << 12) | ((b & 0x3F) << 6) | (c & 0x3F);
+	else if ((lead & 0xF0) == 0xE0) {
+		ch = lead & 0xF;
+		bytes = 3;
 	}
-	else if ((ch & 0xF8) == 0xF0) {
-		unsigned char a = *p++;
-		unsigned char b = *p++;
-		unsigned char c = *p++;
-		unsigned char d = *p;
-		result = ((a & 0x7) << 18) | ((b & 0x3F) << 12) | ((c & 0x3F) << 6) | (d & 0x3F);
+	else if ((lead & 0xF8) == 0xF0) {
+		ch = lead & 0x7;
+		bytes = 4;
 	}
-	else if ((ch & 0xFC) == 0xF8) {
-		unsigned char a = *p++;
-		unsigned char b = *p++;
-		unsigned char c = *p++;
-		unsigned char d = *p++;
-		unsigned char e = *p;
-		result = ((a & 0x3) << 24) | ((b & 0x3F) << 18) | ((c & 0x3F) << 12) | ((d & 0x3F) << 6) | (e & 0x3F);
+	else if ((lead & 0xFC) == 0xF8) {
+		ch = lead & 0x3;
+		bytes = 5;
 	}
-	else if ((ch & 0xFE) == 0xFC) {
-		unsigned char a = *p++;
-		unsigned char b = *p++;
-		unsigned char c = *p++;
-		unsigned char d = *p++;
-		unsigned char e = *p++;
-		unsigned char f = *p;
-		result = ((a & 0x1) << 30) | ((b & 0x3F) << 24) | ((c & 0x3F) << 18) | ((d & 0x3F) << 12) | ((e & 0x3F) << 6) | (e & 0x3F);
+	else {
+		ch = lead & 0x1;
+		bytes = 6;
 	}
 
-	return result;
+	// A truncated character ends at the 0 so the end is never skipped
+	size = 1;
+	while (size < bytes && p[size] != 0) {
+		ch = (ch << 6) | (p[size] & 0x3F);
+		size++;
+	}
 }
 
-int utf8_len(std::string text)
+UTF8_Index::UTF8_Index(const std::string &text) :
+	text(text)
 {
-	unsigned const char *p = (unsigned const char *)text.c_str();
-	int len = 0;
-
-	while (*p != 0) {
-		len++;
-		p += utf8_size(p);
+	UTF8_Iterator it(text);
+	while (*it != 0) {
+		offsets.push_back(it.get_pointer() - text.c_str());
+		++it;
 	}
-
-	return len;
+	offsets.push_back(it.get_pointer() - text.c_str());
 }
 
-Uint32 utf8_char_next(std::string text, int &offset)
+int UTF8_Index::get_length() const
 {
-	unsigned const char *p = (unsigned const char *)text.c_str() + offset;
-
-	Uint32 result = utf8_next(p);
-
-	offset += utf8_size(p);
-
-	return result;
+	return offsets.size() - 1;
 }
 
-Uint32 utf8_char(std::string text, int i)
+int UTF8_Index::get_offset(int i) const
 {
-	unsigned const char *p = (unsigned const char *)text.c_str();
-
-	for (int count = 0; count < i; count++) {
-		int size = utf8_size(p);
-		if (size == 0) {
-			return 0;
-		}
-		p += size;
-	}
+	return offsets[MAX(0, MIN(i, get_length()))];
+}
 
-	return utf8_next(p);
+Uint32 UTF8_Index::get_char(int i) const
+{
+	return *get_iterator(i);
 }
 
-std::string utf8_char_to_string(Uint32 ch)
+UTF8_Iterator UTF8_Index::get_iterator(int i) const
 {
-	unsigned char buf[7] = { 0 };
+	return UTF8_Iterator(text, get_offset(i));
+}
 
+int utf8_encode(Uint32 ch, char buf[7])
+{
+	unsigned char *out = (unsigned char *)buf;
 	int bytes;
 
 	if (ch & 0xF7000000) {
@@ -142,68 +161,56 @@ std::string utf8_char_to_string(Uint32 ch)
 	}
 
 	if (bytes == 1) {
-		buf[0] = (unsigned char)ch;
-	}
-	else if (bytes == 2) {
-		buf[1] = (ch & 0x3F) | 0x80;
-		ch >>= 6;
-		buf[0] = (ch & 0x1F) | 0xC0;
+		out[0] = (unsigned char)ch;
 	}
-	else if (bytes == 3) {
-		buf[2] = (ch & 0x3F) | 0x80;
-		ch >>= 6;
-		buf[1] = (ch & 0x3F) | 0x80;
-		ch >>= 6;
-		buf[0] = (ch & 0xF) | 0xE0;
-	}
-	else if (bytes == 4) {
-		buf[3] = (ch & 0x3F) | 0x80;
-		ch >>= 6;
-		buf[2] = (ch & 0x3F) | 0x80;
-		ch >>= 6;
-		buf[1] = (ch & 0x3F) | 0x80;
-		ch >>= 6;
-		buf[0] = (ch & 0x7) | 0xF0;
-	}
-	else if (bytes == 5) {
-		buf[4] = (ch & 0x3F) | 0x80;
-		ch >>= 6;
-		buf[3] = (ch & 0x3F) | 0x80;
-		ch >>= 6;
-		buf[2] = (ch & 0x3F) | 0x80;
-		ch >>= 6;
-		buf[1] = (ch & 0x3F) | 0x80;
-		ch >>= 6;
-		buf[0] = (ch & 0x3) | 0xF8;
+	else {
+		// Lead byte has bytes 1s then a 0, then what's left of ch
+		static const unsigned char leads[7] = { 0, 0, 0xC0, 0xE0, 0xF0, 0xF8, 0xFC };
+		for (int i = bytes-1; i > 0; i--) {
+			out[i] = (ch & 0x3F) | 0x80;
+			ch >>= 6;
+		}
+		out[0] = (unsigned char)((ch & (0x7F >> bytes)) | leads[bytes]);
 	}
-	else if (bytes == 6) {
-		buf[5] = (ch & 0x3F) | 0x80;
-		ch >>= 6;
-		buf[4] = (ch & 0x3F) | 0x80;
-		ch >>= 6;
-		buf[3] = (ch & 0x3F) | 0x80;
-		ch >>= 6;
-		buf[2] = (ch & 0x3F) | 0x80;
-		ch >>= 6;
-		buf[1] = (ch & 0x3F) | 0x80;
-		ch >>= 6;
-		buf[0] = (ch & 0x1) | 0xFC;
+
+	out[bytes] = 0;
+
+	return bytes;
+}
+
+int utf8_len(const std::string &text)
+{
+	int len = 0;
+
+	for (UTF8_Iterator it(text); *it != 0; ++it) {
+		len++;
 	}
 
-	return std::string((char *)buf);
+	return len;
+}
+
+std::string utf8_char_to_string(Uint32 ch)
+{
+	char buf[7];
+	utf8_encode(ch, buf);
+	return std::string(buf);
 }
 
-std::string utf8_substr(std::string s, int start, int len)
+std::string utf8_substr(const std::string &s, int start, int len)
 {
-	std::string result;
+	UTF8_Iterator it(s);
 
-	int total_len = utf8_len(s);
+	for (int i = 0; i < start && *it != 0; i++) {
+		++it;
+	}
 
-	for (int i = start, count = 0; i < total_len && (len == -1 || count < len); i++, count++) {
-		result += utf8_char_to_string(utf8_char(s, i));
+	const char *begin = it.get_pointer();
+
+	for (int i = 0; (len == -1 || i < len) && *it != 0; i++) {
+		++it;
 	}
 
-	return result;
+	return std::string(begin, it.get_pointer() - begin);
 }
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,166 @@
+#include "Nooskewl_Engine/engine.h"
+#include "Nooskewl_Engine/error.h"
+#include "Nooskewl_Engine/internal.h"
+#include "Nooskewl_Engine/shader.h"
+#include "Nooskewl_Engine/vertex_buffer.h"
+#include "Nooskewl_Engine/vertex_cache.h"
+
+using namespace Nooskewl_Engine;
+
+Vertex_Buffer::Vertex_Buffer(float *vertices, int count) :
+	count(count),
+	vertex_buffer(0),
+	colour_buffer(0)
+{
+	std::vector<float> white(count * 4, 1.0f);
+
+	if (noo.opengl) {
+		glGenBuffers(1, &vertex_buffer);
+		printGLerror("glGenBuffers");
+		glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+		printGLerror("glBindBuffer");
+		glBufferData(GL_ARRAY_BUFFER, count * 5 * sizeof(GLfloat), vertices, GL_STATIC_DRAW);
+		printGLerror("glBufferData");
+
+		glGenBuffers(1, &colour_buffer);
+		printGLerror("glGenBuffers");
+		glBindBuffer(GL_ARRAY_BUFFER, colour_buffer);
+		printGLerror("glBindBuffer");
+		glBufferData(GL_ARRAY_BUFFER, count * 4 * sizeof(GLfloat), &white[0], GL_DYNAMIC_DRAW);
+		printGLerror("glBufferData");
+
+		// Leave nothing bound for whoever draws next
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		printGLerror("glBindBuffer");
+	}
+#ifdef NOOSKEWL_ENGINE_WINDOWS
+	else {
+		this->vertices = new float[count * 9];
+		for (int i = 0; i < count; i++) {
+			memcpy(&this->vertices[i*9], &vertices[i*5], 5 * sizeof(float));
+		}
+		set_colours(&white[0]);
+	}
+#endif
+}
+
+Vertex_Buffer::~Vertex_Buffer()
+{
+	if (noo.opengl) {
+		glDeleteBuffers(1, &vertex_buffer);
+		printGLerror("glDeleteBuffers");
+		glDeleteBuffers(1, &colour_buffer);
+		printGLerror("glDeleteBuffers");
+	}
+#ifdef NOOSKEWL_ENGINE_WINDOWS
+	else {
+		delete[] vertices;
+	}
+#endif
+}
+
+int Vertex_Buffer::get_count()
+{
+	return count;
+}
+
+void Vertex_Buffer::set_colours(float *colours)
+{
+	if (noo.opengl) {
+		glBindBuffer(GL_ARRAY_BUFFER, colour_buffer);
+		printGLerror("glBindBuffer");
+		glBufferSubData(GL_ARRAY_BUFFER, 0, count * 4 * sizeof(GLfloat), colours);
+		printGLerror("glBufferSubData");
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		printGLerror("glBindBuffer");
+	}
+#ifdef NOOSKEWL_ENGINE_WINDOWS
+	else {
+		for (int i = 0; i < count; i++) {
+			memcpy(&vertices[i*9+5], &colours[i*4], 4 * sizeof(float));
+		}
+	}
+#endif
+}
+
+void Vertex_Buffer::draw(int first, int count)
+{
+	if (count <= 0) {
+		return;
+	}
+
+	m.vertex_cache->count_draw_call();
+
+	if (noo.opengl) {
+		GLint pos_attrib = noo.current_shader->get_opengl_attribute(Shader::POSITION);
+		if (pos_attrib == -1) {
+			throw Error("No in_position attribute in shader");
+		}
+		// These are -1 if the shader doesn't use them, and are left alone
+		GLint texcoord_attrib = noo.current_shader->get_opengl_attribute(Shader::TEXCOORD);
+		GLint colour_attrib = noo.current_shader->get_opengl_attribute(Shader::COLOUR);
+
+		glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+		printGLerror("glBindBuffer");
+
+		glEnableVertexAttribArray(pos_attrib);
+		printGLerror("glEnableVertexAttribArray (in_position)");
+		glVertexAttribPointer(pos_attrib, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid *)0);
+		printGLerror("glVertexAttribPointer (in_position)");
+
+		if (texcoord_attrib != -1) {
+			glEnableVertexAttribArray(texcoord_attrib);
+			printGLerror("glEnableVertexAttribArray (in_texcoord)");
+			glVertexAttribPointer(texcoord_attrib, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid *)(3 * sizeof(GLfloat)));
+			printGLerror("glVertexAttribPointer (in_texcoord)");
+		}
+
+		if (colour_attrib != -1) {
+			glBindBuffer(GL_ARRAY_BUFFER, colour_buffer);
+			printGLerror("glBindBuffer");
+
+			glEnableVertexAttribArray(colour_attrib);
+			printGLerror("glEnableVertexAttribArray (in_colour)");
+			glVertexAttribPointer(colour_attrib, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (GLvoid *)0);
+			printGLerror("glVertexAttribPointer (in_colour)");
+		}
+
+		glDrawArrays(GL_TRIANGLES, first, count);
+		printGLerror("glDrawArrays");
+
+		glDisableVertexAttribArray(pos_attrib);
+		printGLerror("glDisableVertexAttribArray");
+
+		if (texcoord_attrib != -1) {
+			glDisableVertexAttribArray(texcoord_attrib);
+			printGLerror("glDisableVertexAttribArray");
+		}
+
+		if (colour_attrib != -1) {
+			glDisableVertexAttribArray(colour_attrib);
+			printGLerror("glDisableVertexAttribArray");
+		}
+
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		printGLerror("glBindBuffer");
+	}
+#ifdef NOOSKEWL_ENGINE_WINDOWS
+	else {
+		if (noo.d3d_lost) {
+			return;
+		}
+		LPD3DXEFFECT d3d_effect = noo.current_shader->get_d3d_effect();
+		unsigned int required_passes;
+		d3d_effect->Begin(&required_passes, 0);
+		for (unsigned int i = 0; i < required_passes; i++) {
+			d3d_effect->BeginPass(i);
+			if (noo.d3d_device->DrawPrimitiveUP(D3DPT_TRIANGLELIST, count / 3, (void *)&vertices[first*9], 9*sizeof(float)) != D3D_OK) {
+				infomsg("DrawPrimitiveUP failed\n");
+				return;
+			}
+			d3d_effect->EndPass();
+		}
+		d3d_effect->End();
+	}
+#endif
+}
@@ -17,96 +17,196 @@ Vertex_Cache::Vertex_Cache() :
 	total(0),
 	perspective_drawing(false),
 	repeat(false),
-	font_scaling(false)
+	font_scaling(false),
+	current_buffer(0),
+	index_buffer(0),
+	draw_calls(0)
 {
+	for (int i = 0; i < NUM_BUFFERS; i++) {
+		buffers[i] = 0;
+		buffer_sizes[i] = 0;
+	}
+
+	use_tex_uniform = Shader::get_uniform("use_tex");
+	tex_uniform = Shader::get_uniform("tex");
 }
 
 Vertex_Cache::~Vertex_Cache()
 {
+	if (noo.opengl && buffers[0] != 0) {
+		glDeleteBuffers(NUM_BUFFERS, buffers);
+		printGLerror("glDeleteBuffers");
+		glDeleteBuffers(1, &index_buffer);
+		printGLerror("glDeleteBuffers");
+	}
+
 	free(vertices);
 }
 
 void Vertex_Cache::init()
 {
 	maybe_resize_cache(256);
+
+	// Every quad is 4 vertices drawn as 2 triangles, a b c and a c d
+	indices.resize(MAX_QUADS * 6);
+	for (int i = 0; i < MAX_QUADS; i++) {
+		Uint16 *q = &indices[i*6];
+		Uint16 first = i * 4;
+		q[0] = first;
+		q[1] = first + 1;
+		q[2] = first + 2;
+		q[3] = first;
+		q[4] = first + 2;
+		q[5] = first + 3;
+	}
+
+	if (noo.opengl) {
+		glGenBuffers(NUM_BUFFERS, buffers);
+		printGLerror("glGenBuffers");
+
+		glGenBuffers(1, &index_buffer);
+		printGLerror("glGenBuffers");
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+		printGLerror("glBindBuffer");
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(Uint16), &indices[0], GL_STATIC_DRAW);
+		printGLerror("glBufferData");
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		printGLerror("glBindBuffer");
+	}
 }
 
 void Vertex_Cache::start(bool repeat)
 {
 	image = 0;
 	this->repeat = repeat;
-	noo.current_shader->set_bool("use_tex", false);
-	noo.current_shader->set_texture("tex", 0);
+	noo.current_shader->set_bool(use_tex_uniform, false);
+	noo.current_shader->set_texture(tex_uniform, 0);
 }
 
 void Vertex_Cache::start(Image *image, bool repeat)
 {
 	this->image = image;
 	this->repeat = repeat;
-	noo.current_shader->set_bool("use_tex", true);
-	noo.current_shader->set_texture("tex", image);
+	noo.current_shader->set_bool(use_tex_uniform, true);
+	noo.current_shader->set_texture(tex_uniform, image);
 }
 
 void Vertex_Cache::end()
 {
-	if (noo.opengl) {
-		GLuint opengl_shader = noo.current_shader->get_opengl_shader();
+	if (count == 0) {
+		return;
+	}
 
-		GLint pos_attrib = glGetAttribLocation(opengl_shader, "in_position");
-		printGLerror("glGetAttribLocation (in_position)");
+	int num_quads = count / 4;
+
+	if (noo.opengl) {
+		GLint pos_attrib = noo.current_shader->get_opengl_attribute(Shader::POSITION);
 		if (pos_attrib == -1) {
 			throw Error("No in_position attribute in shader");
 		}
+		// These are -1 if the shader doesn't use them, and are left alone
+		GLint texcoord_attrib = noo.current_shader->get_opengl_attribute(Shader::TEXCOORD);
+		GLint colour_attrib = noo.current_shader->get_opengl_attribute(Shader::COLOUR);
+
+		// Next buffer in the ring, orphaned first so the driver can hand us
+		// fresh memory instead of waiting for the GPU to finish with it
+		GLuint buffer = buffers[current_buffer];
+		int size = MAX(count, buffer_sizes[current_buffer]);
+
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		printGLerror("glBindBuffer");
+		glBufferData(GL_ARRAY_BUFFER, size * sizeof(Vertex), 0, GL_STREAM_DRAW);
+		printGLerror("glBufferData");
+		glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(Vertex), vertices);
+		printGLerror("glBufferSubData");
+
+		buffer_sizes[current_buffer] = size;
+		current_buffer = (current_buffer + 1) % NUM_BUFFERS;
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+		printGLerror("glBindBuffer");
+
 		glEnableVertexAttribArray(pos_attrib);
 		printGLerror("glEnableVertexAttribArray (in_position)");
-		glVertexAttribPointer(pos_attrib, 3, GL_FLOAT, GL_FALSE, 9 * sizeof(GLfloat), vertices);
-		printGLerror("glVertexAttribPointer (in_position)");
-
-		GLint texcoord_attrib = glGetAttribLocation(opengl_shader, "in_texcoord");
-		printGLerror("glGetAttribLocation (in_texcoord)");
-		if (pos_attrib == -1) {
-			throw Error("No in_texcoord attribute in shader");
+		if (texcoord_attrib != -1) {
+			glEnableVertexAttribArray(texcoord_attrib);
+			printGLerror("glEnableVertexAttribArray (in_texcoord)");
 		}
-		glEnableVertexAttribArray(texcoord_attrib);
-		printGLerror("glEnableVertexAttribArray (in_texcoord)");
-		glVertexAttribPointer(texcoord_attrib, 2, GL_FLOAT, GL_FALSE, 9 * sizeof(float), &vertices[3]);
-		printGLerror("glVertexAttribPointer (in_texcoord)");
-
-		GLint colour_attrib = glGetAttribLocation(opengl_shader, "in_colour");
-		printGLerror("glGetAttribLocation (in_colour)");
-		if (pos_attrib == -1) {
-			throw Error("No in_colour attribute in shader");
+		if (colour_attrib != -1) {
+			glEnableVertexAttribArray(colour_attrib);
+			printGLerror("glEnableVertexAttribArray (in_colour)");
 		}
-		glEnableVertexAttribArray(colour_attrib);
-		printGLerror("glEnableVertexAttribArray (in_colour)");
-		glVertexAttribPointer(colour_attrib, 4, GL_FLOAT, GL_FALSE, 9 * sizeof(float), &vertices[5]);
-		printGLerror("glVertexAttribPointer (in_colour)");
 
-		glDrawArrays(GL_TRIANGLES, 0, count);
-		printGLerror("glDrawArrays");
+		// 16 bit indices only reach so far, past that the attributes are moved along
+		for (int first = 0; first < num_quads; first += MAX_QUADS) {
+			int n = MIN(MAX_QUADS, num_quads - first);
+			size_t base = first * 4 * sizeof(Vertex);
+
+			glVertexAttribPointer(pos_attrib, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid *)(base + offsetof(Vertex, x)));
+			printGLerror("glVertexAttribPointer (in_position)");
+			if (texcoord_attrib != -1) {
+				glVertexAttribPointer(texcoord_attrib, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid *)(base + offsetof(Vertex, u)));
+				printGLerror("glVertexAttribPointer (in_texcoord)");
+			}
+			if (colour_attrib != -1) {
+				// Still a vec4 of 0-1 in the shader, GL does the divide
+				glVertexAttribPointer(colour_attrib, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (GLvoid *)(base + offsetof(Vertex, colour)));
+				printGLerror("glVertexAttribPointer (in_colour)");
+			}
+
+			glDrawElements(GL_TRIANGLES, n * 6, GL_UNSIGNED_SHORT, 0);
+			printGLerror("glDrawElements");
+		}
 
 		glDisableVertexAttribArray(pos_attrib);
 		printGLerror("glDisableVertexAttribArray");
 
-		glDisableVertexAttribArray(texcoord_attrib);
-		printGLerror("glDisableVertexAttribArray");
+		if (texcoord_attrib != -1) {
+			glDisableVertexAttribArray(texcoord_attrib);
+			printGLerror("glDisableVertexAttribArray");
+		}
 
-		glDisableVertexAttribArray(colour_attrib);
-		printGLerror("glDisableVertexAttribArray");
+		if (colour_attrib != -1) {
+			glDisableVertexAttribArray(colour_attrib);
+			printGLerror("glDisableVertexAttribArray");
+		}
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		printGLerror("glBindBuffer");
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		printGLerror("glBindBuffer");
 	}
 #ifdef NOOSKEWL_ENGINE_WINDOWS
 	else {
 		if (noo.d3d_lost) {
 			return;
 		}
+		// The effects take colours as floats in the second texture coordinate
+		d3d_vertices.resize(count * 9);
+		for (int i = 0; i < count; i++) {
+			Vertex &v = vertices[i];
+			float *f = &d3d_vertices[i*9];
+			f[0] = v.x;
+			f[1] = v.y;
+			f[2] = v.z;
+			f[3] = v.u;
+			f[4] = v.v;
+			f[5] = v.colour.r / 255.0f;
+			f[6] = v.colour.g / 255.0f;
+			f[7] = v.colour.b / 255.0f;
+			f[8] = v.colour.a / 255.0f;
+		}
 		LPD3DXEFFECT d3d_effect = noo.current_shader->get_d3d_effect();
 		unsigned int required_passes;
 		d3d_effect->Begin(&required_passes, 0);
 		for (unsigned int i = 0; i < required_passes; i++) {
 			d3d_effect->BeginPass(i);
-			if (noo.d3d_device->DrawPrimitiveUP(D3DPT_TRIANGLELIST, count / 3, (void *)vertices, 9*sizeof(float)) != D3D_OK) {
-				infomsg("DrawPrimitiveUP failed\n");
-				return;
+			for (int first = 0; first < num_quads; first += MAX_QUADS) {
+				int n = MIN(MAX_QUADS, num_quads - first);
+				if (noo.d3d_device->DrawIndexedPrimitiveUP(D3DPT_TRIANGLELIST, 0, n * 4, n * 2, (void *)&indices[0], D3DFMT_INDEX16, (void *)&d3d_vertices[first*4*9], 9*sizeof(float)) != D3D_OK) {
+					infomsg("DrawIndexedPrimitiveUP failed\n");
+					return;
+				}
 			}
 			d3d_effect->EndPass();
 		}
@@ -115,6 +215,8 @@ void Vertex_Cache::end()
 #endif
 
 	count = 0;
+
+	draw_calls++;
 }
 
 void Vertex_Cache::enable_perspective_drawing(Size<int> screen_size)
@@ -133,85 +235,69 @@ void Vertex_Cache::enable_font_scaling(bool enable)
 	font_scaling = enable;
 }
 
-void Vertex_Cache::cache(SDL_Colour vertex_colours[3], Point<float> da, Point<float> db, Point<float> dc)
+void Vertex_Cache::get_transform(Point<float> &scale, Point<float> &translation)
 {
-	maybe_resize_cache(256);
-
-	float scale;
-
-	if (font_scaling) {
-		scale = noo.font_scale;
-	}
-	else if ((noo.target_image && noo.target_image != noo.work_image) || image == noo.work_image) {
-		scale = 1.0f;
+	// Same as cache_z does to each destination position
+	if (perspective_drawing) {
+		scale = Point<float>(6.0f / screen_size.w, 6.0f / screen_size.h);
+		translation = Point<float>(-3.0f, -3.0f);
 	}
 	else {
-		scale = noo.scale;
+		float s = get_scale();
+		scale = Point<float>(s, s);
+		translation = Point<float>(0.0f, 0.0f);
 	}
+}
 
-	// Set vertex x, y
-	vertices[9*(count+0)+0] = (float)da.x * scale;
-	vertices[9*(count+0)+1] = (float)da.y * scale;
-	vertices[9*(count+1)+0] = (float)db.x * scale;
-	vertices[9*(count+1)+1] = (float)db.y * scale;
-	vertices[9*(count+2)+0] = (float)dc.x * scale;
-	vertices[9*(count+2)+1] = (float)dc.y * scale;
+void Vertex_Cache::count_draw_call()
+{
+	draw_calls++;
+}
 
-	for (int i = 0; i < 3; i++) {
-		vertices[9*(count+i)+2] = 0.0f; // set vertex z
-	}
+int Vertex_Cache::get_draw_calls()
+{
+	return draw_calls;
+}
+
+void Vertex_Cache::reset_draw_calls()
+{
+	draw_calls = 0;
+}
+
+void Vertex_Cache::cache(SDL_Colour vertex_colours[3], Point<float> da, Point<float> db, Point<float> dc)
+{
+	maybe_resize_cache(256);
 
-	vertices[9*(count+0)+5+0] = (float)vertex_colours[0].r / 255.0f;
-	vertices[9*(count+0)+5+1] = (float)vertex_colours[0].g / 255.0f;
-	vertices[9*(count+0)+5+2] = (float)vertex_colours[0].b / 255.0f;
-	vertices[9*(count+0)+5+3] = (float)vertex_colours[0].a / 255.0f;
+	float scale = get_scale();
 
-	vertices[9*(count+1)+5+0] = (float)vertex_colours[1].r / 255.0f;
-	vertices[9*(count+1)+5+1] = (float)vertex_colours[1].g / 255.0f;
-	vertices[9*(count+1)+5+2] = (float)vertex_colours[1].b / 255.0f;
-	vertices[9*(count+1)+5+3] = (float)vertex_colours[1].a / 255.0f;
+	Vertex *v = &vertices[count];
 
-	vertices[9*(count+2)+5+0] = (float)vertex_colours[2].r / 255.0f;
-	vertices[9*(count+2)+5+1] = (float)vertex_colours[2].g / 255.0f;
-	vertices[9*(count+2)+5+2] = (float)vertex_colours[2].b / 255.0f;
-	vertices[9*(count+2)+5+3] = (float)vertex_colours[2].a / 255.0f;
+	// Drawn as a quad with the last corner doubled up so the second triangle is empty
+	set_position(v[0], da.x * scale, da.y * scale, 0.0f);
+	set_position(v[1], db.x * scale, db.y * scale, 0.0f);
+	set_position(v[2], dc.x * scale, dc.y * scale, 0.0f);
+	set_position(v[3], dc.x * scale, dc.y * scale, 0.0f);
+
+	for (int i = 0; i < 3; i++) {
+		v[i].colour = vertex_colours[i];
+	}
+	v[3].colour = vertex_colours[2];
 
-	count += 3;
+	count += 4;
 }
 
 void Vertex_Cache::cache(SDL_Colour vertex_colours[4], Point<float> source_position, Size<float> source_size, Point<float> da, Point<float> db, Point<float> dc, Point<float> dd, int flags)
 {
 	maybe_resize_cache(256);
 
-	float scale;
+	float scale = get_scale();
 
-	if (font_scaling) {
-		scale = noo.font_scale;
-	}
-	else if ((noo.target_image && noo.target_image != noo.work_image) || image == noo.work_image) {
-		scale = 1.0f;
-	}
-	else {
-		scale = noo.scale;
-	}
+	Vertex *v = &vertices[count];
 
-	// Set vertex x, y
-	vertices[9*(count+0)+0] = (float)da.x * scale;
-	vertices[9*(count+0)+1] = (float)da.y * scale;
-	vertices[9*(count+1)+0] = (float)db.x * scale;
-	vertices[9*(count+1)+1] = (float)db.y * scale;
-	vertices[9*(count+2)+0] = (float)dc.x * scale;
-	vertices[9*(count+2)+1] = (float)dc.y * scale;
-	vertices[9*(count+3)+0] = (float)da.x * scale;
-	vertices[9*(count+3)+1] = (float)da.y * scale;
-	vertices[9*(count+4)+0] = (float)dc.x * scale;
-	vertices[9*(count+4)+1] = (float)dc.y * scale;
-	vertices[9*(count+5)+0] = (float)dd.x * scale;
-	vertices[9*(count+5)+1] = (float)dd.y * scale;
-
-	for (int i = 0; i < 6; i++) {
-		vertices[9*(count+i)+2] = 0.0f; // set vertex z
-	}
+	set_position(v[0], da.x * scale, da.y * scale, 0.0f);
+	set_position(v[1], db.x * scale, db.y * scale, 0.0f);
+	set_position(v[2], dc.x * scale, dc.y * scale, 0.0f);
+	set_position(v[3], dd.x * scale, dd.y * scale, 0.0f);
 
 	if (image) {
 		float sx = (float)source_position.x;
@@ -240,52 +326,12 @@ void Vertex_Cache::cache(SDL_Colour vertex_colours[4], Point<float> source_posit
 			tv2 = tmp;
 		}
 
-		// texture coordinates
-		vertices[9*(count+0)+3] = tu;
-		vertices[9*(count+0)+4] = tv;
-		vertices[9*(count+1)+3] = tu2;
-		vertices[9*(count+1)+4] = tv;
-		vertices[9*(count+2)+3] = tu2;
-		vertices[9*(count+2)+4] = tv2;
-		vertices[9*(count+3)+3] = tu;
-		vertices[9*(count+3)+4] = tv;
-		vertices[9*(count+4)+3] = tu2;
-		vertices[9*(count+4)+4] = tv2;
-		vertices[9*(count+5)+3] = tu;
-		vertices[9*(count+5)+4] = tv2;
+		set_texcoords(v, tu, tv, tu2, tv2);
 	}
 
-	vertices[9*(count+0)+5+0] = (float)vertex_colours[0].r / 255.0f;
-	vertices[9*(count+0)+5+1] = (float)vertex_colours[0].g / 255.0f;
-	vertices[9*(count+0)+5+2] = (float)vertex_colours[0].b / 255.0f;
-	vertices[9*(count+0)+5+3] = (float)vertex_colours[0].a / 255.0f;
-
-	vertices[9*(count+1)+5+0] = (float)vertex_colours[1].r / 255.0f;
-	vertices[9*(count+1)+5+1] = (float)vertex_colours[1].g / 255.0f;
-	vertices[9*(count+1)+5+2] = (float)vertex_colours[1].b / 255.0f;
-	vertices[9*(count+1)+5+3] = (float)vertex_colours[1].a / 255.0f;
-
-	vertices[9*(count+2)+5+0] = (float)vertex_colours[2].r / 255.0f;
-	vertices[9*(count+2)+5+1] = (float)vertex_colours[2].g / 255.0f;
-	vertices[9*(count+2)+5+2] = (float)vertex_colours[2].b / 255.0f;
-	vertices[9*(count+2)+5+3] = (float)vertex_colours[2].a / 255.0f;
-
-	vertices[9*(count+3)+5+0] = (float)vertex_colours[0].r / 255.0f;
-	vertices[9*(count+3)+5+1] = (float)vertex_colours[0].g / 255.0f;
-	vertices[9*(count+3)+5+2] = (float)vertex_colours[0].b / 255.0f;
-	vertices[9*(count+3)+5+3] = (float)vertex_colours[0].a / 255.0f;
-
-	vertices[9*(count+4)+5+0] = (float)vertex_colours[2].r / 255.0f;
-	vertices[9*(count+4)+5+1] = (float)vertex_colours[2].g / 255.0f;
-	vertices[9*(count+4)+5+2] = (float)vertex_colours[2].b / 255.0f;
-	vertices[9*(count+4)+5+3] = (float)vertex_colours[2].a / 255.0f;
-
-	vertices[9*(count+5)+5+0] = (float)vertex_colours[3].r / 255.0f;
-	vertices[9*(count+5)+5+1] = (float)vertex_colours[3].g / 255.0f;
-	vertices[9*(count+5)+5+2] = (float)vertex_colours[3].b / 255.0f;
-	vertices[9*(count+5)+5+3] = (float)vertex_colours[3].a / 255.0f;
-
-	count += 6;
+	set_colours(v, vertex_colours);
+
+	count += 4;
 }
 
 void Vertex_Cache::cache_z(SDL_Colour vertex_colours[4], Point<float> source_position, Size<float> source_size, Point<float> dest_position, float z, Size<float> dest_size, int flags)
@@ -312,17 +358,7 @@ void Vertex_Cache::cache_z(SDL_Colour vertex_colours[4], Point<float> source_pos
 		dy2 *= 6.0f;
 	}
 	else {
-		float scale;
-
-		if (font_scaling) {
-			scale = noo.font_scale;
-		}
-		else if ((noo.target_image && noo.target_image != noo.work_image) || image == noo.work_image) {
-			scale = 1.0f;
-		}
-		else {
-			scale = noo.scale;
-		}
+		float scale = get_scale();
 
 		dx *= scale;
 		dy *= scale;
@@ -330,23 +366,12 @@ void Vertex_Cache::cache_z(SDL_Colour vertex_colours[4], Point<float> source_pos
 		dy2 *= scale;
 	}
 
-	// Set vertex x, y
-	vertices[9*(count+0)+0] = dx;
-	vertices[9*(count+0)+1] = dy;
-	vertices[9*(count+1)+0] = dx2;
-	vertices[9*(count+1)+1] = dy;
-	vertices[9*(count+2)+0] = dx2;
-	vertices[9*(count+2)+1] = dy2;
-	vertices[9*(count+3)+0] = dx;
-	vertices[9*(count+3)+1] = dy;
-	vertices[9*(count+4)+0] = dx2;
-	vertices[9*(count+4)+1] = dy2;
-	vertices[9*(count+5)+0] = dx;
-	vertices[9*(count+5)+1] = dy2;
-
-	for (int i = 0; i < 6; i++) {
-		vertices[9*(count+i)+2] = z; // set vertex z
-	}
+	Vertex *v = &vertices[count];
+
+	set_position(v[0], dx, dy, z);
+	set_position(v[1], dx2, dy, z);
+	set_position(v[2], dx2, dy2, z);
+	set_position(v[3], dx, dy2, z);
 
 	if (image) {
 		float tu, tv, tu2, tv2;
@@ -390,52 +415,12 @@ void Vertex_Cache::cache_z(SDL_Colour vertex_colours[4], Point<float> source_pos
 			}
 		}
 
-		// texture coordinates
-		vertices[9*(count+0)+3] = tu;
-		vertices[9*(count+0)+4] = tv;
-		vertices[9*(count+1)+3] = tu2;
-		vertices[9*(count+1)+4] = tv;
-		vertices[9*(count+2)+3] = tu2;
-		vertices[9*(count+2)+4] = tv2;
-		vertices[9*(count+3)+3] = tu;
-		vertices[9*(count+3)+4] = tv;
-		vertices[9*(count+4)+3] = tu2;
-		vertices[9*(count+4)+4] = tv2;
-		vertices[9*(count+5)+3] = tu;
-		vertices[9*(count+5)+4] = tv2;
+		set_texcoords(v, tu, tv, tu2, tv2);
 	}
 
-	vertices[9*(count+0)+5+0] = (float)vertex_colours[0].r / 255.0f;
-	vertices[9*(count+0)+5+1] = (float)vertex_colours[0].g / 255.0f;
-	vertices[9*(count+0)+5+2] = (float)vertex_colours[0].b / 255.0f;
-	vertices[9*(count+0)+5+3] = (float)vertex_colours[0].a / 255.0f;
-
-	vertices[9*(count+1)+5+0] = (float)vertex_colours[1].r / 255.0f;
-	vertices[9*(count+1)+5+1] = (float)vertex_colours[1].g / 255.0f;
-	vertices[9*(count+1)+5+2] = (float)vertex_colours[1].b / 255.0f;
-	vertices[9*(count+1)+5+3] = (float)vertex_colours[1].a / 255.0f;
-
-	vertices[9*(count+2)+5+0] = (float)vertex_colours[2].r / 255.0f;
-	vertices[9*(count+2)+5+1] = (float)vertex_colours[2].g / 255.0f;
-	vertices[9*(count+2)+5+2] = (float)vertex_colours[2].b / 255.0f;
-	vertices[9*(count+2)+5+3] = (float)vertex_colours[2].a / 255.0f;
-
-	vertices[9*(count+3)+5+0] = (float)vertex_colours[0].r / 255.0f;
-	vertices[9*(count+3)+5+1] = (float)vertex_colours[0].g / 255.0f;
-	vertices[9*(count+3)+5+2] = (float)vertex_colours[0].b / 255.0f;
-	vertices[9*(count+3)+5+3] = (float)vertex_colours[0].a / 255.0f;
-
-	vertices[9*(count+4)+5+0] = (float)vertex_colours[2].r / 255.0f;
-	vertices[9*(count+4)+5+1] = (float)vertex_colours[2].g / 255.0f;
-	vertices[9*(count+4)+5+2] = (float)vertex_colours[2].b / 255.0f;
-	vertices[9*(count+4)+5+3] = (float)vertex_colours[2].a / 255.0f;
-
-	vertices[9*(count+5)+5+0] = (float)vertex_colours[3].r / 255.0f;
-	vertices[9*(count+5)+5+1] = (float)vertex_colours[3].g / 255.0f;
-	vertices[9*(count+5)+5+2] = (float)vertex_colours[3].b / 255.0f;
-	vertices[9*(count+5)+5+3] = (float)vertex_colours[3].a / 255.0f;
-
-	count += 6;
+	set_colours(v, vertex_colours);
+
+	count += 4;
 }
 
 void Vertex_Cache::cache(SDL_Colour vertex_colours[4], Point<float> source_position, Size<float> source_size, Point<float> dest_position, Size<float> dest_size, int flags)
@@ -443,6 +428,19 @@ void Vertex_Cache::cache(SDL_Colour vertex_colours[4], Point<float> source_posit
 	cache_z(vertex_colours, source_position, source_size, dest_position, 0.0f, dest_size, flags);
 }
 
+float Vertex_Cache::get_scale()
+{
+	if (font_scaling) {
+		return noo.font_scale;
+	}
+	else if ((noo.target_image && noo.target_image != noo.work_image) || image == noo.work_image) {
+		return 1.0f;
+	}
+	else {
+		return noo.scale;
+	}
+}
+
 void Vertex_Cache::maybe_resize_cache(int increase)
 {
 	if (total - count >= increase/2) {
@@ -450,10 +448,10 @@ void Vertex_Cache::maybe_resize_cache(int increase)
 	}
 
 	if (vertices == 0) {
-		vertices = (float *)malloc(sizeof(float)*9*increase);
+		vertices = (Vertex *)malloc(sizeof(Vertex)*increase);
 	}
 	else {
-		vertices = (float *)realloc(vertices, sizeof(float)*9*(total+increase));
+		vertices = (Vertex *)realloc(vertices, sizeof(Vertex)*(total+increase));
 	}
 	if (vertices == 0) {
 		throw MemoryError("out of memory in maybe_resize_cache");
@@ -461,3 +459,30 @@ void Vertex_Cache::maybe_resize_cache(int increase)
 
 	total += increase;
 }
+
+void Vertex_Cache::set_position(Vertex &v, float x, float y, float z)
+{
+	v.x = x;
+	v.y = y;
+	v.z = z;
+}
+
+void Vertex_Cache::set_texcoords(Vertex *v, float tu, float tv, float tu2, float tv2)
+{
+	// Same corners as the positions: top left, top right, bottom right, bottom left
+	v[0].u = tu;
+	v[0].v = tv;
+	v[1].u = tu2;
+	v[1].v = tv;
+	v[2].u = tu2;
+	v[2].v = tv2;
+	v[3].u = tu;
+	v[3].v = tv2;
+}
+
+void Vertex_Cache::set_colours(Vertex *v, SDL_Colour vertex_colours[4])
+{
+	for (int i = 0; i < 4; i++) {
+		v[i].colour = vertex_colours[i];
+	}
+}
@@ -1,7 +1,22 @@
 #!/bin/sh
 
+# Writes a version 2 archive with mkcpa2 (build it from mkcpa2.c and put it in
+# your PATH). Use "mkcpa.sh -v1 out.cpa" for an old gzipped version 1 archive.
+
+V1=0
+if [ "$1" = "-v1" ]; then
+	V1=1
+	shift
+fi
+
 FILES=`find * -type f | grep -v LICENSE.txt | grep -v README.txt | grep -v "^flp" | sort`
 
+if [ $V1 = 0 ]; then
+	echo "Writing archive..."
+	for f in $FILES; do echo $f; done | mkcpa2 $1
+	exit $?
+fi
+
 echo "Writing header..."
 # the big space is a tab
 du -bc $FILES | grep "	total$" | cut -f1 > $1
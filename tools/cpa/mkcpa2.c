@@ -0,0 +1,183 @@
+/* Writes a version 2 CPA archive. Reads the list of files to store from
+ * stdin, one per line, and writes the archive to the file given on the
+ * command line. Each file is deflated on its own and stored as is if that
+ * doesn't make it smaller. See src/Nooskewl_Engine/cpa.cpp for the layout.
+ *
+ * Build with: cc -o mkcpa2 mkcpa2.c -lz
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#define HEADER_SIZE 16
+#define ENTRY_SIZE 24
+
+struct Entry {
+	char *name;
+	unsigned int name_offset;
+	unsigned int name_length;
+	unsigned int data_offset;
+	unsigned int stored_size;
+	unsigned int size;
+	unsigned int flags;
+};
+
+static void write_le32(FILE *f, unsigned int n)
+{
+	fputc(n & 0xff, f);
+	fputc((n >> 8) & 0xff, f);
+	fputc((n >> 16) & 0xff, f);
+	fputc((n >> 24) & 0xff, f);
+}
+
+/* FNV-1a, must match CPA::hash_name */
+static unsigned int hash_name(const char *name, unsigned int length)
+{
+	unsigned int hash = 2166136261u;
+	unsigned int i;
+	for (i = 0; i < length; i++) {
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static unsigned char *read_file(const char *filename, unsigned int *size)
+{
+	FILE *f = fopen(filename, "rb");
+	if (f == NULL) {
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	*size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	unsigned char *bytes = malloc(*size + 1);
+	if (fread(bytes, 1, *size, f) != *size) {
+		free(bytes);
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+	return bytes;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 2) {
+		printf("Usage: %s <out.cpa> < filelist.txt\n", argv[0]);
+		return 0;
+	}
+
+	struct Entry *entries = NULL;
+	unsigned int num_entries = 0;
+	unsigned int names_size = 0;
+	char buf[1000];
+
+	while (fgets(buf, 1000, stdin) != NULL) {
+		int len = strlen(buf);
+		while (len > 0 && (buf[len-1] == '\n' || buf[len-1] == '\r')) {
+			buf[--len] = 0;
+		}
+		if (len == 0) {
+			continue;
+		}
+		entries = realloc(entries, (num_entries+1) * sizeof(struct Entry));
+		entries[num_entries].name = strdup(buf);
+		entries[num_entries].name_offset = names_size;
+		entries[num_entries].name_length = len;
+		names_size += len;
+		num_entries++;
+	}
+
+	FILE *out = fopen(argv[1], "wb");
+	if (out == NULL) {
+		printf("Can't open %s\n", argv[1]);
+		return 1;
+	}
+
+	/* Hash table with at least half the slots empty so misses stop early */
+	unsigned int num_slots = 2;
+	while (num_slots < num_entries * 2) {
+		num_slots *= 2;
+	}
+	unsigned int *slots = calloc(num_slots * 2, sizeof(unsigned int));
+	unsigned int i;
+
+	for (i = 0; i < num_entries; i++) {
+		unsigned int hash = hash_name(entries[i].name, entries[i].name_length);
+		unsigned int slot = hash & (num_slots - 1);
+		while (slots[slot*2+1] != 0) {
+			slot = (slot + 1) & (num_slots - 1);
+		}
+		slots[slot*2] = hash;
+		slots[slot*2+1] = i + 1;
+	}
+
+	unsigned int padded_names_size = (names_size + 3) & ~3;
+	unsigned int offset = HEADER_SIZE + num_entries * ENTRY_SIZE + padded_names_size + num_slots * 8;
+
+	/* Data first, the index is filled in once the sizes are known */
+	fseek(out, offset, SEEK_SET);
+
+	for (i = 0; i < num_entries; i++) {
+		struct Entry *e = &entries[i];
+		unsigned char *bytes = read_file(e->name, &e->size);
+		if (bytes == NULL) {
+			printf("Can't read %s\n", e->name);
+			return 1;
+		}
+		uLongf compressed_size = compressBound(e->size);
+		unsigned char *compressed = malloc(compressed_size);
+		if (compress2(compressed, &compressed_size, bytes, e->size, Z_BEST_COMPRESSION) == Z_OK && compressed_size < e->size) {
+			fwrite(compressed, 1, compressed_size, out);
+			e->stored_size = compressed_size;
+			e->flags = 1;
+		}
+		else {
+			fwrite(bytes, 1, e->size, out);
+			e->stored_size = e->size;
+			e->flags = 0;
+		}
+		e->data_offset = offset;
+		offset += e->stored_size;
+		free(compressed);
+		free(bytes);
+	}
+
+	fseek(out, 0, SEEK_SET);
+
+	fwrite("CPA2", 1, 4, out);
+	write_le32(out, num_entries);
+	write_le32(out, names_size);
+	write_le32(out, num_slots);
+
+	for (i = 0; i < num_entries; i++) {
+		struct Entry *e = &entries[i];
+		write_le32(out, e->name_offset);
+		write_le32(out, e->name_length);
+		write_le32(out, e->data_offset);
+		write_le32(out, e->stored_size);
+		write_le32(out, e->size);
+		write_le32(out, e->flags);
+	}
+
+	for (i = 0; i < num_entries; i++) {
+		fwrite(entries[i].name, 1, entries[i].name_length, out);
+	}
+	for (i = names_size; i < padded_names_size; i++) {
+		fputc(0, out);
+	}
+
+	for (i = 0; i < num_slots * 2; i++) {
+		write_le32(out, slots[i]);
+	}
+
+	fclose(out);
+
+	printf("Wrote %u files, %u bytes\n", num_entries, offset);
+
+	return 0;
+}